@@ -0,0 +1,160 @@
+// 检查慢请求工作池(main/async_handler.c)：排队、队列满时回503、统计数字。
+//
+// 用法: ./async_handler_test
+//
+// main/async_handler.c is built unchanged against shim/ (FreeRTOS on pthreads,
+// a fake httpd that only records responses). The handler blocks until the
+// test opens a gate, so the test can occupy every worker, fill the queue and
+// check that one more request is answered with 503 and Retry-After while the
+// depth, busy and rejected counters match. After the gate opens every queued
+// request must complete, the counters must drain back to zero and the time
+// spent waiting must show up in wait_us/max_wait_us. Exits 1 on any failure.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "async_handler.h"
+#include "esp_timer.h"
+
+#define HOLD_MS 20 // 排队的请求至少等这么久
+#define TIMEOUT_MS 2000
+#define REQUEST_COUNT (ASYNC_WORKER_COUNT + ASYNC_QUEUE_LEN + 1)
+
+static pthread_mutex_t s_gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_gate_open = PTHREAD_COND_INITIALIZER;
+static bool s_open = false;
+static atomic_int s_calls;
+static atomic_int s_calls_on_worker;
+static atomic_int s_calls_on_copy;
+static int s_failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);                   \
+      s_failures++;                                                            \
+    }                                                                          \
+  } while (0)
+
+static esp_err_t slow_handler(httpd_req_t *req) {
+  if (!async_handler_on_worker()) {
+    return async_handler_submit(req, slow_handler);
+  }
+  atomic_fetch_add(&s_calls, 1);
+  atomic_fetch_add(&s_calls_on_worker, async_handler_on_worker());
+  atomic_fetch_add(&s_calls_on_copy, req->orig != NULL);
+  pthread_mutex_lock(&s_gate_lock);
+  while (!s_open) {
+    pthread_cond_wait(&s_gate_open, &s_gate_lock);
+  }
+  pthread_mutex_unlock(&s_gate_lock);
+  return httpd_resp_send(req, "ok", 2);
+}
+
+static esp_err_t inline_handler(httpd_req_t *req) {
+  atomic_fetch_add(&s_calls, 1);
+  return httpd_resp_send(req, "ok", 2);
+}
+
+// 等到统计满足条件，超时返回false
+static bool wait_for(bool (*done)(const async_handler_stats_t *)) {
+  int64_t deadline = esp_timer_get_time() + TIMEOUT_MS * 1000LL;
+  async_handler_stats_t stats;
+  do {
+    async_handler_get_stats(&stats);
+    if (done(&stats)) {
+      return true;
+    }
+    usleep(1000);
+  } while (esp_timer_get_time() < deadline);
+  return false;
+}
+
+static bool all_busy(const async_handler_stats_t *s) {
+  return s->busy == ASYNC_WORKER_COUNT;
+}
+
+static bool all_completed(const async_handler_stats_t *s) {
+  return s->completed == ASYNC_WORKER_COUNT + ASYNC_QUEUE_LEN;
+}
+
+int main(void) {
+  // 没有初始化时在调用者的任务中直接处理
+  httpd_req_t early = {.uri = "/early"};
+  CHECK(async_handler_submit(&early, inline_handler) == ESP_OK);
+  CHECK(atomic_load(&s_calls) == 1 && early.sent && !early.detached);
+  atomic_store(&s_calls, 0);
+
+  CHECK(async_handler_init() == ESP_OK);
+  CHECK(!async_handler_on_worker());
+
+  httpd_req_t reqs[REQUEST_COUNT];
+  char uris[REQUEST_COUNT][16];
+  for (int i = 0; i < REQUEST_COUNT; i++) {
+    snprintf(uris[i], sizeof(uris[i]), "/slow%d", i);
+    reqs[i] = (httpd_req_t){.uri = uris[i]};
+  }
+
+  // 先占满所有工作任务，再填满队列
+  for (int i = 0; i < ASYNC_WORKER_COUNT; i++) {
+    CHECK(slow_handler(&reqs[i]) == ESP_OK);
+  }
+  CHECK(wait_for(all_busy));
+  for (int i = ASYNC_WORKER_COUNT; i < REQUEST_COUNT - 1; i++) {
+    CHECK(slow_handler(&reqs[i]) == ESP_OK);
+  }
+  async_handler_stats_t stats;
+  async_handler_get_stats(&stats);
+  CHECK(stats.depth == ASYNC_QUEUE_LEN);
+  CHECK(stats.max_depth == ASYNC_QUEUE_LEN);
+  CHECK(stats.busy == ASYNC_WORKER_COUNT);
+  CHECK(stats.rejected == 0);
+
+  // 再来一个：马上回503，请求已经结束
+  httpd_req_t *last = &reqs[REQUEST_COUNT - 1];
+  CHECK(slow_handler(last) == ESP_OK);
+  CHECK(last->status && !strcmp(last->status, "503 Service Unavailable"));
+  CHECK(last->retry_after && !strcmp(last->retry_after, "1"));
+  CHECK(last->sent && last->completed);
+  async_handler_get_stats(&stats);
+  CHECK(stats.rejected == 1);
+  CHECK(stats.submitted == REQUEST_COUNT);
+  CHECK(stats.depth == ASYNC_QUEUE_LEN);
+
+  usleep(HOLD_MS * 1000);
+  pthread_mutex_lock(&s_gate_lock);
+  s_open = true;
+  pthread_cond_broadcast(&s_gate_open);
+  pthread_mutex_unlock(&s_gate_lock);
+
+  CHECK(wait_for(all_completed));
+  async_handler_get_stats(&stats);
+  CHECK(stats.depth == 0);
+  CHECK(stats.busy == 0);
+  CHECK(stats.rejected == 1);
+  CHECK(stats.max_depth == ASYNC_QUEUE_LEN);
+  CHECK(stats.max_wait_us >= HOLD_MS * 1000);
+  CHECK(stats.wait_us >= (uint64_t)ASYNC_QUEUE_LEN * HOLD_MS * 1000);
+  int handled = ASYNC_WORKER_COUNT + ASYNC_QUEUE_LEN;
+  CHECK(atomic_load(&s_calls) == handled);
+  CHECK(atomic_load(&s_calls_on_worker) == handled);
+  CHECK(atomic_load(&s_calls_on_copy) == handled);
+  for (int i = 0; i < handled; i++) {
+    CHECK(reqs[i].detached && reqs[i].sent && reqs[i].completed);
+    CHECK(reqs[i].status == NULL);
+  }
+
+  printf("submitted %u, completed %u, rejected %u, max depth %u, "
+         "max wait %.1fms\n",
+         stats.submitted, stats.completed, stats.rejected, stats.max_depth,
+         stats.max_wait_us / 1000.0);
+  if (s_failures) {
+    printf("%d checks failed\n", s_failures);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,124 @@
+// 测量人脸特征库(main/face_db.c)的查询耗时随登记人数的变化。
+//
+// 用法: ./face_db_bench [queries]
+//
+// 没有真实的特征数据，用随机向量模拟：每个人一个随机的单位向量，
+// 登记和查询时各加一点噪声（同一个人两次拍照的差别）。
+// For every database size the bench reports the average query time of a
+// full scan and of the IVF index, and how often IVF returns the same match
+// as the full scan (recall). Timings are host timings: compare sizes and
+// modes with each other, not with the device.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "face_db.h"
+
+#define NOISE 0.35f // 噪声相对于单位向量的大小
+
+static float gauss(void) {
+  float u = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+  float v = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+  return sqrtf(-2 * logf(u)) * cosf(2 * (float)M_PI * v);
+}
+
+static void random_unit(float *v) {
+  float norm = 0;
+  for (int i = 0; i < FACE_DB_DIM; i++) {
+    v[i] = gauss();
+    norm += v[i] * v[i];
+  }
+  norm = sqrtf(norm);
+  for (int i = 0; i < FACE_DB_DIM; i++) {
+    v[i] /= norm;
+  }
+}
+
+// 同一个人的另一张照片
+static void sample(const float *person, int8_t *out) {
+  float v[FACE_DB_DIM];
+  float scale = NOISE / sqrtf(FACE_DB_DIM);
+  for (int i = 0; i < FACE_DB_DIM; i++) {
+    v[i] = person[i] + gauss() * scale;
+  }
+  face_db_quantize(v, out);
+}
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv) {
+  static const int sizes[] = {7, 50, 100, 200, 300, 500};
+  int queries = argc > 1 ? atoi(argv[1]) : 2000;
+  int max = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+  srand(1);
+
+  float *people = malloc((size_t)max * FACE_DB_DIM * sizeof(float));
+  int8_t(*probe)[FACE_DB_DIM] = malloc((size_t)queries * FACE_DB_DIM);
+  int *probe_id = malloc(queries * sizeof(int));
+  face_db_t db;
+  if (!people || !probe || !probe_id || face_db_init(&db, max, NULL) != 0) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for (int p = 0; p < max; p++) {
+    random_unit(people + (size_t)p * FACE_DB_DIM);
+  }
+
+  printf("%6s %10s %10s %8s %8s\n", "faces", "scan(us)", "ivf(us)", "recall",
+         "correct");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    int n = sizes[s];
+    face_db_free(&db);
+    face_db_init(&db, n, NULL);
+    int8_t q[FACE_DB_DIM];
+    for (int p = 0; p < n; p++) {
+      sample(people + (size_t)p * FACE_DB_DIM, q);
+      face_db_enroll(&db, q, "");
+    }
+    for (int i = 0; i < queries; i++) {
+      probe_id[i] = rand() % n;
+      sample(people + (size_t)probe_id[i] * FACE_DB_DIM, probe[i]);
+    }
+
+    face_db_match_t *scan = malloc(queries * sizeof(face_db_match_t));
+    double t0 = now_us();
+    for (int i = 0; i < queries; i++) {
+      face_db_search(&db, probe[i], &scan[i]);
+    }
+    double scan_us = (now_us() - t0) / queries;
+    int correct = 0;
+    for (int i = 0; i < queries; i++) {
+      correct += scan[i].id == probe_id[i] + 1; // ids start at 1
+    }
+
+    if (face_db_build_index(&db) != 0) {
+      printf("%6d %10.2f %10s %8s %7.1f%%\n", n, scan_us, "-", "-",
+             100.0 * correct / queries);
+      free(scan);
+      continue;
+    }
+    int same = 0;
+    face_db_match_t m;
+    t0 = now_us();
+    for (int i = 0; i < queries; i++) {
+      face_db_search(&db, probe[i], &m);
+      same += m.id == scan[i].id;
+    }
+    double ivf_us = (now_us() - t0) / queries;
+    printf("%6d %10.2f %10.2f %7.1f%% %7.1f%%\n", n, scan_us, ivf_us,
+           100.0 * same / queries, 100.0 * correct / queries);
+    free(scan);
+  }
+
+  face_db_free(&db);
+  free(people);
+  free(probe);
+  free(probe_id);
+  return 0;
+}
@@ -0,0 +1,134 @@
+// 测量软件缩放(main/img_scale.c)的耗时，并和浮点的参考实现比较误差。
+//
+// 用法: ./img_scale_bench [rounds]
+//
+// 源图是随机噪声加渐变的RGB565帧（驱动的字节序）。
+// For each source/target pair the bench reports the time per scale and the
+// largest per-channel difference from a double precision box filter, which
+// should stay at most 1 (the fixed-point rounding); the bench exits 1 when it
+// does not. The flat cases scale a uniform mid-gray UXGA frame down to a few
+// pixels, where every block averages hundreds of thousands of pixels and a
+// coarse reciprocal shows up as a brighter or black result. Timings are host
+// timings: compare sizes with each other, not with the device.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "img_scale.h"
+
+typedef struct {
+  int src_w, src_h;
+  img_rect_t roi; // w == 0: whole frame
+  int dst_w, dst_h;
+  bool flat; // 整幅都是r/g/b 16/32/16，不加噪声
+} bench_case_t;
+
+static const bench_case_t s_cases[] = {
+    {240, 240, {0, 0, 0, 0}, 96, 96},
+    {240, 240, {60, 60, 120, 120}, 120, 120},
+    {320, 240, {0, 0, 0, 0}, 96, 72},
+    {640, 480, {0, 0, 0, 0}, 160, 120},
+    {640, 480, {100, 50, 333, 257}, 100, 77},
+    {1600, 1200, {0, 0, 0, 0}, 96, 72},
+    {1600, 1200, {0, 0, 0, 0}, 800, 600},
+    {1600, 1200, {0, 0, 0, 0}, 16, 12, true},
+    {1600, 1200, {0, 0, 0, 0}, 4, 3, true},
+    {1600, 1200, {0, 0, 0, 0}, 1, 1, true},
+};
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint16_t pixel(const uint8_t *buf, int i) {
+  return (buf[i * 2] << 8) | buf[i * 2 + 1];
+}
+
+// 和img_scale_rgb565()同样的块划分，用double求平均
+static int max_error(const uint8_t *src, int width, const img_rect_t *roi,
+                     const uint8_t *dst, int dst_w, int dst_h) {
+  int worst = 0;
+  for (int oy = 0; oy < dst_h; oy++) {
+    int y0 = roi->y + oy * roi->h / dst_h;
+    int y1 = roi->y + (oy + 1) * roi->h / dst_h;
+    for (int ox = 0; ox < dst_w; ox++) {
+      int x0 = roi->x + ox * roi->w / dst_w;
+      int x1 = roi->x + (ox + 1) * roi->w / dst_w;
+      double sum[3] = {0, 0, 0};
+      for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+          uint16_t p = pixel(src, y * width + x);
+          sum[0] += p >> 11;
+          sum[1] += (p >> 5) & 0x3F;
+          sum[2] += p & 0x1F;
+        }
+      }
+      double area = (double)(x1 - x0) * (y1 - y0);
+      uint16_t q = pixel(dst, oy * dst_w + ox);
+      int got[3] = {q >> 11, (q >> 5) & 0x3F, q & 0x1F};
+      for (int c = 0; c < 3; c++) {
+        int err = abs(got[c] - (int)lround(sum[c] / area));
+        if (err > worst) {
+          worst = err;
+        }
+      }
+    }
+  }
+  return worst;
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 20;
+  srand(1);
+  int worst = 0;
+  printf("%-11s %-20s %-9s %10s %6s\n", "source", "roi", "output",
+         "us/scale", "error");
+  for (size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+    const bench_case_t *c = &s_cases[i];
+    uint8_t *src = (uint8_t *)malloc(c->src_w * c->src_h * 2);
+    uint8_t *dst = (uint8_t *)malloc(c->dst_w * c->dst_h * 2);
+    for (int y = 0; y < c->src_h; y++) {
+      for (int x = 0; x < c->src_w; x++) {
+        int r = c->flat ? 16 : (x * 31 / c->src_w + rand() % 4) & 0x1F;
+        int g = c->flat ? 32 : (y * 63 / c->src_h + rand() % 8) & 0x3F;
+        int b = c->flat ? 16 : rand() & 0x1F;
+        uint16_t p = (r << 11) | (g << 5) | b;
+        src[(y * c->src_w + x) * 2] = p >> 8;
+        src[(y * c->src_w + x) * 2 + 1] = p & 0xFF;
+      }
+    }
+    img_rect_t roi = c->roi;
+    if (roi.w == 0) {
+      roi = (img_rect_t){0, 0, c->src_w, c->src_h};
+    }
+
+    double start = now_us();
+    for (int r = 0; r < rounds; r++) {
+      if (img_scale_rgb565(src, c->src_w, c->src_h, &roi, dst, c->dst_w,
+                           c->dst_h) != 0) {
+        fprintf(stderr, "scale failed\n");
+        return 1;
+      }
+    }
+    double us = (now_us() - start) / rounds;
+
+    char source[16], rect[24], output[16];
+    snprintf(source, sizeof(source), "%dx%d", c->src_w, c->src_h);
+    snprintf(rect, sizeof(rect), "%d,%d,%d,%d", roi.x, roi.y, roi.w, roi.h);
+    snprintf(output, sizeof(output), "%dx%d", c->dst_w, c->dst_h);
+    int err = max_error(src, c->src_w, &roi, dst, c->dst_w, c->dst_h);
+    printf("%-11s %-20s %-9s %10.0f %6d%s\n", source, rect, output, us, err,
+           c->flat ? " (flat)" : "");
+    if (err > worst) {
+      worst = err;
+    }
+    free(src);
+    free(dst);
+  }
+  return worst > 1 ? 1 : 0;
+}
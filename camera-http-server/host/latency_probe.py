@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+# 测量视频流每一帧的延迟：拍照 -> 发布 -> 开始发送 -> 电脑收到。
+#
+# 用法: ./latency_probe.py <ip> [-n 300] [--csv frames.csv]
+#
+# 连接 /stream?probe=1，设备在每个part头里写上帧序号和设备上的时刻
+# (X-Capture-Us / X-Publish-Us / X-Send-Us，esp_timer微秒)。
+# The device clock is mapped to the host clock with NTP-style round trips to
+# /time before and after the run (the sample with the smallest round trip
+# wins, drift is interpolated linearly), so network delay is only as accurate
+# as half the best round trip, which is printed. capture->publish and
+# publish->send are measured on the device alone and are exact.
+# Only the Python standard library is used.
+
+import argparse
+import csv
+import http.client
+import json
+import socket
+import sys
+import time
+
+STAGES = [
+    ("capture->publish", "capture", "publish"),  # encode + motion gate
+    ("publish->send", "publish", "send"),  # waiting in the client slot
+    ("send->header", "send", "header"),  # network, first bytes
+    ("send->received", "send", "received"),  # network, whole frame
+    ("capture->received", "capture", "received"),  # end to end
+]
+
+
+def host_us():
+    return time.monotonic_ns() // 1000
+
+
+def sync_clock(host, port, rounds):
+    """Returns (offset, rtt): device_us - offset is the host time."""
+    best = None
+    for _ in range(rounds):
+        conn = http.client.HTTPConnection(host, port, timeout=5)
+        conn.connect()  # 不把建立连接的时间算进往返时间
+        t0 = host_us()
+        conn.request("GET", "/time")
+        device_us = json.loads(conn.getresponse().read())["device_us"]
+        t1 = host_us()
+        conn.close()
+        if best is None or t1 - t0 < best[1]:
+            best = (device_us - (t0 + t1) // 2, t1 - t0)
+    return best
+
+
+def read_parts(sock):
+    """Yields (headers, header_us, received_us, length) for each part."""
+    buf = b""
+    while True:
+        while b"\r\n\r\n" not in buf:
+            data = sock.recv(65536)
+            if not data:
+                return
+            buf += data
+        header_us = host_us()
+        head, buf = buf.split(b"\r\n\r\n", 1)
+        headers = {}
+        for line in head.split(b"\r\n"):
+            if b":" in line:
+                key, value = line.split(b":", 1)
+                headers[key.strip().lower().decode()] = value.strip().decode()
+        length = int(headers.get("content-length", 0))
+        while len(buf) < length:
+            data = sock.recv(65536)
+            if not data:
+                return
+            buf += data
+        yield headers, header_us, host_us(), length
+        buf = buf[length:]
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="video stream latency probe")
+    parser.add_argument("host")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("-n", "--frames", type=int, default=300)
+    parser.add_argument("--sync-rounds", type=int, default=20)
+    parser.add_argument("--csv", help="write one row per frame")
+    args = parser.parse_args()
+
+    start_offset, start_rtt = sync_clock(args.host, args.port, args.sync_rounds)
+    start_us = host_us()
+
+    sock = socket.create_connection((args.host, args.port), timeout=10)
+    sock.sendall(
+        b"GET /stream?probe=1 HTTP/1.1\r\nHost: %s\r\n\r\n" % args.host.encode()
+    )
+    frames = []
+    for headers, header_us, received_us, length in read_parts(sock):
+        if "x-frame-seq" not in headers:
+            continue  # 开启探测模式之前开始发送的帧
+        frames.append(
+            {
+                "seq": int(headers["x-frame-seq"]),
+                "bytes": length,
+                "capture": int(headers["x-capture-us"]),
+                "publish": int(headers["x-publish-us"]),
+                "send": int(headers["x-send-us"]),
+                "header": header_us,
+                "received": received_us,
+            }
+        )
+        if len(frames) >= args.frames:
+            break
+    sock.close()
+    if not frames:
+        sys.exit("no probe frames received")
+
+    end_offset, end_rtt = sync_clock(args.host, args.port, args.sync_rounds)
+    end_us = host_us()
+    # 设备时间换算成电脑时间，两次对时之间线性插值
+    for f in frames:
+        k = (f["header"] - start_us) / max(1, end_us - start_us)
+        offset = start_offset + (end_offset - start_offset) * k
+        for key in ("capture", "publish", "send"):
+            f[key] = int(f[key] - offset)
+
+    seqs = [f["seq"] for f in frames]
+    missing = seqs[-1] - seqs[0] + 1 - len(set(seqs))
+    secs = (frames[-1]["received"] - frames[0]["received"]) / 1e6
+    print(
+        "%d frames, %.1f fps, %d B/frame, %d seq gaps (dropped for this client)"
+        % (
+            len(frames),
+            (len(frames) - 1) / secs if secs > 0 else 0,
+            sum(f["bytes"] for f in frames) // len(frames),
+            missing,
+        )
+    )
+    print(
+        "clock sync: best rtt %.1f/%.1f ms, drift %+d us over the run"
+        % (start_rtt / 1e3, end_rtt / 1e3, end_offset - start_offset)
+    )
+    print("%-18s %8s %8s %8s %8s  (ms)" % ("stage", "p50", "p90", "p99", "max"))
+    for name, a, b in STAGES:
+        values = [(f[b] - f[a]) / 1e3 for f in frames]
+        print(
+            "%-18s %8.1f %8.1f %8.1f %8.1f"
+            % (
+                name,
+                percentile(values, 50),
+                percentile(values, 90),
+                percentile(values, 99),
+                max(values),
+            )
+        )
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=list(frames[0].keys()))
+            writer.writeheader()
+            writer.writerows(frames)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,193 @@
+// 在电脑上用录下来的画面回放运动检测门控(main/motion_detect.c)，
+// 用来调 STREAM_MOTION_THRESHOLD / STREAM_MOTION_MIN_BLOCKS。
+//
+// 用法: ./motion_replay [-w 240 -h 240] [-t 8] [-b 3] [-k 15] <frame>...
+//
+// 每个文件是一帧，按参数顺序回放：
+//   *.bmp  从 /bmp 下载的24位BMP，例如
+//          for i in $(seq -w 1 200); do curl -s -o f$i.bmp http://<ip>/bmp; done
+//   其他   esp32-camera的RGB565原始数据（高字节在前），需要 -w/-h
+// -k 是保活间隔（帧数），与 STREAM_KEEPALIVE_MS * STREAM_TARGET_FPS 对应。
+//
+// Prints one line per frame (changed blocks and the gate decision) and a
+// summary with the share of frames that would have been encoded and sent.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "motion_detect.h"
+
+static uint8_t *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *buf = size > 0 ? (uint8_t *)malloc(size) : NULL;
+  if (!buf || fread(buf, 1, size, f) != (size_t)size) {
+    fprintf(stderr, "%s: read failed\n", path);
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  *len = size;
+  return buf;
+}
+
+static uint32_t le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// 24位BMP转灰度，权重与motion_detect.c中RGB565的一致
+static uint8_t *bmp_to_gray(const uint8_t *bmp, size_t len, int *width,
+                            int *height) {
+  if (len < 54 || bmp[0] != 'B' || bmp[1] != 'M' || le32(bmp + 28) != 24) {
+    return NULL;
+  }
+  uint32_t offset = le32(bmp + 10);
+  int w = (int32_t)le32(bmp + 18);
+  int h = (int32_t)le32(bmp + 22);
+  int top_down = h < 0;
+  if (top_down) {
+    h = -h;
+  }
+  size_t stride = ((size_t)w * 3 + 3) & ~(size_t)3;
+  if (w <= 0 || offset + stride * h > len) {
+    return NULL;
+  }
+  uint8_t *gray = (uint8_t *)malloc((size_t)w * h);
+  if (!gray) {
+    return NULL;
+  }
+  for (int y = 0; y < h; y++) {
+    const uint8_t *row = bmp + offset + stride * (top_down ? y : h - 1 - y);
+    for (int x = 0; x < w; x++) {
+      // BMP里是BGR
+      uint32_t b = row[x * 3], g = row[x * 3 + 1], r = row[x * 3 + 2];
+      gray[(size_t)y * w + x] = (r * 77 + g * 150 + b * 29) >> 8;
+    }
+  }
+  *width = w;
+  *height = h;
+  return gray;
+}
+
+static int is_bmp(const char *path) {
+  size_t n = strlen(path);
+  return n > 4 && strcmp(path + n - 4, ".bmp") == 0;
+}
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: motion_replay [-w width -h height] [-t threshold] "
+                  "[-b min_blocks] [-k keepalive_frames] <frame>...\n");
+}
+
+int main(int argc, char **argv) {
+  int width = 0, height = 0;
+  int threshold = 8, min_blocks = 3, keepalive = 15;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    int v = atoi(argv[i + 1]);
+    switch (argv[i][1]) {
+    case 'w':
+      width = v;
+      break;
+    case 'h':
+      height = v;
+      break;
+    case 't':
+      threshold = v;
+      break;
+    case 'b':
+      min_blocks = v;
+      break;
+    case 'k':
+      keepalive = v;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  if (i >= argc) {
+    usage();
+    return 1;
+  }
+
+  motion_detect_t md;
+  motion_detect_init(&md, threshold, min_blocks);
+  int frames = 0, sent = 0, keepalives = 0, since_sent = 0;
+  double detect_us = 0;
+
+  printf("%5s %7s  %s\n", "frame", "changed", "decision");
+  for (; i < argc; i++) {
+    size_t len;
+    uint8_t *buf = read_file(argv[i], &len);
+    if (!buf) {
+      continue;
+    }
+    int changed = -1;
+    double t0 = now_us();
+    if (is_bmp(argv[i])) {
+      int w, h;
+      uint8_t *gray = bmp_to_gray(buf, len, &w, &h);
+      if (gray) {
+        t0 = now_us();
+        changed = motion_detect_gray(&md, gray, w, h);
+        free(gray);
+      } else {
+        fprintf(stderr, "%s: not a 24 bit BMP\n", argv[i]);
+      }
+    } else if ((size_t)width * height * 2 == len) {
+      changed = motion_detect_rgb565(&md, buf, width, height);
+    } else {
+      fprintf(stderr, "%s: %zu bytes, expected %dx%d RGB565\n", argv[i], len,
+              width, height);
+    }
+    detect_us += now_us() - t0;
+    free(buf);
+    if (changed < 0) {
+      continue;
+    }
+
+    // 与stream_hub.c中motion_gate_pass()的判断相同
+    const char *decision = "skip";
+    int pass = 1;
+    frames++;
+    since_sent++;
+    if (motion_detect_moved(&md)) {
+      decision = "send";
+    } else if (since_sent >= keepalive) {
+      decision = "keepalive";
+      keepalives++;
+    } else {
+      pass = 0;
+    }
+    if (pass) {
+      motion_detect_accept(&md);
+      sent++;
+      since_sent = 0;
+    }
+    printf("%5d %7d  %s\n", frames, changed, decision);
+  }
+
+  if (frames == 0) {
+    return 1;
+  }
+  printf("\n%d frames, %d sent (%d keepalive), %.1f%% of encodes saved, "
+         "detect %.1fus/frame\n",
+         frames, sent, keepalives, 100.0 * (frames - sent) / frames,
+         detect_us / frames);
+  return 0;
+}
@@ -0,0 +1,174 @@
+// 在电脑上回放带宽变化曲线，观察码率控制器(main/rate_control.c)的表现。
+//
+// 用法: ./rate_control_sim <trace> [target_fps]
+//
+// trace文件每行是 "<duration_ms> <kbps>"，#开头的行是注释。
+// 程序模拟单个客户端时的串行流程（最坏情况，不考虑stream_hub中采集和发送的并行）：
+// 等待传感器出图 -> 编码jpg -> 发送，每秒打印一行统计。
+//
+// The frame size and encode time models below are rough fits for an OV2640
+// in RGB565 on the ESP32-S3; they are good enough to compare controller
+// tunings against each other, not to predict absolute fps on hardware.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rate_control.h"
+
+#define MAX_SEGMENTS 1024
+#define CAPTURE_US 20000 // 平均等待传感器出一帧的时间
+#define TCP_OVERHEAD_US 3000
+#define MIN_QUALITY 30
+#define MAX_QUALITY 80
+
+typedef struct {
+  int64_t start_us;
+  int64_t end_us;
+  int kbps;
+} segment_t;
+
+static segment_t segments[MAX_SEGMENTS];
+static int segment_count = 0;
+
+// 与camera_server.h中 FRAMESIZE_240X240 -> HQVGA -> QCIF 的降档顺序一致
+static const int ladder_w[] = {240, 240, 176};
+static const int ladder_h[] = {240, 176, 144};
+#define LADDER_SIZE (int)(sizeof(ladder_w) / sizeof(ladder_w[0]))
+
+static int load_trace(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  char line[128];
+  int64_t t = 0;
+  while (fgets(line, sizeof(line), f) && segment_count < MAX_SEGMENTS) {
+    long duration_ms;
+    int kbps;
+    if (line[0] == '#' || sscanf(line, "%ld %d", &duration_ms, &kbps) != 2) {
+      continue;
+    }
+    segments[segment_count].start_us = t;
+    t += duration_ms * 1000;
+    segments[segment_count].end_us = t;
+    segments[segment_count].kbps = kbps;
+    segment_count++;
+  }
+  fclose(f);
+  return segment_count > 0 ? 0 : -1;
+}
+
+static int64_t trace_end_us(void) {
+  return segments[segment_count - 1].end_us;
+}
+
+static int kbps_at(int64_t t) {
+  for (int i = 0; i < segment_count; i++) {
+    if (t < segments[i].end_us) {
+      return segments[i].kbps;
+    }
+  }
+  return segments[segment_count - 1].kbps;
+}
+
+// 按带宽曲线积分，返回发送完bytes字节的时刻
+static int64_t transmit(int64_t t, size_t bytes) {
+  double bits = (double)bytes * 8;
+  while (bits > 0) {
+    int kbps = kbps_at(t);
+    int64_t seg_end = trace_end_us();
+    for (int i = 0; i < segment_count; i++) {
+      if (t < segments[i].end_us) {
+        seg_end = segments[i].end_us;
+        break;
+      }
+    }
+    if (t >= trace_end_us()) {
+      seg_end = t + 1000000;
+    }
+    // kbps == bits per ms == 1000 bits per second / 1000
+    double capacity = (double)kbps * (double)(seg_end - t) / 1000.0;
+    if (capacity >= bits) {
+      t += (int64_t)(bits * 1000.0 / kbps);
+      bits = 0;
+    } else {
+      bits -= capacity;
+      t = seg_end;
+    }
+  }
+  return t + TCP_OVERHEAD_US;
+}
+
+static size_t frame_bytes(int quality, int step) {
+  double q = quality / 100.0;
+  double pixels = (double)ladder_w[step] * ladder_h[step];
+  return (size_t)(pixels * (0.08 + 1.6 * q * q) / 4);
+}
+
+static int64_t encode_us(int step) {
+  return (int64_t)ladder_w[step] * ladder_h[step] / 2;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <trace> [target_fps]\n", argv[0]);
+    return 1;
+  }
+  if (load_trace(argv[1]) != 0) {
+    fprintf(stderr, "no segments in %s\n", argv[1]);
+    return 1;
+  }
+  int target_fps = argc > 2 ? atoi(argv[2]) : 15;
+
+  rate_control_t rc;
+  rate_control_init(&rc, target_fps, MIN_QUALITY, MAX_QUALITY, LADDER_SIZE - 1);
+
+  int64_t now = 0;
+  int64_t last_frame = 0;
+  int64_t second_end = 1000000;
+  int frames = 0, second_frames = 0, in_band_seconds = 0, seconds = 0;
+  long quality_sum = 0;
+  size_t second_bytes = 0;
+
+  printf("# t_s kbps fps quality size kB/frame\n");
+  while (now < trace_end_us()) {
+    now += CAPTURE_US + encode_us(rc.size_step);
+    size_t bytes = frame_bytes(rc.quality, rc.size_step);
+    int64_t send_start = now;
+    now = transmit(now, bytes);
+
+    rate_sample_t sample = {
+        .frame_us = now - last_frame,
+        .send_us = now - send_start,
+        .bytes = bytes,
+    };
+    sample.backpressure = sample.send_us > 2 * rc.budget_us;
+    last_frame = now;
+    frames++;
+    second_frames++;
+    second_bytes += bytes;
+    quality_sum += rc.quality;
+    rate_control_update(&rc, &sample);
+
+    while (now >= second_end) {
+      seconds++;
+      if (abs(second_frames - target_fps) * 5 <= target_fps) {
+        in_band_seconds++;
+      }
+      printf("%3d %5d %3d %3d %dx%d %5.1f\n", seconds,
+             kbps_at(second_end - 1), second_frames, rc.quality,
+             ladder_w[rc.size_step], ladder_h[rc.size_step],
+             second_frames ? second_bytes / 1024.0 / second_frames : 0.0);
+      second_frames = 0;
+      second_bytes = 0;
+      second_end += 1000000;
+    }
+  }
+
+  printf("# frames %d, mean fps %.1f, mean quality %.1f, "
+         "%d/%d seconds within 20%% of %d fps\n",
+         frames, frames * 1e6 / now, (double)quality_sum / frames,
+         in_band_seconds, seconds, target_fps);
+  return 0;
+}
@@ -0,0 +1,122 @@
+// 在电脑上用main/frame_replay.c回放录好的帧，测量每帧的处理耗时。
+//
+// 用法: ./replay_bench [-f fps] [-n frames] [-w 240 -h 240] <dir>
+//
+// 目录里的文件和开发板上的 CAMERA_REPLAY_DIR 一样：*.jpg，或者 *.rgb（RGB565
+// 原始数据，高字节在前，大小由 -w/-h 指定），例如
+//   for i in $(seq -w 1 100); do curl -s -o f$i.jpg http://<ip>/capture; done
+// -f 0 表示不限速，测量的是读文件本身的速度。
+//
+// Every frame goes through the stages of stream_hub that have no ESP-IDF
+// dependencies: motion analysis (motion_detect.c) and a THUMB-sized downscale
+// (img_scale.c). JPEG frames are only read and paced, since the JPEG codec
+// lives in esp32-camera. The bench reports the frame rate it got, the time
+// spent waiting in frame_replay_fb_get() (pacing plus file I/O) and the
+// average time per stage.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "frame_replay.h"
+#include "img_scale.h"
+#include "motion_detect.h"
+
+#define THUMB_WIDTH 96 // 与camera_server.h一致
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv) {
+  int fps = 15, frames = 100, width = 240, height = 240;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:n:w:h:")) != -1) {
+    switch (opt) {
+    case 'f':
+      fps = atoi(optarg);
+      break;
+    case 'n':
+      frames = atoi(optarg);
+      break;
+    case 'w':
+      width = atoi(optarg);
+      break;
+    case 'h':
+      height = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-f fps] [-n frames] [-w 240 -h 240] <dir>\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc || frame_replay_open(argv[optind], fps, width, height)) {
+    fprintf(stderr, "usage: %s [-f fps] [-n frames] [-w 240 -h 240] <dir>\n",
+            argv[0]);
+    return 1;
+  }
+
+  motion_detect_t md;
+  motion_detect_init(&md, 8, 3);
+  uint8_t *thumb = NULL;
+  double wait_us = 0, motion_us = 0, scale_us = 0;
+  long long bytes = 0;
+  int got = 0, raw = 0, moved = 0, errors = 0;
+  double start = now_us();
+
+  for (int i = 0; i < frames; i++) {
+    double t0 = now_us();
+    camera_fb_t *fb = frame_replay_fb_get();
+    double t1 = now_us();
+    wait_us += t1 - t0;
+    if (!fb) {
+      if (frame_replay_count() == 0) {
+        fprintf(stderr, "%s: no .jpg or .rgb frames\n", argv[optind]);
+        return 1;
+      }
+      errors++;
+      continue;
+    }
+    got++;
+    bytes += fb->len;
+
+    if (fb->format == PIXFORMAT_RGB565) {
+      raw++;
+      motion_detect_rgb565(&md, fb->buf, fb->width, fb->height);
+      if (motion_detect_moved(&md)) {
+        moved++;
+        motion_detect_accept(&md);
+      }
+      double t2 = now_us();
+      motion_us += t2 - t1;
+
+      img_rect_t roi = {0, 0, (int)fb->width, (int)fb->height};
+      int tw = THUMB_WIDTH < roi.w ? THUMB_WIDTH : roi.w;
+      int th = (roi.h * tw + roi.w / 2) / roi.w;
+      if (!thumb) {
+        thumb = (uint8_t *)malloc(tw * th * 2);
+      }
+      img_scale_rgb565(fb->buf, fb->width, fb->height, &roi, thumb, tw, th);
+      scale_us += now_us() - t2;
+    }
+    frame_replay_fb_return(fb);
+  }
+
+  double secs = (now_us() - start) / 1e6;
+  printf("frames: %d (%d errors) in %.2fs, %.1f fps, %lld B/frame\n", got,
+         errors, secs, got / secs, got ? bytes / got : 0);
+  printf("fb_get:  %8.0f us/frame (pacing + file read)\n",
+         frames ? wait_us / frames : 0);
+  if (raw) {
+    printf("motion:  %8.0f us/frame, %d of %d frames moved\n", motion_us / raw,
+           moved, raw);
+    printf("thumb:   %8.0f us/frame\n", scale_us / raw);
+  }
+  free(thumb);
+  return 0;
+}
@@ -0,0 +1,150 @@
+// 不用开发板检查RTP封包(main/rtp_jpeg.c)：把录好的JPEG帧按RFC 2435发到
+// 本机的UDP端口，再用ffprobe/ffplay/VLC打开生成的SDP文件。
+//
+// 用法: ./rtp_replay [-f fps] [-n frames] [-p port] [-s stream.sdp] <dir>
+//   ./rtp_replay -n 150 frames/ &
+//   ffprobe -protocol_whitelist file,udp,rtp -show_frames stream.sdp
+//
+// 目录和replay_bench一样（main/frame_replay.c），只用其中的.jpg文件。
+// Packets are built exactly like stream_hub builds them for RTSP clients:
+// the headers from rtp_jpeg_packet() and a slice of the frame's scan data go
+// out in one sendmsg(), with no per-packet copy. Start the receiver first (or
+// use -n 0 to loop forever): RTP/JPEG carries the tables in every frame, so a
+// late receiver just starts at the next frame.
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "frame_replay.h"
+#include "rtp_jpeg.h"
+
+#define MAX_PACKET 1400 // 与stream_hub.c的HUB_RTP_MAX_PACKET一致
+
+static int write_sdp(const char *path, int port) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    return -1;
+  }
+  fprintf(f,
+          "v=0\n"
+          "o=- 0 0 IN IP4 127.0.0.1\n"
+          "s=rtp_replay\n"
+          "c=IN IP4 127.0.0.1\n"
+          "t=0 0\n"
+          "m=video %d RTP/AVP %d\n"
+          "a=rtpmap:%d JPEG/%d\n",
+          port, RTP_JPEG_PAYLOAD_TYPE, RTP_JPEG_PAYLOAD_TYPE,
+          RTP_JPEG_CLOCK_RATE);
+  fclose(f);
+  return 0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-f fps] [-n frames] [-p port] [-s stream.sdp] <dir>\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  int fps = 15, frames = 150, port = 5004;
+  const char *sdp = "stream.sdp";
+  int opt;
+  while ((opt = getopt(argc, argv, "f:n:p:s:")) != -1) {
+    switch (opt) {
+    case 'f':
+      fps = atoi(optarg);
+      break;
+    case 'n':
+      frames = atoi(optarg);
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 's':
+      sdp = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc || fps <= 0 ||
+      frame_replay_open(argv[optind], fps, 0, 0)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (write_sdp(sdp, port) != 0) {
+    perror(sdp);
+    return 1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in to = {.sin_family = AF_INET, .sin_port = htons(port)};
+  inet_pton(AF_INET, "127.0.0.1", &to.sin_addr);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&to, sizeof(to)) != 0) {
+    perror("socket");
+    return 1;
+  }
+
+  rtp_jpeg_stream_t stream = {.ssrc = 0x12345678, .seq = 65500};
+  int sent = 0, skipped = 0;
+  long long packets = 0, bytes = 0;
+  size_t largest = 0;
+  for (int i = 0; frames == 0 || i < frames; i++) {
+    camera_fb_t *fb = frame_replay_fb_get();
+    if (!fb) {
+      if (frame_replay_count() == 0) {
+        fprintf(stderr, "%s: no .jpg frames\n", argv[optind]);
+        return 1;
+      }
+      skipped++;
+      continue;
+    }
+    rtp_jpeg_frame_t frame;
+    if (fb->format != PIXFORMAT_JPEG ||
+        rtp_jpeg_parse(fb->buf, fb->len, &frame) != 0) {
+      skipped++; // .rgb，或者RFC 2435传不了的JPEG
+      frame_replay_fb_return(fb);
+      continue;
+    }
+    uint64_t capture_us =
+        (uint64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    stream.timestamp = (uint32_t)(capture_us * 9 / 100);
+
+    uint8_t header[RTP_JPEG_HEADER_MAX];
+    for (size_t offset = 0; offset < frame.scan_len;) {
+      size_t payload_len;
+      size_t header_len = rtp_jpeg_packet(&frame, offset, MAX_PACKET, &stream,
+                                          header, &payload_len);
+      struct iovec iov[2] = {
+          {.iov_base = header, .iov_len = header_len},
+          {.iov_base = (void *)(frame.scan + offset), .iov_len = payload_len},
+      };
+      struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+      if (sendmsg(fd, &msg, 0) < 0) {
+        perror("sendmsg"); // 比如接收端还没启动: connection refused
+      }
+      if (header_len + payload_len > largest) {
+        largest = header_len + payload_len;
+      }
+      packets++;
+      bytes += header_len + payload_len;
+      offset += payload_len;
+    }
+    sent++;
+    frame_replay_fb_return(fb);
+  }
+
+  printf("frames: %d sent, %d skipped; %lld packets (%.1f/frame), "
+         "largest %zu B, %lld B/frame\n",
+         sent, skipped, packets, sent ? (double)packets / sent : 0, largest,
+         sent ? bytes / sent : 0);
+  close(fd);
+  return 0;
+}
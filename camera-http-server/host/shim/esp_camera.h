@@ -0,0 +1,29 @@
+// 在电脑上编译main/frame_replay.c用的esp32-camera类型，只有回放需要的部分
+#if !defined(__HOST_ESP_CAMERA__)
+#define __HOST_ESP_CAMERA__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+typedef enum {
+  PIXFORMAT_RGB565,
+  PIXFORMAT_YUV422,
+  PIXFORMAT_YUV420,
+  PIXFORMAT_GRAYSCALE,
+  PIXFORMAT_JPEG,
+} pixformat_t;
+
+typedef struct {
+  uint8_t *buf;
+  size_t len;
+  size_t width;
+  size_t height;
+  pixformat_t format;
+  struct timeval timestamp;
+} camera_fb_t;
+
+typedef struct _sensor sensor_t;
+
+#endif // __HOST_ESP_CAMERA__
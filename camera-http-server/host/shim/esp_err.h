@@ -0,0 +1,14 @@
+// 在电脑上编译main/async_handler.c用的ESP-IDF错误码
+#if !defined(__HOST_ESP_ERR__)
+#define __HOST_ESP_ERR__
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NOT_FOUND 0x105
+
+#endif // __HOST_ESP_ERR__
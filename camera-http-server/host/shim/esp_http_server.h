@@ -0,0 +1,33 @@
+// 在电脑上编译main/async_handler.c用的假http服务器：请求只记录响应，不发送任何东西。
+//
+// httpd_req_async_handler_begin() makes a heap copy that points back at the
+// original, responses sent on the copy are recorded in the original so a test
+// can inspect them after httpd_req_async_handler_complete() freed the copy.
+#if !defined(__HOST_ESP_HTTP_SERVER__)
+#define __HOST_ESP_HTTP_SERVER__
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct httpd_req {
+  const char *uri;
+  struct httpd_req *orig; // 分离出来的副本指向原来的请求
+  void *user_ctx;
+  // 记录在原来的请求里
+  const char *status;
+  const char *retry_after;
+  bool sent;
+  bool detached;
+  bool completed;
+} httpd_req_t;
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r);
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field,
+                             const char *value);
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, size_t len);
+
+#endif // __HOST_ESP_HTTP_SERVER__
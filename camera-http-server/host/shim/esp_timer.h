@@ -0,0 +1,14 @@
+// esp_timer_get_time()用CLOCK_MONOTONIC
+#if !defined(__HOST_ESP_TIMER__)
+#define __HOST_ESP_TIMER__
+
+#include <stdint.h>
+#include <time.h>
+
+static inline int64_t esp_timer_get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif // __HOST_ESP_TIMER__
@@ -0,0 +1,181 @@
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct host_queue {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  uint8_t *items;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head;
+  UBaseType_t count;
+};
+
+struct host_mutex {
+  pthread_mutex_t lock;
+};
+
+struct host_task {
+  pthread_t thread;
+  TaskFunction_t fn;
+  void *arg;
+};
+
+static __thread TaskHandle_t s_current = NULL;
+
+// 等到条件变化或超时；超时返回false
+static bool wait_changed(struct host_queue *q, TickType_t wait) {
+  if (wait == 0) {
+    return false;
+  }
+  if (wait == portMAX_DELAY) {
+    pthread_cond_wait(&q->changed, &q->lock);
+    return true;
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += wait / 1000;
+  ts.tv_nsec += (long)(wait % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  return pthread_cond_timedwait(&q->changed, &q->lock, &ts) != ETIMEDOUT;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  struct host_queue *q = calloc(1, sizeof(*q));
+  q->items = malloc((size_t)length * item_size);
+  q->length = length;
+  q->item_size = item_size;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->changed, NULL);
+  return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t wait) {
+  pthread_mutex_lock(&q->lock);
+  while (q->count == q->length) {
+    if (!wait_changed(q, wait)) {
+      pthread_mutex_unlock(&q->lock);
+      return pdFALSE;
+    }
+  }
+  UBaseType_t tail = (q->head + q->count) % q->length;
+  memcpy(q->items + (size_t)tail * q->item_size, item, q->item_size);
+  q->count++;
+  pthread_cond_broadcast(&q->changed);
+  pthread_mutex_unlock(&q->lock);
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait) {
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0) {
+    if (!wait_changed(q, wait)) {
+      pthread_mutex_unlock(&q->lock);
+      return pdFALSE;
+    }
+  }
+  memcpy(item, q->items + (size_t)q->head * q->item_size, q->item_size);
+  q->head = (q->head + 1) % q->length;
+  q->count--;
+  pthread_cond_broadcast(&q->changed);
+  pthread_mutex_unlock(&q->lock);
+  return pdTRUE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  struct host_mutex *m = calloc(1, sizeof(*m));
+  pthread_mutex_init(&m->lock, NULL);
+  return m;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+  (void)wait; // 测试里只用portMAX_DELAY
+  return pthread_mutex_lock(&sem->lock) == 0;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  return pthread_mutex_unlock(&sem->lock) == 0;
+}
+
+static void *task_main(void *arg) {
+  struct host_task *task = arg;
+  s_current = task;
+  task->fn(task->arg);
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core) {
+  (void)name, (void)stack, (void)priority, (void)core;
+  struct host_task *task = calloc(1, sizeof(*task));
+  task->fn = fn;
+  task->arg = arg;
+  // 和FreeRTOS一样，任务开始运行前句柄已经返回给调用者
+  if (handle) {
+    *handle = task;
+  }
+  if (pthread_create(&task->thread, NULL, task_main, task) != 0) {
+    return pdFAIL;
+  }
+  pthread_detach(task->thread);
+  return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return s_current; }
+
+void vTaskDelay(TickType_t ticks) { usleep((useconds_t)ticks * 1000); }
+
+// 假http服务器：响应记录在原来的请求里
+
+static httpd_req_t *original(httpd_req_t *r) { return r->orig ? r->orig : r; }
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out) {
+  httpd_req_t *copy = malloc(sizeof(*copy));
+  if (!copy) {
+    return ESP_ERR_NO_MEM;
+  }
+  *copy = *r;
+  copy->orig = r;
+  r->detached = true;
+  *out = copy;
+  return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r) {
+  if (!r->orig) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  __atomic_store_n(&r->orig->completed, true, __ATOMIC_RELEASE);
+  free(r);
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) {
+  original(r)->status = status;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field,
+                             const char *value) {
+  if (!strcmp(field, "Retry-After")) {
+    original(r)->retry_after = value;
+  }
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, size_t len) {
+  (void)buf, (void)len;
+  original(r)->sent = true;
+  return ESP_OK;
+}
@@ -0,0 +1,138 @@
+// 检查视频流统计(main/stream_stats.c)：分位数和参考实现一致，并发读不会读到写了一半的数据。
+//
+// 用法: ./stream_stats_bench [seconds]
+//
+// First the window summaries of random samples are compared with a direct
+// computation over the same samples. Then a writer thread adds consecutive
+// integers (one per millisecond of fake time) as fast as it can while a reader
+// thread summarizes continuously. In a consistent snapshot the all-time count
+// is the last value + 1 and every window holds consecutive values ending at
+// the last one; a torn copy breaks one of these. The bench prints the cost of
+// add() and read() and how many reads gave up because the writer kept the ring
+// busy.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "stream_stats.h"
+
+#define SAMPLE_STEP_US 1000 // 假时钟：每个样本间隔1ms，窗口总是装满整个环
+
+static stream_stats_t s_stats;
+static atomic_llong s_now_us;
+static atomic_bool s_stop;
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// 参考实现：最近window_ms内（最多STREAM_STATS_SAMPLES个）的值排序后取秩
+static int check_window(const uint32_t *values, int n, int step_ms,
+                        const stream_stats_window_t *w) {
+  int k = 0;
+  uint32_t sorted[STREAM_STATS_SAMPLES];
+  for (int i = n - 1; i >= 0 && k < STREAM_STATS_SAMPLES; i--) {
+    if ((uint32_t)(n - 1 - i) * step_ms > w->window_ms) {
+      break;
+    }
+    sorted[k++] = values[i];
+  }
+  qsort(sorted, k, sizeof(uint32_t), compare_u32);
+  int p50 = sorted[(k * 50 + 99) / 100 - 1];
+  int p90 = sorted[(k * 90 + 99) / 100 - 1];
+  int p99 = sorted[(k * 99 + 99) / 100 - 1];
+  return w->count == (uint32_t)k && w->min == sorted[0] &&
+         w->max == sorted[k - 1] && w->p50 == (uint32_t)p50 &&
+         w->p90 == (uint32_t)p90 && w->p99 == (uint32_t)p99;
+}
+
+static void *writer(void *arg) {
+  long long *adds = (long long *)arg;
+  for (uint32_t i = 0; !atomic_load(&s_stop); i++) {
+    long long t = (long long)i * SAMPLE_STEP_US;
+    stream_stats_add(&s_stats, i, t);
+    atomic_store(&s_now_us, t);
+    (*adds)++;
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2;
+
+  // 1. 和参考实现比较
+  srand(1);
+  int step_ms = 33, n = 500, bad = 0;
+  uint32_t values[500];
+  stream_stats_init(&s_stats);
+  for (int i = 0; i < n; i++) {
+    values[i] = 30000 + rand() % 40000;
+    stream_stats_add(&s_stats, values[i], (long long)i * step_ms * 1000);
+    if (i % 7 == 0) {
+      stream_stats_summary_t sum;
+      stream_stats_read(&s_stats, (long long)i * step_ms * 1000, &sum);
+      for (int w = 0; w < STREAM_STATS_WINDOWS; w++) {
+        bad += !check_window(values, i + 1, step_ms, &sum.windows[w]);
+      }
+    }
+  }
+  stream_stats_summary_t sum;
+  stream_stats_read(&s_stats, (long long)(n - 1) * step_ms * 1000, &sum);
+  printf("accuracy: %d mismatches; ewma %.0f, last %u\n", bad, sum.ewma,
+         sum.last);
+  for (int w = 0; w < STREAM_STATS_WINDOWS; w++) {
+    const stream_stats_window_t *win = &sum.windows[w];
+    printf("  %5ums: n=%3u min=%u max=%u mean=%u p50=%u p90=%u p99=%u\n",
+           win->window_ms, win->count, win->min, win->max, win->mean,
+           win->p50, win->p90, win->p99);
+  }
+
+  // 2. 一个写者一个读者同时跑
+  stream_stats_init(&s_stats);
+  long long adds = 0, reads = 0, gave_up = 0, torn = 0;
+  pthread_t thread;
+  pthread_create(&thread, NULL, writer, &adds);
+  // 等写者写进第一个值：之前读到的是空的统计，不能按下面的规则检查
+  while (!stream_stats_read(&s_stats, atomic_load(&s_now_us), &sum) ||
+         sum.count == 0) {
+    sched_yield();
+  }
+  double start = now_us(), read_us = 0;
+  while (now_us() - start < seconds * 1e6) {
+    double t0 = now_us();
+    bool ok = stream_stats_read(&s_stats, atomic_load(&s_now_us), &sum);
+    read_us += now_us() - t0;
+    reads++;
+    if (!ok) {
+      gave_up++;
+      continue;
+    }
+    // 写者写的是0, 1, 2...：总数比最后一个值大1，窗口里的值连续且以它结尾
+    bool consistent = sum.count == sum.last + 1ULL;
+    for (int w = 0; w < STREAM_STATS_WINDOWS; w++) {
+      const stream_stats_window_t *win = &sum.windows[w];
+      consistent &= win->count > 0 && win->max == sum.last &&
+                    win->max - win->min + 1 == win->count;
+    }
+    torn += !consistent;
+  }
+  atomic_store(&s_stop, true);
+  pthread_join(thread, NULL);
+  double elapsed = now_us() - start;
+  printf("concurrent: %lld adds (%.0f ns each), %lld reads (%.1f us each), "
+         "%lld gave up, %lld inconsistent\n",
+         adds, elapsed * 1e3 / adds, reads, read_us / reads, gave_up, torn);
+  return bad || torn ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+#include "async_handler.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "async_handler"
+
+typedef struct {
+  httpd_req_t *req; // detached copy, see httpd_req_async_handler_begin()
+  async_handler_fn_t handler;
+  int64_t queued_us;
+} async_job_t;
+
+static QueueHandle_t s_queue = NULL;
+static TaskHandle_t s_workers[ASYNC_WORKER_COUNT];
+static SemaphoreHandle_t s_stats_lock = NULL;
+static async_handler_stats_t s_stats;
+
+static void worker_task(void *arg) {
+  async_job_t job;
+  while (true) {
+    if (xQueueReceive(s_queue, &job, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    uint32_t wait = esp_timer_get_time() - job.queued_us;
+    xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+    s_stats.depth--;
+    s_stats.busy++;
+    s_stats.wait_us += wait;
+    if (wait > s_stats.max_wait_us) {
+      s_stats.max_wait_us = wait;
+    }
+    xSemaphoreGive(s_stats_lock);
+
+    job.handler(job.req);
+    httpd_req_async_handler_complete(job.req);
+
+    xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+    s_stats.busy--;
+    s_stats.completed++;
+    xSemaphoreGive(s_stats_lock);
+  }
+}
+
+esp_err_t async_handler_init(void) {
+  if (s_queue) {
+    return ESP_OK;
+  }
+  s_stats_lock = xSemaphoreCreateMutex();
+  s_queue = xQueueCreate(ASYNC_QUEUE_LEN, sizeof(async_job_t));
+  if (!s_stats_lock || !s_queue) {
+    return ESP_ERR_NO_MEM;
+  }
+  for (int i = 0; i < ASYNC_WORKER_COUNT; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "http_async%d", i);
+    if (xTaskCreatePinnedToCore(worker_task, name, ASYNC_WORKER_STACK, NULL,
+                                ASYNC_WORKER_PRIORITY, &s_workers[i],
+                                ASYNC_WORKER_CORE) != pdPASS) {
+      return ESP_FAIL;
+    }
+  }
+  return ESP_OK;
+}
+
+bool async_handler_on_worker(void) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  for (int i = 0; i < ASYNC_WORKER_COUNT; i++) {
+    if (s_workers[i] == self) {
+      return true;
+    }
+  }
+  return false;
+}
+
+esp_err_t async_handler_submit(httpd_req_t *req, async_handler_fn_t handler) {
+  if (!s_queue) {
+    return handler(req); // 没有初始化时在当前任务中处理
+  }
+  async_job_t job = {
+      .handler = handler,
+      .queued_us = esp_timer_get_time(),
+  };
+  if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+    return handler(req);
+  }
+
+  // 先加depth再入队，工作任务取出后减depth时不会减到负数
+  xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+  s_stats.submitted++;
+  uint32_t depth = ++s_stats.depth;
+  xSemaphoreGive(s_stats_lock);
+  if (xQueueSend(s_queue, &job, 0) == pdTRUE) {
+    // 被拒绝的请求不算进max_depth，它不会超过ASYNC_QUEUE_LEN
+    xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+    if (depth > s_stats.max_depth) {
+      s_stats.max_depth = depth;
+    }
+    xSemaphoreGive(s_stats_lock);
+    return ESP_OK;
+  }
+
+  // 队列满了：不让请求排太久，直接告诉客户端稍后再试
+  xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+  s_stats.depth--;
+  s_stats.rejected++;
+  xSemaphoreGive(s_stats_lock);
+  ESP_LOGW(TAG, "Queue full, rejecting %s", req->uri);
+  httpd_resp_set_status(job.req, "503 Service Unavailable");
+  httpd_resp_set_hdr(job.req, "Retry-After", "1");
+  httpd_resp_send(job.req, NULL, 0);
+  httpd_req_async_handler_complete(job.req);
+  return ESP_OK;
+}
+
+void async_handler_get_stats(async_handler_stats_t *stats) {
+  if (!s_stats_lock) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+  *stats = s_stats;
+  xSemaphoreGive(s_stats_lock);
+}
@@ -0,0 +1,52 @@
+#if !defined(__ASYNC_HANDLER__)
+#define __ASYNC_HANDLER__
+
+#include "esp_http_server.h"
+#include <stdbool.h>
+
+// 慢的请求（拍照、人脸识别、下载录像）交给工作任务处理，http服务器的任务马上去处理下一个请求，
+// /status 和 /control 不会被一次慢的 /capture 卡住。
+//
+// A slow handler starts with
+//
+//   if (!async_handler_on_worker()) {
+//     return async_handler_submit(req, capture_handler);
+//   }
+//
+// The request is detached with httpd_req_async_handler_begin() and queued;
+// a worker calls the same handler again with the detached copy and completes
+// it. When the queue is full the request is answered with 503 right away.
+// Nothing here depends on the camera, so the layer builds for the ESP-IDF
+// linux target as well.
+
+#define ASYNC_WORKER_COUNT 2
+#define ASYNC_QUEUE_LEN 4
+#define ASYNC_WORKER_STACK 4096 // 和httpd的任务栈一样大
+#define ASYNC_WORKER_PRIORITY 5
+#define ASYNC_WORKER_CORE 0
+
+typedef esp_err_t (*async_handler_fn_t)(httpd_req_t *req);
+
+typedef struct {
+  uint32_t submitted;
+  uint32_t rejected; // queue full, answered with 503
+  uint32_t completed;
+  uint32_t depth;     // requests waiting in the queue now
+  uint32_t max_depth; // since boot
+  uint32_t busy;      // workers running a handler now
+  uint64_t wait_us;   // total time requests spent in the queue
+  uint32_t max_wait_us;
+} async_handler_stats_t;
+
+esp_err_t async_handler_init(void);
+
+// True when called from one of the workers.
+bool async_handler_on_worker(void);
+
+// Hands req over to a worker which calls handler(copy of req). Returns ESP_OK
+// when the request was queued or rejected with a 503 response.
+esp_err_t async_handler_submit(httpd_req_t *req, async_handler_fn_t handler);
+
+void async_handler_get_stats(async_handler_stats_t *stats);
+
+#endif // __ASYNC_HANDLER__
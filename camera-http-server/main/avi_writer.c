@@ -0,0 +1,179 @@
+#include "avi_writer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define AVI_HEADER_SIZE 224 // RIFF + hdrl + "LIST....movi"
+#define AVI_MOVI_FOURCC_OFFSET 220
+#define AVIF_HASINDEX 0x10
+#define AVIIF_KEYFRAME 0x10
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+  return p + 4;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t *put_fourcc(uint8_t *p, const char *fourcc) {
+  memcpy(p, fourcc, 4);
+  return p + 4;
+}
+
+static uint32_t us_per_frame(const avi_writer_t *aw) {
+  if (aw->frames < 2 || aw->last_us <= aw->first_us) {
+    return 200000; // 还不知道真实帧率时按5fps
+  }
+  return (aw->last_us - aw->first_us) / (aw->frames - 1);
+}
+
+// 固定长度的文件头：RIFF / hdrl(avih, strl(strh, strf)) / movi列表头
+static int write_header(avi_writer_t *aw) {
+  uint8_t h[AVI_HEADER_SIZE];
+  uint8_t *p = h;
+  uint32_t usec = us_per_frame(aw);
+  uint32_t idx_size = aw->frames * 16;
+
+  p = put_fourcc(p, "RIFF");
+  p = put32(p, AVI_HEADER_SIZE - 8 + aw->movi_size + 8 + idx_size);
+  p = put_fourcc(p, "AVI ");
+
+  p = put_fourcc(p, "LIST");
+  p = put32(p, 192);
+  p = put_fourcc(p, "hdrl");
+
+  p = put_fourcc(p, "avih");
+  p = put32(p, 56);
+  p = put32(p, usec);
+  p = put32(p, (uint64_t)aw->max_frame_size * 1000000 / usec);
+  p = put32(p, 0);
+  p = put32(p, AVIF_HASINDEX);
+  p = put32(p, aw->frames);
+  p = put32(p, 0);
+  p = put32(p, 1); // streams
+  p = put32(p, aw->max_frame_size);
+  p = put32(p, aw->width);
+  p = put32(p, aw->height);
+  memset(p, 0, 16);
+  p += 16;
+
+  p = put_fourcc(p, "LIST");
+  p = put32(p, 116);
+  p = put_fourcc(p, "strl");
+
+  p = put_fourcc(p, "strh");
+  p = put32(p, 56);
+  p = put_fourcc(p, "vids");
+  p = put_fourcc(p, "MJPG");
+  p = put32(p, 0);          // flags
+  p = put32(p, 0);          // priority, language
+  p = put32(p, 0);          // initial frames
+  p = put32(p, usec);       // scale
+  p = put32(p, 1000000);    // rate: rate/scale = fps
+  p = put32(p, 0);          // start
+  p = put32(p, aw->frames); // length
+  p = put32(p, aw->max_frame_size);
+  p = put32(p, 0xFFFFFFFF); // quality
+  p = put32(p, 0);          // sample size
+  p = put16(p, 0);
+  p = put16(p, 0);
+  p = put16(p, aw->width);
+  p = put16(p, aw->height);
+
+  p = put_fourcc(p, "strf");
+  p = put32(p, 40); // BITMAPINFOHEADER
+  p = put32(p, 40);
+  p = put32(p, aw->width);
+  p = put32(p, aw->height);
+  p = put16(p, 1);
+  p = put16(p, 24);
+  p = put_fourcc(p, "MJPG");
+  p = put32(p, aw->width * aw->height * 3);
+  memset(p, 0, 16);
+  p += 16;
+
+  p = put_fourcc(p, "LIST");
+  p = put32(p, 4 + aw->movi_size);
+  p = put_fourcc(p, "movi");
+
+  return fwrite(h, 1, sizeof(h), aw->f) == sizeof(h) ? 0 : -1;
+}
+
+int avi_writer_open(avi_writer_t *aw, FILE *f, int width, int height,
+                    uint32_t max_frames) {
+  memset(aw, 0, sizeof(*aw));
+  aw->f = f;
+  aw->width = width;
+  aw->height = height;
+  aw->max_frames = max_frames;
+  aw->index =
+      (avi_index_entry_t *)malloc(max_frames * sizeof(avi_index_entry_t));
+  if (!aw->index) {
+    return -1;
+  }
+  return write_header(aw);
+}
+
+int avi_writer_add_frame(avi_writer_t *aw, const uint8_t *jpeg, size_t len,
+                         int64_t capture_us) {
+  if (aw->frames >= aw->max_frames) {
+    return -1;
+  }
+  uint8_t chunk[8];
+  put_fourcc(chunk, "00dc");
+  put32(chunk + 4, len);
+  static const uint8_t pad = 0;
+  if (fwrite(chunk, 1, 8, aw->f) != 8 || fwrite(jpeg, 1, len, aw->f) != len ||
+      ((len & 1) && fwrite(&pad, 1, 1, aw->f) != 1)) {
+    return -1;
+  }
+  aw->index[aw->frames].offset = 4 + aw->movi_size;
+  aw->index[aw->frames].size = len;
+  aw->movi_size += 8 + len + (len & 1);
+  if (len > aw->max_frame_size) {
+    aw->max_frame_size = len;
+  }
+  if (aw->frames == 0) {
+    aw->first_us = capture_us;
+  }
+  aw->last_us = capture_us;
+  aw->frames++;
+  return 0;
+}
+
+int avi_writer_close(avi_writer_t *aw) {
+  int ret = 0;
+  uint8_t h[8];
+  put_fourcc(h, "idx1");
+  put32(h + 4, aw->frames * 16);
+  if (fwrite(h, 1, 8, aw->f) != 8) {
+    ret = -1;
+  }
+  for (uint32_t i = 0; i < aw->frames && ret == 0; i++) {
+    uint8_t e[16];
+    put_fourcc(e, "00dc");
+    put32(e + 4, AVIIF_KEYFRAME);
+    put32(e + 8, aw->index[i].offset);
+    put32(e + 12, aw->index[i].size);
+    if (fwrite(e, 1, 16, aw->f) != 16) {
+      ret = -1;
+    }
+  }
+  if (ret == 0 && fseek(aw->f, 0, SEEK_SET) == 0) {
+    ret = write_header(aw);
+  }
+  if (fclose(aw->f) != 0) {
+    ret = -1;
+  }
+  free(aw->index);
+  aw->index = NULL;
+  aw->f = NULL;
+  return ret;
+}
@@ -0,0 +1,40 @@
+#if !defined(__AVI_WRITER__)
+#define __AVI_WRITER__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// 把JPEG帧写成MJPEG编码的AVI文件（RIFF AVI，一路视频流，带idx1索引）。
+//
+// The header is written with placeholder counts on open and rewritten on
+// close, when the number of frames and the real frame rate are known. The
+// index is kept in memory; it is allocated once on open for max_frames.
+
+typedef struct {
+  uint32_t offset; // relative to the "movi" fourcc
+  uint32_t size;
+} avi_index_entry_t;
+
+typedef struct {
+  FILE *f;
+  int width;
+  int height;
+  uint32_t frames;
+  uint32_t max_frames;
+  uint32_t max_frame_size;
+  uint32_t movi_size; // bytes after the "movi" fourcc
+  int64_t first_us;
+  int64_t last_us;
+  avi_index_entry_t *index;
+} avi_writer_t;
+
+// Returns 0 on success.
+int avi_writer_open(avi_writer_t *aw, FILE *f, int width, int height,
+                    uint32_t max_frames);
+// Returns 0 on success, -1 on write errors or when max_frames is reached.
+int avi_writer_add_frame(avi_writer_t *aw, const uint8_t *jpeg, size_t len,
+                         int64_t capture_us);
+// Writes the index, patches the header and closes the file.
+int avi_writer_close(avi_writer_t *aw);
+
+#endif // __AVI_WRITER__
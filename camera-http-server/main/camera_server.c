@@ -1,68 +1,34 @@
 #include "camera_server.h"
-#include "camera_index.h"
+#include "async_handler.h"
+#include "clip_recorder.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
 #include "esp_camera.h"
+#include "esp_heap_caps.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_random.h"
 #include "esp_timer.h"
+#include "face_engine.h"
+#include "frame_replay.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "img_converters.h"
+#include "img_scale.h"
+#include "mem_policy.h"
+#include "metrics.h"
+#include "rtsp_server.h"
 #include "sdkconfig.h"
+#include "snapshot.h"
+#include "stream_hub.h"
+#include "timelapse.h"
+#include "ws_video.h"
+#include "www.h"
 
 #define TAG "camera_server"
 
-// Face Detection will not work on boards without (or with disabled) PSRAM
-#ifdef BOARD_HAS_PSRAM
-// Face Recognition takes upward from 15 seconds per frame on chips other than
-// ESP32S3 Makes no sense to have it enabled for them
-#if CONFIG_IDF_TARGET_ESP32S3
-#define CONFIG_ESP_FACE_RECOGNITION_ENABLED 1
-#define CONFIG_ESP_FACE_DETECT_ENABLED 1
-#else
-#define CONFIG_ESP_FACE_RECOGNITION_ENABLED 0
-#define CONFIG_ESP_FACE_DETECT_ENABLED 0
-#endif
-#else
-#define CONFIG_ESP_FACE_DETECT_ENABLED 0
-#define CONFIG_ESP_FACE_RECOGNITION_ENABLED 0
-#endif
-
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-
-#include "human_face_detect_mnp01.hpp"
-#include "human_face_detect_msr01.hpp"
-#include <vector>
-
-#define TWO_STAGE                                                              \
-  1 /*<! 1: detect by two-stage which is more accurate but slower(with         \
-       keypoints). */
-    /*<! 0: detect by one-stage which is less accurate but faster(without
-     * keypoints). */
-
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-#pragma GCC diagnostic ignored "-Wformat"
-#pragma GCC diagnostic ignored "-Wstrict-aliasing"
-#include "face_recognition_112_v1_s16.hpp"
-#include "face_recognition_112_v1_s8.hpp"
-#include "face_recognition_tool.hpp"
-#pragma GCC diagnostic error "-Wformat"
-#pragma GCC diagnostic warning "-Wstrict-aliasing"
-
-#define QUANT_TYPE                                                             \
-  0 // if set to 1 => very large firmware, very slow, reboots when streaming...
-
-#define FACE_ID_SAVE_NUMBER 7
-#endif
-
-#define FACE_COLOR_WHITE 0x00FFFFFF
-#define FACE_COLOR_BLACK 0x00000000
-#define FACE_COLOR_RED 0x000000FF
-#define FACE_COLOR_GREEN 0x0000FF00
-#define FACE_COLOR_BLUE 0x00FF0000
-#define FACE_COLOR_YELLOW (FACE_COLOR_RED | FACE_COLOR_GREEN)
-#define FACE_COLOR_CYAN (FACE_COLOR_BLUE | FACE_COLOR_GREEN)
-#define FACE_COLOR_PURPLE (FACE_COLOR_BLUE | FACE_COLOR_RED)
-#endif
-
 // Enable LED FLASH setting
 #define CONFIG_LED_ILLUMINATOR_ENABLED 0
 
@@ -82,187 +48,35 @@ typedef struct {
   size_t len;
 } jpg_chunking_t;
 
-#define PART_BOUNDARY "123456789000000000000987654321"
+typedef struct {
+  char variable[32];
+  int val;
+} control_item_t;
+
 static const char *_STREAM_CONTENT_TYPE =
-    "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char *_STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: "
-                                  "%u\r\nX-Timestamp: %d.%06d\r\n\r\n";
+    "multipart/x-mixed-replace;boundary=" STREAM_PART_BOUNDARY;
 
-httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
 
+// 拿帧和修改传感器设置互斥，一组设置不会在拍一帧的中间生效
+static SemaphoreHandle_t s_sensor_lock = NULL;
+// 传感器休眠：s_sensor_off只在持有s_sensor_lock时修改，统计由s_power_mux保护
+static volatile bool s_sensor_off = false;
+static portMUX_TYPE s_power_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t s_power_changed_us = 0;
+static uint64_t s_sensor_on_us = 0;
+static uint64_t s_sensor_off_us = 0;
+static uint32_t s_sensor_wakeups = 0;
+
 #if CONFIG_ESP_FACE_DETECT_ENABLED
 
 static int8_t detection_enabled = 0;
 
-// #if TWO_STAGE
-// static HumanFaceDetectMSR01 s1(0.1F, 0.5F, 10, 0.2F);
-// static HumanFaceDetectMNP01 s2(0.5F, 0.3F, 5);
-// #else
-// static HumanFaceDetectMSR01 s1(0.3F, 0.5F, 10, 0.2F);
-// #endif
-
 #if CONFIG_ESP_FACE_RECOGNITION_ENABLED
 static int8_t recognition_enabled = 0;
 static int8_t is_enrolling = 0;
-
-#if QUANT_TYPE
-// S16 model
-FaceRecognition112V1S16 recognizer;
-#else
-// S8 model
-FaceRecognition112V1S8 recognizer;
-#endif
-#endif
-
-#endif
-
-typedef struct {
-  size_t size;  // number of values used for filtering
-  size_t index; // current value index
-  size_t count; // value count
-  int sum;
-  int *values; // array to be filled with values
-} ra_filter_t;
-
-static ra_filter_t ra_filter;
-
-static ra_filter_t *ra_filter_init(ra_filter_t *filter, size_t sample_size) {
-  memset(filter, 0, sizeof(ra_filter_t));
-
-  filter->values = (int *)malloc(sample_size * sizeof(int));
-  if (!filter->values) {
-    return NULL;
-  }
-  memset(filter->values, 0, sample_size * sizeof(int));
-
-  filter->size = sample_size;
-  return filter;
-}
-
-static int ra_filter_run(ra_filter_t *filter, int value) {
-  if (!filter->values) {
-    return value;
-  }
-  filter->sum -= filter->values[filter->index];
-  filter->values[filter->index] = value;
-  filter->sum += filter->values[filter->index];
-  filter->index++;
-  filter->index = filter->index % filter->size;
-  if (filter->count < filter->size) {
-    filter->count++;
-  }
-  return filter->sum / filter->count;
-}
-
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-static void rgb_print(fb_data_t *fb, unsigned int color, const char *str) {
-  fb_gfx_print(fb, (fb->width - (strlen(str) * 14)) / 2, 10, color, str);
-}
-
-static int rgb_printf(fb_data_t *fb, unsigned int color, const char *format,
-                      ...) {
-  char loc_buf[64];
-  char *temp = loc_buf;
-  int len;
-  va_list arg;
-  va_list copy;
-  va_start(arg, format);
-  va_copy(copy, arg);
-  len = vsnprintf(loc_buf, sizeof(loc_buf), format, arg);
-  va_end(copy);
-  if (len >= sizeof(loc_buf)) {
-    temp = (char *)malloc(len + 1);
-    if (temp == NULL) {
-      return 0;
-    }
-  }
-  vsnprintf(temp, len + 1, format, arg);
-  va_end(arg);
-  rgb_print(fb, color, temp);
-  if (len > 64) {
-    free(temp);
-  }
-  return len;
-}
-#endif
-static void draw_face_boxes(fb_data_t *fb,
-                            std::list<dl::detect::result_t> *results,
-                            int face_id) {
-  int x, y, w, h;
-  unsigned int color = FACE_COLOR_YELLOW;
-  if (face_id < 0) {
-    color = FACE_COLOR_RED;
-  } else if (face_id > 0) {
-    color = FACE_COLOR_GREEN;
-  }
-  if (fb->bytes_per_pixel == 2) {
-    // color = ((color >> 8) & 0xF800) | ((color >> 3) & 0x07E0) | (color &
-    // 0x001F);
-    color = ((color >> 16) & 0x001F) | ((color >> 3) & 0x07E0) |
-            ((color << 8) & 0xF800);
-  }
-  int i = 0;
-  for (std::list<dl::detect::result_t>::iterator prediction = results->begin();
-       prediction != results->end(); prediction++, i++) {
-    // rectangle box
-    x = (int)prediction->box[0];
-    y = (int)prediction->box[1];
-    w = (int)prediction->box[2] - x + 1;
-    h = (int)prediction->box[3] - y + 1;
-    if ((x + w) > fb->width) {
-      w = fb->width - x;
-    }
-    if ((y + h) > fb->height) {
-      h = fb->height - y;
-    }
-    fb_gfx_drawFastHLine(fb, x, y, w, color);
-    fb_gfx_drawFastHLine(fb, x, y + h - 1, w, color);
-    fb_gfx_drawFastVLine(fb, x, y, h, color);
-    fb_gfx_drawFastVLine(fb, x + w - 1, y, h, color);
-#if TWO_STAGE
-    // landmarks (left eye, mouth left, nose, right eye, mouth right)
-    int x0, y0, j;
-    for (j = 0; j < 10; j += 2) {
-      x0 = (int)prediction->keypoint[j];
-      y0 = (int)prediction->keypoint[j + 1];
-      fb_gfx_fillRect(fb, x0, y0, 3, 3, color);
-    }
 #endif
-  }
-}
-
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-static int run_face_recognition(fb_data_t *fb,
-                                std::list<dl::detect::result_t> *results) {
-  std::vector<int> landmarks = results->front().keypoint;
-  int id = -1;
-
-  Tensor<uint8_t> tensor;
-  tensor.set_element((uint8_t *)fb->data)
-      .set_shape({fb->height, fb->width, 3})
-      .set_auto_free(false);
-
-  int enrolled_count = recognizer.get_enrolled_id_num();
-
-  if (enrolled_count < FACE_ID_SAVE_NUMBER && is_enrolling) {
-    id = recognizer.enroll_id(tensor, landmarks, "", true);
-    ESP_LOGI(TAG, "Enrolled ID: %d", id);
-    rgb_printf(fb, FACE_COLOR_CYAN, "ID[%u]", id);
-  }
 
-  face_info_t recognize = recognizer.recognize(tensor, landmarks);
-  if (recognize.id >= 0) {
-    rgb_printf(fb, FACE_COLOR_GREEN, "ID[%u]: %.2f", recognize.id,
-               recognize.similarity);
-  } else {
-    rgb_print(fb, FACE_COLOR_RED, "Intruder Alert!");
-  }
-  return recognize.id;
-}
-#endif
 #endif
 
 #if CONFIG_LED_ILLUMINATOR_ENABLED
@@ -278,6 +92,7 @@ void enable_led(bool en) { // Turn LED On or Off
 }
 #endif
 
+#if !CAMERA_REPLAY
 // 摄像头传感器相关的配置
 // 摄像头传感器使用的是OV2640
 static camera_config_t camera_config = {
@@ -313,25 +128,56 @@ static camera_config_t camera_config = {
     // 当图片缓冲区为空时，拍照
     .grab_mode = CAMERA_GRAB_WHEN_EMPTY,
 };
+#endif
 
 static esp_err_t index_handler(httpd_req_t *);
 static esp_err_t status_handler(httpd_req_t *);
 static esp_err_t cmd_handler(httpd_req_t *);
+static esp_err_t cmd_batch_handler(httpd_req_t *);
 static esp_err_t capture_handler(httpd_req_t *);
 static esp_err_t stream_handler(httpd_req_t *);
+static esp_err_t time_handler(httpd_req_t *);
 static esp_err_t bmp_handler(httpd_req_t *);
+static esp_err_t thumb_handler(httpd_req_t *);
 static esp_err_t win_handler(httpd_req_t *);
 static esp_err_t pll_handler(httpd_req_t *);
 static esp_err_t reg_handler(httpd_req_t *);
 static esp_err_t greg_handler(httpd_req_t *);
 static esp_err_t xclk_handler(httpd_req_t *);
+static int set_control(const char *variable, int val);
+static void status_refresh(void);
+static void status_changed(void);
 
 esp_err_t camera_server_init() {
+  s_sensor_lock = xSemaphoreCreateMutex();
+  if (!s_sensor_lock) {
+    return ESP_ERR_NO_MEM;
+  }
+
+#if CAMERA_REPLAY
+  // 没有摄像头：回放录好的帧，用来在开发板上测试服务器的性能
+  if (frame_replay_open(CAMERA_REPLAY_DIR, CAMERA_REPLAY_FPS,
+                        CAMERA_REPLAY_WIDTH, CAMERA_REPLAY_HEIGHT) != 0) {
+    ESP_LOGE(TAG, "Replay init failed");
+    return ESP_FAIL;
+  }
+  frame_source_set(&frame_replay_source);
+  ESP_LOGI(TAG, "Replaying frames from %s at %d fps", CAMERA_REPLAY_DIR,
+           CAMERA_REPLAY_FPS);
+#else
   // Init camera
   if (esp_camera_init(&camera_config) != ESP_OK) {
     ESP_LOGE(TAG, "Camera Init Failed");
     return ESP_FAIL;
   }
+#endif
+
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+  // 模型只构造一次，之后每次拍照都复用
+  if (face_engine_init() != ESP_OK) {
+    ESP_LOGE(TAG, "Face engine init failed");
+  }
+#endif
 
   return ESP_OK;
 }
@@ -339,7 +185,7 @@ esp_err_t camera_server_init() {
 // 启动摄像头服务器
 esp_err_t camera_server_start() {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-  config.max_uri_handlers = 16;
+  config.max_uri_handlers = 24;
 
   // 当在浏览器输入`172.10.20.6:80/`时的处理逻辑
   httpd_uri_t index_uri = {.uri = "/",
@@ -348,7 +194,7 @@ esp_err_t camera_server_start() {
                            .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                            ,
-                           .is_websocket = true,
+                           .is_websocket = false,
                            .handle_ws_control_frames = false,
                            .supported_subprotocol = NULL
 #endif
@@ -360,7 +206,7 @@ esp_err_t camera_server_start() {
                             .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                             ,
-                            .is_websocket = true,
+                            .is_websocket = false,
                             .handle_ws_control_frames = false,
                             .supported_subprotocol = NULL
 #endif
@@ -372,19 +218,31 @@ esp_err_t camera_server_start() {
                          .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                          ,
-                         .is_websocket = true,
+                         .is_websocket = false,
                          .handle_ws_control_frames = false,
                          .supported_subprotocol = NULL
 #endif
   };
 
+  httpd_uri_t cmd_batch_uri = {.uri = "/controls",
+                               .method = HTTP_GET,
+                               .handler = cmd_batch_handler,
+                               .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+                               ,
+                               .is_websocket = false,
+                               .handle_ws_control_frames = false,
+                               .supported_subprotocol = NULL
+#endif
+  };
+
   httpd_uri_t capture_uri = {.uri = "/capture",
                              .method = HTTP_GET,
                              .handler = capture_handler,
                              .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                              ,
-                             .is_websocket = true,
+                             .is_websocket = false,
                              .handle_ws_control_frames = false,
                              .supported_subprotocol = NULL
 #endif
@@ -397,31 +255,55 @@ esp_err_t camera_server_start() {
                             .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                             ,
-                            .is_websocket = true,
+                            .is_websocket = false,
                             .handle_ws_control_frames = false,
                             .supported_subprotocol = NULL
 #endif
   };
 
+  httpd_uri_t time_uri = {.uri = "/time",
+                          .method = HTTP_GET,
+                          .handler = time_handler,
+                          .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+                          ,
+                          .is_websocket = false,
+                          .handle_ws_control_frames = false,
+                          .supported_subprotocol = NULL
+#endif
+  };
+
   httpd_uri_t bmp_uri = {.uri = "/bmp",
                          .method = HTTP_GET,
                          .handler = bmp_handler,
                          .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                          ,
-                         .is_websocket = true,
+                         .is_websocket = false,
                          .handle_ws_control_frames = false,
                          .supported_subprotocol = NULL
 #endif
   };
 
+  httpd_uri_t thumb_uri = {.uri = "/thumb",
+                           .method = HTTP_GET,
+                           .handler = thumb_handler,
+                           .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+                           ,
+                           .is_websocket = false,
+                           .handle_ws_control_frames = false,
+                           .supported_subprotocol = NULL
+#endif
+  };
+
   httpd_uri_t xclk_uri = {.uri = "/xclk",
                           .method = HTTP_GET,
                           .handler = xclk_handler,
                           .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                           ,
-                          .is_websocket = true,
+                          .is_websocket = false,
                           .handle_ws_control_frames = false,
                           .supported_subprotocol = NULL
 #endif
@@ -433,7 +315,7 @@ esp_err_t camera_server_start() {
                          .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                          ,
-                         .is_websocket = true,
+                         .is_websocket = false,
                          .handle_ws_control_frames = false,
                          .supported_subprotocol = NULL
 #endif
@@ -445,7 +327,7 @@ esp_err_t camera_server_start() {
                           .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                           ,
-                          .is_websocket = true,
+                          .is_websocket = false,
                           .handle_ws_control_frames = false,
                           .supported_subprotocol = NULL
 #endif
@@ -457,7 +339,7 @@ esp_err_t camera_server_start() {
                          .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                          ,
-                         .is_websocket = true,
+                         .is_websocket = false,
                          .handle_ws_control_frames = false,
                          .supported_subprotocol = NULL
 #endif
@@ -469,61 +351,157 @@ esp_err_t camera_server_start() {
                          .user_ctx = NULL
 #ifdef CONFIG_HTTPD_WS_SUPPORT
                          ,
-                         .is_websocket = true,
+                         .is_websocket = false,
                          .handle_ws_control_frames = false,
                          .supported_subprotocol = NULL
 #endif
   };
 
-  ra_filter_init(&ra_filter, 20);
-
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-  recognizer.set_partition(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
-                           "fr");
-
-  // load ids from flash partition
-  recognizer.set_ids_from_flash();
-#endif
+  if (stream_hub_init() != ESP_OK || snapshot_init() != ESP_OK) {
+    ESP_LOGE(TAG, "Stream hub init failed");
+    return ESP_FAIL;
+  }
+  // 拍照在工作任务中处理，不占住http服务器的任务
+  if (async_handler_init() != ESP_OK) {
+    ESP_LOGE(TAG, "Async handler init failed");
+  }
+  // 网页在www分区里，没有烧录时 / 返回404，其他接口照常工作
+  www_init();
+  // 视频流的socket由stream_hub写数据，关闭前要先通知它
+  config.close_fn = stream_hub_close_fn;
+
+  // 视频流交给stream_hub发送后handler马上返回，不会占住服务器的任务，
+  // 所以网页、控制命令和视频流共用一个http服务器（一个任务、一张socket表）
+  size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
   ESP_LOGI(TAG, "Starting web server on port: '%d'", config.server_port);
   if (httpd_start(&camera_httpd, &config) != ESP_OK) {
     ESP_LOGE(TAG, "Web server start failed");
     return ESP_FAIL;
   }
+  ESP_LOGI(TAG, "Web server uses %u bytes of internal RAM",
+           (unsigned int)(heap_before -
+                          heap_caps_get_free_size(MALLOC_CAP_INTERNAL)));
   httpd_register_uri_handler(camera_httpd, &index_uri);
   httpd_register_uri_handler(camera_httpd, &cmd_uri);
+  httpd_register_uri_handler(camera_httpd, &cmd_batch_uri);
   httpd_register_uri_handler(camera_httpd, &status_uri);
   httpd_register_uri_handler(camera_httpd, &capture_uri);
+  httpd_register_uri_handler(camera_httpd, &stream_uri);
+  httpd_register_uri_handler(camera_httpd, &time_uri);
   httpd_register_uri_handler(camera_httpd, &bmp_uri);
+  httpd_register_uri_handler(camera_httpd, &thumb_uri);
   httpd_register_uri_handler(camera_httpd, &pll_uri);
   httpd_register_uri_handler(camera_httpd, &xclk_uri);
   httpd_register_uri_handler(camera_httpd, &reg_uri);
   httpd_register_uri_handler(camera_httpd, &greg_uri);
   httpd_register_uri_handler(camera_httpd, &win_uri);
-
-  config.server_port += 1;
-  config.ctrl_port += 1;
-  ESP_LOGI(TAG, "Starting stream server on port: '%d'", config.server_port);
-  if (httpd_start(&stream_httpd, &config) != ESP_OK) {
-    ESP_LOGE(TAG, "Web server start failed");
-    return ESP_FAIL;
+  // 视频和控制命令共用一个websocket连接
+  ws_video_register(camera_httpd, set_control);
+  // 视频流各阶段耗时、丢帧、内存，Prometheus格式
+  metrics_register(camera_httpd);
+  // 门铃录像：/clips列出录像，/clip?name=下载
+  if (clip_recorder_init() == ESP_OK) {
+    clip_recorder_register(camera_httpd);
   }
-  httpd_register_uri_handler(stream_httpd, &stream_uri);
+  // 间隔拍照：/timelapse查看状态、打开关闭、下载文件
+  if (timelapse_init() == ESP_OK) {
+    timelapse_register(camera_httpd);
+  }
+#if RTSP_SERVER
+  // NVR、VLC用的RTSP，和网页共用stream_hub的帧
+  if (rtsp_server_start() != ESP_OK) {
+    ESP_LOGE(TAG, "RTSP server start failed");
+  }
+#endif
   return ESP_OK;
 }
 
 void camera_server_stop() {
   httpd_stop(camera_httpd);
-  httpd_stop(stream_httpd);
 }
 
-void camera_server_destroy() { esp_camera_deinit(); }
+void camera_server_destroy() {
+#if !CAMERA_REPLAY
+  esp_camera_deinit();
+#endif
+}
+
+// 调用者需要持有s_power_mux
+static void power_changed(bool on) {
+  int64_t now = esp_timer_get_time();
+  if (s_sensor_off) {
+    s_sensor_off_us += now - s_power_changed_us;
+  } else {
+    s_sensor_on_us += now - s_power_changed_us;
+  }
+  s_power_changed_us = now;
+  s_sensor_off = !on;
+  s_sensor_wakeups += on;
+}
+
+#if !CAMERA_REPLAY
+// 调用者需要持有s_sensor_lock
+static void sensor_wake(void) {
+  ledc_timer_resume(LEDC_LOW_SPEED_MODE, camera_config.ledc_timer);
+  gpio_set_level(CAMERA_PIN_PWDN, 0);
+  vTaskDelay(pdMS_TO_TICKS(CAMERA_WAKE_MS));
+  portENTER_CRITICAL(&s_power_mux);
+  power_changed(true);
+  portEXIT_CRITICAL(&s_power_mux);
+  for (int i = 0; i < CAMERA_WAKE_SKIP_FRAMES; i++) {
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (fb) {
+      esp_camera_fb_return(fb);
+    }
+  }
+  ESP_LOGD(TAG, "Sensor awake");
+}
+#endif
+
+void camera_sensor_lock(void) {
+  xSemaphoreTake(s_sensor_lock, portMAX_DELAY);
+#if !CAMERA_REPLAY
+  if (s_sensor_off) {
+    sensor_wake();
+  }
+#endif
+}
+
+void camera_sensor_unlock(void) { xSemaphoreGive(s_sensor_lock); }
+
+void camera_sensor_power_down(void) {
+#if !CAMERA_REPLAY
+  xSemaphoreTake(s_sensor_lock, portMAX_DELAY);
+  if (!s_sensor_off) {
+    gpio_set_level(CAMERA_PIN_PWDN, 1);
+    ledc_timer_pause(LEDC_LOW_SPEED_MODE, camera_config.ledc_timer);
+    portENTER_CRITICAL(&s_power_mux);
+    power_changed(false);
+    portEXIT_CRITICAL(&s_power_mux);
+    ESP_LOGD(TAG, "Sensor powered down");
+  }
+  xSemaphoreGive(s_sensor_lock);
+#endif
+}
+
+void camera_sensor_get_power_stats(camera_power_stats_t *stats) {
+  portENTER_CRITICAL(&s_power_mux);
+  int64_t since = esp_timer_get_time() - s_power_changed_us;
+  stats->powered = !s_sensor_off;
+  stats->wakeups = s_sensor_wakeups;
+  stats->on_us = s_sensor_on_us + (s_sensor_off ? 0 : since);
+  stats->off_us = s_sensor_off_us + (s_sensor_off ? since : 0);
+  portEXIT_CRITICAL(&s_power_mux);
+}
 
 static esp_err_t bmp_handler(httpd_req_t *req) {
-  camera_fb_t *fb = NULL;
+  if (!async_handler_on_worker()) {
+    return async_handler_submit(req, bmp_handler);
+  }
   esp_err_t res = ESP_OK;
   uint64_t fr_start = esp_timer_get_time();
-  fb = esp_camera_fb_get();
-  if (!fb) {
+  snapshot_t *snap = snapshot_take();
+  if (!snap) {
     ESP_LOGE(TAG, "Camera capture failed");
     httpd_resp_send_500(req);
     return ESP_FAIL;
@@ -535,26 +513,27 @@ static esp_err_t bmp_handler(httpd_req_t *req) {
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
   char ts[32];
-  snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
+  snprintf(ts, 32, "%lld.%06ld", snap->fb.timestamp.tv_sec,
+           snap->fb.timestamp.tv_usec);
   httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
-  uint8_t *buf = NULL;
   size_t buf_len = 0;
-  bool converted = frame2bmp(fb, &buf, &buf_len);
-  esp_camera_fb_return(fb);
-  if (!converted) {
-    ESP_LOGE(TAG, "BMP Conversion failed");
+  const uint8_t *buf = snapshot_bmp(snap, &buf_len);
+  if (!buf) {
+    snapshot_release(snap);
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
   res = httpd_resp_send(req, (const char *)buf, buf_len);
-  free(buf);
+  bool cached = snap->taken_us < (int64_t)fr_start;
+  snapshot_release(snap);
   uint64_t fr_end = esp_timer_get_time();
-  ESP_LOGI(TAG, "BMP: %llums, %uB", (uint64_t)((fr_end - fr_start) / 1000),
-           buf_len);
+  ESP_LOGI(TAG, "BMP: %llums, %uB%s", (uint64_t)((fr_end - fr_start) / 1000),
+           buf_len, cached ? " (cached)" : "");
   return res;
 }
 
+#if CONFIG_ESP_FACE_DETECT_ENABLED
 static size_t jpg_encode_stream(void *arg, size_t index, const void *data,
                                 size_t len) {
   jpg_chunking_t *j = (jpg_chunking_t *)arg;
@@ -567,8 +546,188 @@ static size_t jpg_encode_stream(void *arg, size_t index, const void *data,
   j->len += len;
   return len;
 }
+#endif
+
+// /capture 和 /thumb 的缩放参数：w、h是输出大小，roi=x,y,w,h是裁剪的区域。
+// 值为0表示没有给出：没有roi就用整个画面，只给了宽或高时按roi的宽高比算另一个
+typedef struct {
+  int width;
+  int height;
+  img_rect_t roi;
+} scale_args_t;
+
+// 返回true表示请求里有缩放或裁剪的参数
+static bool parse_scale_args(httpd_req_t *req, scale_args_t *args) {
+  char query[96];
+  char value[32];
+  bool found = false;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) {
+    return false;
+  }
+  if (httpd_query_key_value(query, "w", value, sizeof(value)) == ESP_OK) {
+    args->width = atoi(value);
+    found = true;
+  }
+  if (httpd_query_key_value(query, "h", value, sizeof(value)) == ESP_OK) {
+    args->height = atoi(value);
+    found = true;
+  }
+  img_rect_t roi;
+  if (httpd_query_key_value(query, "roi", value, sizeof(value)) == ESP_OK &&
+      sscanf(value, "%d,%d,%d,%d", &roi.x, &roi.y, &roi.w, &roi.h) == 4) {
+    args->roi = roi;
+    found = true;
+  }
+  return found;
+}
+
+// 从快照裁剪、缩小后编码成jpg发送。只缩小不放大，超过roi的大小按roi的大小输出
+static esp_err_t send_scaled(httpd_req_t *req, snapshot_t *snap,
+                             const scale_args_t *args, const char *filename) {
+  img_rect_t roi = args->roi;
+  if (roi.w <= 0 || roi.h <= 0) {
+    roi = (img_rect_t){0, 0, snap->fb.width, snap->fb.height};
+  }
+  if (img_rect_clip(&roi, snap->fb.width, snap->fb.height) != 0) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                               "ROI is outside the frame");
+  }
+  int w = args->width;
+  int h = args->height;
+  if (w <= 0 && h <= 0) {
+    w = roi.w;
+    h = roi.h;
+  } else if (w <= 0) {
+    w = (roi.w * h + roi.h / 2) / roi.h;
+  } else if (h <= 0) {
+    h = (roi.h * w + roi.w / 2) / roi.w;
+  }
+  w = w < 1 ? 1 : (w > roi.w ? roi.w : w);
+  h = h < 1 ? 1 : (h > roi.h ? roi.h : h);
+
+  const uint8_t *src = snapshot_rgb565(snap);
+  size_t dst_len = w * h * 2;
+  uint8_t *dst = (uint8_t *)mem_alloc(MEM_POOL_FRAME, dst_len);
+  if (!src || !dst) {
+    free(dst);
+    return httpd_resp_send_500(req);
+  }
+  uint8_t *jpeg = NULL;
+  size_t jpeg_len = 0;
+  bool ok = img_scale_rgb565(src, snap->fb.width, snap->fb.height, &roi, dst,
+                             w, h) == 0 &&
+            mem_fmt2jpg(dst, dst_len, w, h, PIXFORMAT_RGB565,
+                        SNAPSHOT_JPEG_QUALITY, &jpeg, &jpeg_len);
+  free(dst);
+  if (!ok) {
+    ESP_LOGE(TAG, "Scaling to %dx%d failed", w, h);
+    return httpd_resp_send_500(req);
+  }
+
+  char disposition[48];
+  snprintf(disposition, sizeof(disposition), "inline; filename=%s", filename);
+  httpd_resp_set_type(req, "image/jpeg");
+  httpd_resp_set_hdr(req, "Content-Disposition", disposition);
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  char ts[32];
+  snprintf(ts, 32, "%lld.%06ld", snap->fb.timestamp.tv_sec,
+           snap->fb.timestamp.tv_usec);
+  httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
+  esp_err_t res = httpd_resp_send(req, (const char *)jpeg, jpeg_len);
+  free(jpeg);
+  return res;
+}
+
+// 不做人脸检测时的/capture：用快照缓存，短时间内的请求共用一次拍照和编码
+static esp_err_t capture_snapshot(httpd_req_t *req) {
+  int64_t fr_start = esp_timer_get_time();
+  snapshot_t *snap = snapshot_cached();
+  bool cached = snap != NULL;
+  if (!snap) {
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+    enable_led(true);
+    vTaskDelay(150 / portTICK_PERIOD_MS); // 闪光灯要在拍照前150ms打开
+#endif
+    snap = snapshot_take();
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+    enable_led(false);
+#endif
+  }
+  if (!snap) {
+    ESP_LOGE(TAG, "Camera capture failed");
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  // 带了w、h或roi参数：从同一张快照裁剪缩小，不改传感器的设置
+  scale_args_t args = {0};
+  if (parse_scale_args(req, &args)) {
+    esp_err_t res = send_scaled(req, snap, &args, "capture.jpg");
+    snapshot_release(snap);
+    ESP_LOGI(TAG, "JPG scaled: %ums%s",
+             (unsigned int)((esp_timer_get_time() - fr_start) / 1000),
+             cached ? " (cached)" : "");
+    return res;
+  }
+
+  size_t jpeg_len = 0;
+  const uint8_t *jpeg = snapshot_jpeg(snap, &jpeg_len);
+  if (!jpeg) {
+    snapshot_release(snap);
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, "image/jpeg");
+  httpd_resp_set_hdr(req, "Content-Disposition",
+                     "inline; filename=capture.jpg");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  char ts[32];
+  snprintf(ts, 32, "%lld.%06ld", snap->fb.timestamp.tv_sec,
+           snap->fb.timestamp.tv_usec);
+  httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
+
+  esp_err_t res = httpd_resp_send(req, (const char *)jpeg, jpeg_len);
+  snapshot_release(snap);
+  int64_t fr_end = esp_timer_get_time();
+  ESP_LOGI(TAG, "JPG: %uB %ums%s", (unsigned int)(jpeg_len),
+           (unsigned int)((fr_end - fr_start) / 1000),
+           cached ? " (cached)" : "");
+  return res;
+}
+
+// 缩略图：默认THUMB_WIDTH宽，也接受和/capture一样的w、h、roi参数。
+// 页面轮询缩略图时多个请求共用快照缓存中的同一张照片
+static esp_err_t thumb_handler(httpd_req_t *req) {
+  if (!async_handler_on_worker()) {
+    return async_handler_submit(req, thumb_handler);
+  }
+  snapshot_t *snap = snapshot_take();
+  if (!snap) {
+    ESP_LOGE(TAG, "Camera capture failed");
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  scale_args_t args = {.width = THUMB_WIDTH};
+  parse_scale_args(req, &args);
+  esp_err_t res = send_scaled(req, snap, &args, "thumb.jpg");
+  snapshot_release(snap);
+  return res;
+}
 
 static esp_err_t capture_handler(httpd_req_t *req) {
+  // 人脸识别要几百毫秒，拍照都交给工作任务
+  if (!async_handler_on_worker()) {
+    return async_handler_submit(req, capture_handler);
+  }
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+  // 画了人脸框的图片每次都不一样，不能缓存；裁剪缩放的请求不画人脸框
+  scale_args_t args = {0};
+  if (!detection_enabled || parse_scale_args(req, &args)) {
+    return capture_snapshot(req);
+  }
+
   camera_fb_t *fb = NULL;
   esp_err_t res = ESP_OK;
   int64_t fr_start = esp_timer_get_time();
@@ -578,11 +737,15 @@ static esp_err_t capture_handler(httpd_req_t *req) {
   vTaskDelay(150 /
              portTICK_PERIOD_MS); // The LED needs to be turned on ~150ms before
                                   // the call to esp_camera_fb_get()
-  fb = esp_camera_fb_get(); // or it won't be visible in the frame. A better way
-                            // to do this is needed.
+  camera_sensor_lock();
+  fb = frame_source_fb_get(); // or it won't be visible in the frame. A better
+                              // way to do this is needed.
+  camera_sensor_unlock();
   enable_led(false);
 #else
-  fb = esp_camera_fb_get();
+  camera_sensor_lock();
+  fb = frame_source_fb_get();
+  camera_sensor_unlock();
 #endif
 
   if (!fb) {
@@ -600,14 +763,12 @@ static esp_err_t capture_handler(httpd_req_t *req) {
   snprintf(ts, 32, "%lld.%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
   httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
-#if CONFIG_ESP_FACE_DETECT_ENABLED
   size_t out_len, out_width, out_height;
   uint8_t *out_buf;
   bool s;
   bool detected = false;
   int face_id = 0;
-  if (!detection_enabled || fb->width > 400) {
-#endif
+  if (fb->width > 400) {
     size_t fb_len = 0;
     if (fb->format == PIXFORMAT_JPEG) {
       fb_len = fb->len;
@@ -619,34 +780,29 @@ static esp_err_t capture_handler(httpd_req_t *req) {
       httpd_resp_send_chunk(req, NULL, 0);
       fb_len = jchunk.len;
     }
-    esp_camera_fb_return(fb);
+    frame_source_fb_return(fb);
     int64_t fr_end = esp_timer_get_time();
     ESP_LOGI(TAG, "JPG: %uB %ums", (unsigned int)(fb_len),
              (unsigned int)((fr_end - fr_start) / 1000));
     return res;
-#if CONFIG_ESP_FACE_DETECT_ENABLED
   }
 
   jpg_chunking_t jchunk = {req, 0};
+  face_result_t result = {0}; // 检测失败时保持为空
+  int64_t fr_face, fr_draw, fr_encode;
 
-  if (fb->format == PIXFORMAT_RGB565
+  bool recognize = false, enroll = false;
 #if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-      && !recognition_enabled
-#endif
-  ) {
-#if TWO_STAGE
-    HumanFaceDetectMSR01 s1(0.1F, 0.5F, 10, 0.2F);
-    HumanFaceDetectMNP01 s2(0.5F, 0.3F, 5);
-    std::list<dl::detect::result_t> &candidates =
-        s1.infer((uint16_t *)fb->buf, {(int)fb->height, (int)fb->width, 3});
-    std::list<dl::detect::result_t> &results = s2.infer(
-        (uint16_t *)fb->buf, {(int)fb->height, (int)fb->width, 3}, candidates);
-#else
-    HumanFaceDetectMSR01 s1(0.3F, 0.5F, 10, 0.2F);
-    std::list<dl::detect::result_t> &results =
-        s1.infer((uint16_t *)fb->buf, {(int)fb->height, (int)fb->width, 3});
+  recognize = recognition_enabled;
+  enroll = is_enrolling;
 #endif
-    if (results.size() > 0) {
+
+  // RGB565直接检测和画框，识别时推理任务只转换人脸区域
+  if (fb->format == PIXFORMAT_RGB565 && (FACE_RECOGNITION_CROP || !recognize)) {
+    face_engine_detect(fb->buf, fb->width, fb->height, PIXFORMAT_RGB565,
+                       recognize, enroll, &result);
+    fr_face = esp_timer_get_time();
+    if (result.count > 0) {
       fb_data_t rfb;
       rfb.width = fb->width;
       rfb.height = fb->height;
@@ -654,23 +810,27 @@ static esp_err_t capture_handler(httpd_req_t *req) {
       rfb.bytes_per_pixel = 2;
       rfb.format = FB_RGB565;
       detected = true;
-      draw_face_boxes(&rfb, &results, face_id);
+      face_id = result.face_id;
+      face_engine_draw(&rfb, &result);
     }
+    fr_draw = esp_timer_get_time();
     s = fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, PIXFORMAT_RGB565,
                    90, jpg_encode_stream, &jchunk);
-    esp_camera_fb_return(fb);
+    frame_source_fb_return(fb);
   } else {
     out_len = fb->width * fb->height * 3;
     out_width = fb->width;
     out_height = fb->height;
-    out_buf = (uint8_t *)malloc(out_len);
+    out_buf = (uint8_t *)mem_alloc(MEM_POOL_FRAME, out_len);
     if (!out_buf) {
       ESP_LOGE(TAG, "out_buf malloc failed");
       httpd_resp_send_500(req);
       return ESP_FAIL;
     }
+    int64_t fr_convert = esp_timer_get_time();
     s = fmt2rgb888(fb->buf, fb->len, fb->format, out_buf);
-    esp_camera_fb_return(fb);
+    fr_convert = esp_timer_get_time() - fr_convert;
+    frame_source_fb_return(fb);
     if (!s) {
       free(out_buf);
       ESP_LOGE(TAG, "To rgb888 failed");
@@ -685,131 +845,107 @@ static esp_err_t capture_handler(httpd_req_t *req) {
     rfb.bytes_per_pixel = 3;
     rfb.format = FB_BGR888;
 
-#if TWO_STAGE
-    HumanFaceDetectMSR01 s1(0.1F, 0.5F, 10, 0.2F);
-    HumanFaceDetectMNP01 s2(0.5F, 0.3F, 5);
-    std::list<dl::detect::result_t> &candidates =
-        s1.infer((uint8_t *)out_buf, {(int)out_height, (int)out_width, 3});
-    std::list<dl::detect::result_t> &results = s2.infer(
-        (uint8_t *)out_buf, {(int)out_height, (int)out_width, 3}, candidates);
-#else
-    HumanFaceDetectMSR01 s1(0.3F, 0.5F, 10, 0.2F);
-    std::list<dl::detect::result_t> &results =
-        s1.infer((uint8_t *)out_buf, {(int)out_height, (int)out_width, 3});
-#endif
-
-    if (results.size() > 0) {
+    face_engine_detect(out_buf, out_width, out_height, PIXFORMAT_RGB888,
+                       recognize, enroll, &result);
+    result.convert_bytes = out_len;
+    result.convert_us = fr_convert;
+    fr_face = esp_timer_get_time();
+    if (result.count > 0) {
       detected = true;
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-      if (recognition_enabled) {
-        face_id = run_face_recognition(&rfb, &results);
-      }
-#endif
-      draw_face_boxes(&rfb, &results, face_id);
+      face_id = result.face_id;
+      face_engine_draw(&rfb, &result);
     }
+    fr_draw = esp_timer_get_time();
 
     s = fmt2jpg_cb(out_buf, out_len, out_width, out_height, PIXFORMAT_RGB888,
                    90, jpg_encode_stream, &jchunk);
     free(out_buf);
   }
+  fr_encode = esp_timer_get_time();
 
   if (!s) {
     ESP_LOGE(TAG, "JPEG compression failed");
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
-  int64_t fr_end = esp_timer_get_time();
-  ESP_LOGI(TAG, "FACE: %uB %ums %s%d", (unsigned int)(jchunk.len),
-           (unsigned int)((fr_end - fr_start) / 1000),
-           detected ? "DETECTED " : "", face_id);
+  // 各阶段耗时：候选框(MSR01)、精修(MNP01)、识别、画框、编码发送；
+  // conv是为识别转换RGB888用的内存和时间，整帧(旧的做法)或者只有人脸区域
+  ESP_LOGI(TAG,
+           "FACE: %uB %ums (cand %ums, refine %ums, recog %ums, draw %ums, "
+           "enc %ums, conv %uB %uus) %s%d",
+           (unsigned int)(jchunk.len),
+           (unsigned int)((fr_encode - fr_start) / 1000),
+           (unsigned int)(result.candidates_us / 1000),
+           (unsigned int)(result.refine_us / 1000),
+           (unsigned int)(result.recognize_us / 1000),
+           (unsigned int)((fr_draw - fr_face) / 1000),
+           (unsigned int)((fr_encode - fr_draw) / 1000),
+           (unsigned int)result.convert_bytes,
+           (unsigned int)result.convert_us, detected ? "DETECTED " : "",
+           face_id);
   return res;
+#else
+  return capture_snapshot(req);
 #endif
 }
 
-// 第一步：拍照并放入缓冲区
-// 第二步：将缓冲区中的图片数据转换成jpg格式
-// 第三步：将jpg格式的图片分段发送至前端浏览器
+// 拍照、编码、发送都由stream_hub完成，这里只发送响应头，然后把socket交给它。
+// 处理函数马上返回，不会一直占着http服务器的任务；慢的客户端只会丢自己的帧。
 static esp_err_t stream_handler(httpd_req_t *req) {
-  camera_fb_t *fb = NULL;
-  struct timeval _timestamp;
-  esp_err_t res = ESP_OK;
-  size_t _jpg_buf_len = 0;
-  uint8_t *_jpg_buf = NULL;
-  char *part_buf[128];
-
-  static int64_t last_frame = 0;
-  if (!last_frame) {
-    last_frame = esp_timer_get_time();
+  // /stream?layer=low：同一次采集缩小后的低分辨率层，见stream_hub.h
+  // /stream?probe=1：每个part带上帧序号和设备上的时刻，用来测量延迟
+  char query[32];
+  char value[8];
+  bool probe = false;
+  int layer = STREAM_LAYER_FULL;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    probe = httpd_query_key_value(query, "probe", value, sizeof(value)) ==
+                ESP_OK &&
+            atoi(value);
+    if (httpd_query_key_value(query, "layer", value, sizeof(value)) ==
+        ESP_OK) {
+      layer = stream_hub_layer_from_name(value);
+    }
   }
-
-  res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-  if (res != ESP_OK) {
-    return res;
+  if (layer < 0) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                               "layer is full or low");
   }
 
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  // 响应的帧率是60张图片每秒钟
-  httpd_resp_set_hdr(req, "X-Framerate", "60");
-
-  while (true) {
-    // 拍照并将照片存储到图片缓冲区中
-    fb = esp_camera_fb_get();
-    if (!fb) {
-      ESP_LOGE(TAG, "Camera capture failed");
-      res = ESP_FAIL;
-    } else {
-      _timestamp.tv_sec = fb->timestamp.tv_sec;
-      _timestamp.tv_usec = fb->timestamp.tv_usec;
-      if (fb->format != PIXFORMAT_JPEG) {
-        bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-        esp_camera_fb_return(fb);
-        fb = NULL;
-        if (!jpeg_converted) {
-          ESP_LOGE(TAG, "JPEG compression failed");
-          res = ESP_FAIL;
-        }
-      } else {
-        _jpg_buf_len = fb->len;
-        _jpg_buf = fb->buf;
-      }
-    }
-    // 分段将图片数据发送到前端浏览器页面
-    if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY,
-                                  strlen(_STREAM_BOUNDARY));
-    }
-    if (res == ESP_OK) {
-      size_t hlen = snprintf((char *)part_buf, 128, _STREAM_PART, _jpg_buf_len,
-                             _timestamp.tv_sec, _timestamp.tv_usec);
-      res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-    }
-    if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-    }
-    if (fb) {
-      esp_camera_fb_return(fb);
-      fb = NULL;
-      _jpg_buf = NULL;
-    } else if (_jpg_buf) {
-      free(_jpg_buf);
-      _jpg_buf = NULL;
-    }
-    if (res != ESP_OK) {
-      ESP_LOGE(TAG, "Send frame failed");
-      break;
-    }
-    int64_t fr_end = esp_timer_get_time();
-
-    int64_t frame_time = fr_end - last_frame;
-    frame_time /= 1000;
-    unsigned int avg_frame_time = ra_filter_run(&ra_filter, frame_time);
-    ESP_LOGI(TAG, "MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps)",
-             (unsigned int)(_jpg_buf_len), (unsigned int)frame_time,
-             1000.0 / (unsigned int)frame_time, avg_frame_time,
-             1000.0 / avg_frame_time);
+  char header[256];
+  // multipart流没有Content-Length，也不用chunked编码，直到连接关闭为止
+  int len = snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: %s\r\n"
+                     "Access-Control-Allow-Origin: *\r\n"
+                     "X-Framerate: %d\r\n"
+                     "\r\n",
+                     _STREAM_CONTENT_TYPE,
+                     layer == STREAM_LAYER_LOW ? STREAM_LOW_FPS
+                                               : STREAM_TARGET_FPS);
+  if (httpd_send(req, header, len) != len) {
+    ESP_LOGE(TAG, "Send stream header failed");
+    return ESP_FAIL;
   }
+  // 返回ESP_FAIL会让http服务器关闭这个连接
+  int fd = httpd_req_to_sockfd(req);
+  if (stream_hub_attach(req->handle, fd, STREAM_CLIENT_MULTIPART) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  stream_hub_set_layer(fd, (stream_layer_t)layer);
+  stream_hub_set_probe(fd, probe);
+  return ESP_OK;
+}
 
-  return res;
+// 设备的时钟（esp_timer，微秒），host/latency_probe.py 用来对时
+static esp_err_t time_handler(httpd_req_t *req) {
+  char json[48];
+  int len = snprintf(json, sizeof(json), "{\"device_us\":%lld}",
+                     esp_timer_get_time());
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json, len);
 }
 
 static esp_err_t parse_get(httpd_req_t *req, char **obuf) {
@@ -833,28 +969,59 @@ static esp_err_t parse_get(httpd_req_t *req, char **obuf) {
   return ESP_FAIL;
 }
 
-static esp_err_t cmd_handler(httpd_req_t *req) {
-  char *buf = NULL;
-  char variable[32];
-  char value[32];
+// 修改一项传感器设置，/control 和 /ws/video 共用
+// 修改一项设置，调用者需要持有传感器锁
+static int apply_control(const char *variable, int val) {
+  ESP_LOGI(TAG, "%s = %d", variable, val);
+  sensor_t *s = frame_source_sensor_get();
+  int res = 0;
 
-  if (parse_get(req, &buf) != ESP_OK) {
-    return ESP_FAIL;
+  if (!strcmp(variable, "motion_gate")) {
+    stream_hub_set_motion_gate(val);
+  } else if (!strcmp(variable, "clip_arm")) {
+    clip_recorder_set_enabled(val);
+  } else if (!strcmp(variable, "clip_trigger")) {
+    clip_recorder_trigger(CLIP_TRIGGER_HTTP);
+  } else if (!strcmp(variable, "timelapse")) {
+    timelapse_set_enabled(val);
+  } else if (!strcmp(variable, "timelapse_interval")) {
+    timelapse_set_interval(val);
   }
-  if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) != ESP_OK ||
-      httpd_query_key_value(buf, "val", value, sizeof(value)) != ESP_OK) {
-    free(buf);
-    httpd_resp_send_404(req);
-    return ESP_FAIL;
+#if CONFIG_LED_ILLUMINATOR_ENABLED
+  else if (!strcmp(variable, "led_intensity")) {
+    led_duty = val;
+    if (isStreaming) {
+      enable_led(true);
+    }
   }
-  free(buf);
-
-  int val = atoi(value);
-  ESP_LOGI(TAG, "%s = %d", variable, val);
-  sensor_t *s = esp_camera_sensor_get();
-  int res = 0;
+#endif
 
-  if (!strcmp(variable, "framesize")) {
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+  else if (!strcmp(variable, "face_detect")) {
+    detection_enabled = val;
+    stream_hub_set_face_detect(detection_enabled);
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+    if (!detection_enabled) {
+      recognition_enabled = 0;
+    }
+#endif
+  }
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+  else if (!strcmp(variable, "face_enroll")) {
+    is_enrolling = !is_enrolling;
+    ESP_LOGI(TAG, "Enrolling: %s", is_enrolling ? "true" : "false");
+  } else if (!strcmp(variable, "face_recognize")) {
+    recognition_enabled = val;
+    if (recognition_enabled) {
+      detection_enabled = val;
+      stream_hub_set_face_detect(detection_enabled);
+    }
+  }
+#endif
+#endif
+  else if (!s) {
+    res = -1; // 回放录好的帧时没有传感器
+  } else if (!strcmp(variable, "framesize")) {
     if (s->pixformat == PIXFORMAT_JPEG) {
       res = s->set_framesize(s, (framesize_t)val);
     }
@@ -904,42 +1071,99 @@ static esp_err_t cmd_handler(httpd_req_t *req) {
     res = s->set_wb_mode(s, val);
   } else if (!strcmp(variable, "ae_level")) {
     res = s->set_ae_level(s, val);
+  } else {
+    ESP_LOGI(TAG, "Unknown command: %s", variable);
+    res = -1;
   }
-#if CONFIG_LED_ILLUMINATOR_ENABLED
-  else if (!strcmp(variable, "led_intensity")) {
-    led_duty = val;
-    if (isStreaming) {
-      enable_led(true);
-    }
-  }
-#endif
+  return res;
+}
 
-#if CONFIG_ESP_FACE_DETECT_ENABLED
-  else if (!strcmp(variable, "face_detect")) {
-    detection_enabled = val;
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-    if (!detection_enabled) {
-      recognition_enabled = 0;
-    }
-#endif
+static int set_control(const char *variable, int val) {
+  status_refresh(); // 推送的差异要和改之前的设置比较
+  camera_sensor_lock();
+  int res = apply_control(variable, val);
+  camera_sensor_unlock();
+  // 缓存的快照和状态都是旧设置的
+  status_changed();
+  return res;
+}
+
+// 传感器当前的设置值，不是传感器设置（或者不知道）时返回false
+static bool control_value(sensor_t *s, const char *variable, int *val) {
+  if (!s) {
+    return false;
   }
-#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
-  else if (!strcmp(variable, "face_enroll")) {
-    is_enrolling = !is_enrolling;
-    ESP_LOGI(TAG, "Enrolling: %s", is_enrolling ? "true" : "false");
-  } else if (!strcmp(variable, "face_recognize")) {
-    recognition_enabled = val;
-    if (recognition_enabled) {
-      detection_enabled = val;
-    }
+  if (!strcmp(variable, "framesize")) {
+    *val = s->status.framesize;
+  } else if (!strcmp(variable, "quality")) {
+    *val = s->status.quality;
+  } else if (!strcmp(variable, "contrast")) {
+    *val = s->status.contrast;
+  } else if (!strcmp(variable, "brightness")) {
+    *val = s->status.brightness;
+  } else if (!strcmp(variable, "saturation")) {
+    *val = s->status.saturation;
+  } else if (!strcmp(variable, "gainceiling")) {
+    *val = s->status.gainceiling;
+  } else if (!strcmp(variable, "colorbar")) {
+    *val = s->status.colorbar;
+  } else if (!strcmp(variable, "awb")) {
+    *val = s->status.awb;
+  } else if (!strcmp(variable, "agc")) {
+    *val = s->status.agc;
+  } else if (!strcmp(variable, "aec")) {
+    *val = s->status.aec;
+  } else if (!strcmp(variable, "hmirror")) {
+    *val = s->status.hmirror;
+  } else if (!strcmp(variable, "vflip")) {
+    *val = s->status.vflip;
+  } else if (!strcmp(variable, "awb_gain")) {
+    *val = s->status.awb_gain;
+  } else if (!strcmp(variable, "agc_gain")) {
+    *val = s->status.agc_gain;
+  } else if (!strcmp(variable, "aec_value")) {
+    *val = s->status.aec_value;
+  } else if (!strcmp(variable, "aec2")) {
+    *val = s->status.aec2;
+  } else if (!strcmp(variable, "dcw")) {
+    *val = s->status.dcw;
+  } else if (!strcmp(variable, "bpc")) {
+    *val = s->status.bpc;
+  } else if (!strcmp(variable, "wpc")) {
+    *val = s->status.wpc;
+  } else if (!strcmp(variable, "raw_gma")) {
+    *val = s->status.raw_gma;
+  } else if (!strcmp(variable, "lenc")) {
+    *val = s->status.lenc;
+  } else if (!strcmp(variable, "special_effect")) {
+    *val = s->status.special_effect;
+  } else if (!strcmp(variable, "wb_mode")) {
+    *val = s->status.wb_mode;
+  } else if (!strcmp(variable, "ae_level")) {
+    *val = s->status.ae_level;
+  } else {
+    return false;
   }
-#endif
-#endif
-  else {
-    ESP_LOGI(TAG, "Unknown command: %s", variable);
-    res = -1;
+  return true;
+}
+
+static esp_err_t cmd_handler(httpd_req_t *req) {
+  char *buf = NULL;
+  char variable[32];
+  char value[32];
+
+  if (parse_get(req, &buf) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  if (httpd_query_key_value(buf, "var", variable, sizeof(variable)) != ESP_OK ||
+      httpd_query_key_value(buf, "val", value, sizeof(value)) != ESP_OK) {
+    free(buf);
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
   }
+  free(buf);
 
+  int res = set_control(variable, atoi(value));
   if (res < 0) {
     return httpd_resp_send_500(req);
   }
@@ -948,6 +1172,82 @@ static esp_err_t cmd_handler(httpd_req_t *req) {
   return httpd_resp_send(req, NULL, 0);
 }
 
+// /controls?framesize=5&quality=10&awb=1...：一次修改多项设置（比如应用预设）。
+// 同一项出现多次时以最后一次为准，和当前值相同的不写传感器，framesize最先修改；
+// 所有设置在两帧之间一起生效，最后只推送一次状态。
+static esp_err_t cmd_batch_handler(httpd_req_t *req) {
+  char *buf = NULL;
+  control_item_t items[CONTROL_BATCH_MAX];
+  int count = 0;
+
+  if (parse_get(req, &buf) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  char *save = NULL;
+  for (char *item = strtok_r(buf, "&", &save); item;
+       item = strtok_r(NULL, "&", &save)) {
+    char *eq = strchr(item, '=');
+    if (!eq || eq == item || eq - item >= (int)sizeof(items[0].variable)) {
+      continue;
+    }
+    *eq = 0;
+    int i = 0;
+    while (i < count && strcmp(items[i].variable, item)) {
+      i++;
+    }
+    if (i == count) {
+      if (count == CONTROL_BATCH_MAX) {
+        continue;
+      }
+      strcpy(items[count++].variable, item);
+    }
+    items[i].val = atoi(eq + 1);
+  }
+  free(buf);
+  if (count == 0) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+
+  // 先改分辨率，其他设置在新的分辨率上生效
+  for (int i = 1; i < count; i++) {
+    if (!strcmp(items[i].variable, "framesize")) {
+      control_item_t framesize = items[i];
+      memmove(&items[1], &items[0], i * sizeof(items[0]));
+      items[0] = framesize;
+      break;
+    }
+  }
+
+  int applied = 0, unchanged = 0, failed = 0;
+  sensor_t *s = frame_source_sensor_get();
+  status_refresh(); // 推送的差异要和改之前的设置比较
+  camera_sensor_lock();
+  for (int i = 0; i < count; i++) {
+    int current;
+    if (control_value(s, items[i].variable, &current) &&
+        current == items[i].val) {
+      unchanged++;
+    } else if (apply_control(items[i].variable, items[i].val) < 0) {
+      failed++;
+    } else {
+      applied++;
+    }
+  }
+  camera_sensor_unlock();
+  if (applied) {
+    status_changed();
+  }
+
+  char json[64];
+  snprintf(json, sizeof(json),
+           "{\"applied\":%d,\"unchanged\":%d,\"failed\":%d}", applied,
+           unchanged, failed);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return httpd_resp_send(req, json, strlen(json));
+}
+
 static int print_reg(char *p, sensor_t *s, uint16_t reg, unsigned int mask) {
   return sprintf(p, "\"0x%x\":%u,", reg, s->get_reg(s, reg, mask));
 }
@@ -969,8 +1269,14 @@ static esp_err_t xclk_handler(httpd_req_t *req) {
   int xclk = atoi(_xclk);
   ESP_LOGI(TAG, "Set XCLK: %d MHz", xclk);
 
-  sensor_t *s = esp_camera_sensor_get();
+  sensor_t *s = frame_source_sensor_get();
+  if (!s) {
+    return httpd_resp_send_404(req);
+  }
+  camera_sensor_lock();
   int res = s->set_xclk(s, LEDC_TIMER_0, xclk);
+  camera_sensor_unlock();
+  status_changed();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -1003,8 +1309,14 @@ static esp_err_t reg_handler(httpd_req_t *req) {
   ESP_LOGI(TAG, "Set Register: reg: 0x%02x, mask: 0x%02x, value: 0x%02x", reg,
            mask, val);
 
-  sensor_t *s = esp_camera_sensor_get();
+  sensor_t *s = frame_source_sensor_get();
+  if (!s) {
+    return httpd_resp_send_404(req);
+  }
+  camera_sensor_lock();
   int res = s->set_reg(s, reg, mask, val);
+  camera_sensor_unlock();
+  status_changed();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -1031,8 +1343,13 @@ static esp_err_t greg_handler(httpd_req_t *req) {
 
   int reg = atoi(_reg);
   int mask = atoi(_mask);
-  sensor_t *s = esp_camera_sensor_get();
+  sensor_t *s = frame_source_sensor_get();
+  if (!s) {
+    return httpd_resp_send_404(req);
+  }
+  camera_sensor_lock();
   int res = s->get_reg(s, reg, mask);
+  camera_sensor_unlock();
   if (res < 0) {
     return httpd_resp_send_500(req);
   }
@@ -1045,13 +1362,8 @@ static esp_err_t greg_handler(httpd_req_t *req) {
   return httpd_resp_send(req, val, strlen(val));
 }
 
-static esp_err_t status_handler(httpd_req_t *req) {
-  static char json_response[1024];
-
-  sensor_t *s = esp_camera_sensor_get();
-  char *p = json_response;
-  *p++ = '{';
-
+// /status中传感器的设置和寄存器，每项后面都有逗号。调用者需要持有传感器锁
+static char *print_sensor_status(char *p, sensor_t *s) {
   if (s->id.PID == OV5640_PID || s->id.PID == OV3660_PID) {
     for (int reg = 0x3400; reg < 0x3406; reg += 2) {
       p += print_reg(p, s, reg, 0xFFF); // 12 bit
@@ -1106,7 +1418,23 @@ static esp_err_t status_handler(httpd_req_t *req) {
   p += sprintf(p, "\"lenc\":%u,", s->status.lenc);
   p += sprintf(p, "\"hmirror\":%u,", s->status.hmirror);
   p += sprintf(p, "\"dcw\":%u,", s->status.dcw);
-  p += sprintf(p, "\"colorbar\":%u", s->status.colorbar);
+  p += sprintf(p, "\"colorbar\":%u,", s->status.colorbar);
+  return p;
+}
+
+// 生成/status的JSON，只在设置改变后调用。回放录好的帧时没有传感器的设置
+static size_t build_status(char *json) {
+  sensor_t *s = frame_source_sensor_get();
+  char *p = json;
+  *p++ = '{';
+  if (s) {
+    camera_sensor_lock(); // 读寄存器，传感器休眠时先唤醒
+    p = print_sensor_status(p, s);
+    camera_sensor_unlock();
+  }
+  p += sprintf(p, "\"motion_gate\":%u,", stream_hub_get_motion_gate());
+  p += sprintf(p, "\"clip_arm\":%u,", clip_recorder_enabled());
+  p += sprintf(p, "\"timelapse\":%u", timelapse_enabled());
 #if CONFIG_LED_ILLUMINATOR_ENABLED
   p += sprintf(p, ",\"led_intensity\":%u", led_duty);
 #else
@@ -1120,10 +1448,148 @@ static esp_err_t status_handler(httpd_req_t *req) {
 #endif
 #endif
   *p++ = '}';
-  *p++ = 0;
-  httpd_resp_set_type(req, "application/json");
+  *p = 0;
+  return p - json;
+}
+
+// 在上一次的JSON中找到key对应的值，返回值的长度
+static int status_find(const char *json, const char *key, size_t key_len,
+                       const char **value) {
+  for (const char *p = json; (p = strchr(p, '"')) != NULL; p++) {
+    // 必须是完整的 "key": ，不能是别的key的一部分
+    if ((p[-1] == ',' || p[-1] == '{') && !strncmp(p, key, key_len) &&
+        p[key_len] == ':') {
+      *value = p + key_len + 1;
+      return strcspn(*value, ",}");
+    }
+  }
+  return -1;
+}
+
+// 把两次JSON中值不同的字段写成 "key":value,... ，返回长度；放不下返回-1
+static int status_diff(const char *old_json, const char *new_json, char *out,
+                       size_t out_len) {
+  size_t n = 0;
+  const char *p = new_json + 1;
+  while (*p == '"') {
+    size_t key_len = strchr(p + 1, '"') - p + 1;
+    const char *value = p + key_len + 1;
+    size_t value_len = strcspn(value, ",}");
+    const char *old_value;
+    int old_len = status_find(old_json, p, key_len, &old_value);
+    if (old_len != (int)value_len || memcmp(old_value, value, value_len)) {
+      size_t item_len = key_len + 1 + value_len;
+      if (n + item_len + 1 >= out_len) {
+        return -1;
+      }
+      if (n) {
+        out[n++] = ',';
+      }
+      memcpy(out + n, p, item_len);
+      n += item_len;
+    }
+    p = value + value_len;
+    if (*p == ',') {
+      p++;
+    }
+  }
+  out[n] = 0;
+  return n;
+}
+
+// 状态JSON只在设置改变时重新生成。
+// All callers run on the httpd task, so the cache needs no lock; other tasks
+// go through camera_server_status_changed().
+static char s_status_json[1024];
+static size_t s_status_len = 0;
+static uint32_t s_status_version = 1;
+static uint32_t s_status_built = 0;
+// ETag的前缀：版本号每次开机都从1开始，重启后旧的ETag不能匹配到新的内容
+static uint32_t s_status_boot_id = 0;
+
+static void status_refresh(void) {
+  if (s_status_built != s_status_version) {
+    s_status_len = build_status(s_status_json);
+    s_status_built = s_status_version;
+  }
+}
+
+// 设置改变后调用：快照和状态JSON失效，并把变化的字段推送给websocket客户端
+static void status_changed(void) {
+  snapshot_invalidate();
+
+  stream_client_stats_t clients[STREAM_HUB_MAX_CLIENTS];
+  int count = stream_hub_get_stats(clients, STREAM_HUB_MAX_CLIENTS);
+  bool has_ws = false;
+  for (int i = 0; i < count && i < STREAM_HUB_MAX_CLIENTS; i++) {
+    has_ws |= clients[i].type == STREAM_CLIENT_WS;
+  }
+  if (!has_ws) {
+    s_status_version++;
+    return;
+  }
+
+  // 和上一次生成的JSON比较。/control会在修改之前先刷新缓存，
+  // other callers (/timelapse) diff against whatever was built last, which
+  // at worst repeats fields that did not change.
+  bool had_json = s_status_built != 0;
+  static char old_json[sizeof(s_status_json)];
+  memcpy(old_json, s_status_json, s_status_len + 1);
+  s_status_version++;
+  status_refresh();
+
+  char msg[STATUS_PUSH_MAX];
+  int n = snprintf(msg, sizeof(msg), "{\"version\":%u,\"status\":{",
+                   s_status_version);
+  int len = had_json ? status_diff(old_json, s_status_json, msg + n,
+                                   sizeof(msg) - n - 2)
+                     : -1;
+  if (len == 0) {
+    return; // 没有变化，比如设置成了原来的值
+  }
+  if (len < 0) {
+    // 变化太多放不下，只通知版本号，客户端重新获取/status
+    snprintf(msg, sizeof(msg), "{\"version\":%u}", s_status_version);
+  } else {
+    strcpy(msg + n + len, "}}");
+  }
+  for (int i = 0; i < count && i < STREAM_HUB_MAX_CLIENTS; i++) {
+    if (clients[i].type == STREAM_CLIENT_WS) {
+      stream_hub_send_text(clients[i].fd, msg);
+    }
+  }
+}
+
+static void status_changed_work(void *arg) { status_changed(); }
+
+esp_err_t camera_server_status_changed(void) {
+  if (!camera_httpd) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  return httpd_queue_work(camera_httpd, status_changed_work, NULL);
+}
+
+static esp_err_t status_handler(httpd_req_t *req) {
+  status_refresh();
+
+  if (s_status_boot_id == 0) {
+    s_status_boot_id = esp_random() | 1;
+  }
+  char etag[24];
+  char match[24];
+  snprintf(etag, sizeof(etag), "\"%08x-%u\"", (unsigned int)s_status_boot_id,
+           s_status_version);
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  return httpd_resp_send(req, json_response, strlen(json_response));
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(req, "ETag", etag);
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", match,
+                                  sizeof(match)) == ESP_OK &&
+      !strcmp(match, etag)) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_send(req, s_status_json, s_status_len);
 }
 
 static int parse_get_var(char *buf, const char *key, int def) {
@@ -1155,8 +1621,14 @@ static esp_err_t pll_handler(httpd_req_t *req) {
            "Set Pll: bypass: %d, mul: %d, sys: %d, root: %d, pre: %d, seld5: "
            "%d, pclken: %d, pclk: %d",
            bypass, mul, sys, root, pre, seld5, pclken, pclk);
-  sensor_t *s = esp_camera_sensor_get();
+  sensor_t *s = frame_source_sensor_get();
+  if (!s) {
+    return httpd_resp_send_404(req);
+  }
+  camera_sensor_lock();
   int res = s->set_pll(s, bypass, mul, sys, root, pre, seld5, pclken, pclk);
+  camera_sensor_unlock();
+  status_changed();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -1191,9 +1663,15 @@ static esp_err_t win_handler(httpd_req_t *req) {
            "Output: %d %d, Scale: %u, Binning: %u",
            startX, startY, endX, endY, offsetX, offsetY, totalX, totalY,
            outputX, outputY, scale, binning);
-  sensor_t *s = esp_camera_sensor_get();
+  sensor_t *s = frame_source_sensor_get();
+  if (!s) {
+    return httpd_resp_send_404(req);
+  }
+  camera_sensor_lock();
   int res = s->set_res_raw(s, startX, startY, endX, endY, offsetX, offsetY,
                            totalX, totalY, outputX, outputY, scale, binning);
+  camera_sensor_unlock();
+  status_changed();
   if (res) {
     return httpd_resp_send_500(req);
   }
@@ -1203,27 +1681,14 @@ static esp_err_t win_handler(httpd_req_t *req) {
 }
 
 static esp_err_t index_handler(httpd_req_t *req) {
-  httpd_resp_set_type(req, "text/html");
-  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-  // 获取摄像头传感器的属性
-  sensor_t *s = esp_camera_sensor_get();
-  if (s != NULL) {
-    if (s->id.PID == OV3660_PID) {
-      return httpd_resp_send(req, (const char *)index_ov3660_html_gz,
-                             index_ov3660_html_gz_len);
-    } else if (s->id.PID == OV5640_PID) {
-      return httpd_resp_send(req, (const char *)index_ov5640_html_gz,
-                             index_ov5640_html_gz_len);
-    }
-    // OV2640执行这里
-    else {
-      // 向浏览器发送响应response
-      // index_ov2640_html_gz是压缩过的html字符串
-      return httpd_resp_send(req, (const char *)index_ov2640_html_gz,
-                             index_ov2640_html_gz_len);
-    }
-  } else {
-    ESP_LOGE(TAG, "Camera sensor not found");
-    return httpd_resp_send_500(req);
+  // 获取摄像头传感器的属性，回放录好的帧时用OV2640的页面
+  sensor_t *s = frame_source_sensor_get();
+  const char *page = "index_ov2640.html";
+  if (s != NULL && s->id.PID == OV3660_PID) {
+    page = "index_ov3660.html";
+  } else if (s != NULL && s->id.PID == OV5640_PID) {
+    page = "index_ov5640.html";
   }
+  // 页面是压缩过的html，直接从www分区发送
+  return www_send(req, page, "text/html");
 }
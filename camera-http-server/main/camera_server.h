@@ -20,6 +20,51 @@
 #define CAMERA_PIN_VSYNC 41
 #define CAMERA_PIN_XCLK 37
 
+// 视频流的码率控制参数
+#define STREAM_TARGET_FPS 15
+#define STREAM_MIN_QUALITY 30 // frame2jpg()的质量，1~100，越大越清晰
+#define STREAM_MAX_QUALITY 80
+#define STREAM_MAX_SIZE_STEP 2 // 最多比配置的分辨率降低几档
+#define STREAM_MIN_FRAMESIZE FRAMESIZE_QQVGA
+
+// 画面没有变化时不编码、不发送，只按STREAM_KEEPALIVE_MS发一帧保活
+#define STREAM_MOTION_GATE 1       // 默认是否打开，运行时用 motion_gate 控制
+#define STREAM_MOTION_THRESHOLD 8  // 块亮度均值变化超过多少算变化，0~255
+#define STREAM_MOTION_MIN_BLOCKS 3 // 至少几个块变化才算有运动
+#define STREAM_KEEPALIVE_MS 1000
+
+// 低分辨率层（/stream?layer=low），同一帧缩小后单独编码，给手机看，见stream_hub.h
+#define STREAM_LOW_WIDTH 320 // 画面不比这个宽时缩小一半
+#define STREAM_LOW_FPS 5
+
+// 视频流上的人脸检测：推理任务按较低的帧率检测，人脸框画在之后的帧上
+#define STREAM_FACE_FPS 3
+#define STREAM_FACE_MAX_AGE_MS 1000 // 检测结果太旧就不画了
+
+// 设置改变时推送给websocket客户端的状态消息的最大长度，
+// 放不下时只推送版本号（要小于stream_hub的文本缓冲区）
+#define STATUS_PUSH_MAX 160
+
+#define CONTROL_BATCH_MAX 32 // /controls 一次最多修改几项设置
+
+// 没有摄像头时从文件回放画面（见frame_replay.h），文件放在存储分区里，
+// 例如 /storage/replay/0001.jpg；.rgb文件是CAMERA_REPLAY_WIDTH x HEIGHT的RGB565
+#define CAMERA_REPLAY 0
+#define CAMERA_REPLAY_DIR "/storage/replay"
+#define CAMERA_REPLAY_FPS 15
+#define CAMERA_REPLAY_WIDTH 240
+#define CAMERA_REPLAY_HEIGHT 240
+
+// RTSP服务器（rtsp://<ip>/stream，RTP/UDP上的MJPEG），给NVR和VLC用，
+// 见rtsp_server.h
+#define RTSP_SERVER 1
+
+// 传感器休眠（间隔拍照用），见camera_sensor_power_down()
+#define CAMERA_WAKE_MS 50         // 拉低PWDN之后等传感器稳定
+#define CAMERA_WAKE_SKIP_FRAMES 2 // 醒来后丢掉的帧：休眠前没采完的和曝光还没调好的
+
+#define THUMB_WIDTH 96 // /thumb 默认的宽度，高度按画面的宽高比
+
 esp_err_t camera_server_init();
 
 esp_err_t camera_server_start();
@@ -27,6 +72,29 @@ void camera_server_stop();
 
 void camera_server_destroy();
 
+// 不经过/control改了/status里的设置后调用（比如/timelapse?enable=）。
+// Safe from any task: the cache refresh and the WebSocket push are queued to
+// the httpd task with httpd_queue_work().
+esp_err_t camera_server_status_changed(void);
+
+// 拿帧(esp_camera_fb_get)时持有，修改传感器设置时也持有。
+// 传感器在休眠时先唤醒它，所以拿帧、改设置的代码不用管传感器睡没睡
+void camera_sensor_lock(void);
+void camera_sensor_unlock(void);
+
+typedef struct {
+  bool powered;
+  uint32_t wakeups;
+  uint64_t on_us; // 开机以来传感器上电的总时间
+  uint64_t off_us;
+} camera_power_stats_t;
+
+// 拉高PWDN并暂停XCLK，传感器进入待机，寄存器设置保留。
+// Nothing else powers the sensor down: the caller checks that no stream or
+// recorder needs frames. Does nothing when replaying frames from files.
+void camera_sensor_power_down(void);
+void camera_sensor_get_power_stats(camera_power_stats_t *stats);
+
 
 #endif // __CAMERA_SERVER__
 
@@ -0,0 +1,495 @@
+#include "clip_recorder.h"
+#include "async_handler.h"
+#include "avi_writer.h"
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mem_policy.h"
+#include "stream_hub.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TAG "clip_recorder"
+
+// 一个文件最多的帧数，avi_writer按这个大小预先分配索引
+#define CLIP_MAX_FRAMES ((CLIP_MAX_S + CLIP_PREROLL_S) * CLIP_FPS + 1)
+// 正在写入的槽位不算历史帧，所以可用的是CLIP_SLOT_COUNT - 1个
+#define CLIP_HISTORY (CLIP_SLOT_COUNT - 1)
+#define CLIP_PATH_MAX 32
+
+typedef struct {
+  uint8_t *data; // s_slot_size bytes inside s_ring
+  size_t len;
+  uint16_t width;
+  uint16_t height;
+  int64_t capture_us;
+} clip_slot_t;
+
+static const char *s_trigger_names[] = {"button", "motion", "face", "http"};
+
+static uint8_t *s_ring = NULL;
+static size_t s_slot_size = 0; // 由CLIP_MAX_FRAMESIZE算出
+static clip_slot_t s_slots[CLIP_SLOT_COUNT];
+static SemaphoreHandle_t s_lock = NULL;
+static TaskHandle_t s_task = NULL;
+static volatile bool s_enabled = true;
+static bool s_mounted = false;
+static int s_clip_seq = 1;
+// 以下只有采集任务使用
+static int64_t s_last_push_us = 0;
+static bool s_too_big = false; // 上一帧放不进槽位，只在开始时打印一次
+
+// 以下由s_lock保护。帧计数单调递增，槽位 = 计数 % CLIP_SLOT_COUNT
+static uint32_t s_head = 0; // next frame to be stored
+static bool s_recording = false;
+static uint32_t s_clip_next = 0; // next frame to be written to the file
+static int64_t s_clip_start_us = 0;
+static int64_t s_clip_until_us = 0;
+static uint32_t s_dropped = 0;
+
+bool clip_recorder_wants(int64_t capture_us) {
+  return s_enabled && s_ring &&
+         capture_us - s_last_push_us >= 1000000 / CLIP_FPS;
+}
+
+void clip_recorder_push(const uint8_t *jpeg, size_t len, int width,
+                        int height, int64_t capture_us) {
+  if (!clip_recorder_wants(capture_us)) {
+    return;
+  }
+  s_last_push_us = capture_us;
+
+  bool too_big = len > s_slot_size;
+  if (too_big && !s_too_big) {
+    ESP_LOGW(TAG,
+             "%dx%d frame of %uB does not fit a %uB slot, not recording it; "
+             "raise CLIP_MAX_FRAMESIZE",
+             width, height, (unsigned int)len, (unsigned int)s_slot_size);
+  }
+  s_too_big = too_big;
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  // 录像时还没写进文件的帧不能被覆盖
+  bool full = s_recording && s_head - s_clip_next >= CLIP_HISTORY;
+  uint32_t n = s_head;
+  if (full || too_big) {
+    s_dropped++;
+  }
+  xSemaphoreGive(s_lock);
+  if (full || too_big) {
+    return;
+  }
+
+  // 这个槽位不在[s_head - CLIP_HISTORY, s_head)中，写的时候不用持有锁
+  clip_slot_t *slot = &s_slots[n % CLIP_SLOT_COUNT];
+  memcpy(slot->data, jpeg, len);
+  slot->len = len;
+  slot->width = width;
+  slot->height = height;
+  slot->capture_us = capture_us;
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  s_head++;
+  bool recording = s_recording;
+  xSemaphoreGive(s_lock);
+  if (recording) {
+    xTaskNotifyGive(s_task);
+  }
+}
+
+void clip_recorder_trigger(clip_trigger_t trigger) {
+  if (!s_enabled || !s_ring) {
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  bool started = false;
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  if (!s_recording) {
+    // 从环形缓冲区中CLIP_PREROLL_S秒以内最早的一帧开始
+    uint32_t tail = s_head > CLIP_HISTORY ? s_head - CLIP_HISTORY : 0;
+    s_clip_next = s_head;
+    for (uint32_t c = tail; c < s_head; c++) {
+      if (s_slots[c % CLIP_SLOT_COUNT].capture_us >=
+          now - CLIP_PREROLL_S * 1000000LL) {
+        s_clip_next = c;
+        break;
+      }
+    }
+    s_recording = true;
+    s_clip_start_us = now;
+    s_clip_until_us = now + CLIP_POSTROLL_S * 1000000LL;
+    started = true;
+  } else {
+    // 录像中再次触发就延长，但不超过CLIP_MAX_S
+    s_clip_until_us = now + CLIP_POSTROLL_S * 1000000LL;
+    if (s_clip_until_us > s_clip_start_us + CLIP_MAX_S * 1000000LL) {
+      s_clip_until_us = s_clip_start_us + CLIP_MAX_S * 1000000LL;
+    }
+  }
+  uint32_t preroll = s_head - s_clip_next;
+  xSemaphoreGive(s_lock);
+
+  if (started) {
+    ESP_LOGI(TAG, "Clip triggered by %s, %u pre-roll frames",
+             s_trigger_names[trigger], preroll);
+  }
+  if (s_task) {
+    xTaskNotifyGive(s_task);
+  }
+}
+
+// 找到编号最小和最大的录像文件 cNNNNN.avi
+static int scan_clips(int *oldest, int *newest) {
+  int count = 0;
+  *oldest = 0;
+  *newest = 0;
+  DIR *dir = opendir(CLIP_DIR);
+  if (!dir) {
+    return 0;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    int n;
+    if (tolower((unsigned char)entry->d_name[0]) != 'c' ||
+        sscanf(entry->d_name + 1, "%d", &n) != 1) {
+      continue;
+    }
+    if (count == 0 || n < *oldest) {
+      *oldest = n;
+    }
+    if (n > *newest) {
+      *newest = n;
+    }
+    count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+// 删除最旧的录像，直到写完need字节后还剩CLIP_MIN_FREE_KB；正在写的录像keep不删。
+// FatFs caches the free cluster count, so checking before every frame is
+// cheap; the directory is only scanned when space actually runs low.
+static void make_room(size_t need, int keep) {
+  uint64_t total, free_bytes;
+  int oldest, newest;
+  while (esp_vfs_fat_info(CLIP_DIR, &total, &free_bytes) == ESP_OK &&
+         free_bytes < need + CLIP_MIN_FREE_KB * 1024ULL &&
+         scan_clips(&oldest, &newest) > 0 && oldest != keep) {
+    char path[CLIP_PATH_MAX];
+    snprintf(path, sizeof(path), CLIP_DIR "/c%05d.avi", oldest);
+    ESP_LOGI(TAG, "Deleting %s", path);
+    if (unlink(path) != 0) {
+      break;
+    }
+  }
+}
+
+static bool open_clip(avi_writer_t *aw, const clip_slot_t *first) {
+  if (!s_mounted) {
+    return false;
+  }
+  make_room(0, -1);
+  char path[CLIP_PATH_MAX];
+  snprintf(path, sizeof(path), CLIP_DIR "/c%05d.avi", s_clip_seq++);
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    ESP_LOGE(TAG, "Failed to create %s", path);
+    return false;
+  }
+  if (avi_writer_open(aw, f, first->width, first->height, CLIP_MAX_FRAMES) !=
+      0) {
+    ESP_LOGE(TAG, "Failed to write %s", path);
+    fclose(f);
+    return false;
+  }
+  ESP_LOGI(TAG, "Recording %s", path);
+  return true;
+}
+
+// 把录像需要的帧从环形缓冲区写进文件；post-roll结束后关闭文件
+static void write_clip(avi_writer_t *aw, bool *open, bool *failed) {
+  while (true) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool recording = s_recording;
+    uint32_t next = s_clip_next;
+    uint32_t head = s_head;
+    int64_t until = s_clip_until_us;
+    xSemaphoreGive(s_lock);
+    if (!recording) {
+      return;
+    }
+
+    const clip_slot_t *slot = NULL;
+    bool done = false;
+    if (next != head) {
+      // [s_clip_next, s_head)中的槽位不会被覆盖，读的时候不用持有锁
+      slot = &s_slots[next % CLIP_SLOT_COUNT];
+      if (slot->capture_us > until) {
+        slot = NULL;
+        done = true;
+      }
+    } else if (esp_timer_get_time() > until) {
+      done = true;
+    } else {
+      return; // 等新的帧
+    }
+
+    if (slot) {
+      if (!*open && !*failed) {
+        *open = open_clip(aw, slot);
+        *failed = !*open;
+      }
+      if (*open) {
+        // 一个录像最长有几MB，打开时留的空间不够，写每一帧之前都腾出空间
+        make_room(slot->len, s_clip_seq - 1);
+      }
+      if (*open && avi_writer_add_frame(aw, slot->data, slot->len,
+                                        slot->capture_us) != 0) {
+        ESP_LOGE(TAG, "Clip write failed");
+        avi_writer_close(aw);
+        *open = false;
+        *failed = true;
+      }
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      s_clip_next++;
+      xSemaphoreGive(s_lock);
+    }
+
+    if (done) {
+      if (*open) {
+        uint32_t frames = aw->frames;
+        int64_t secs = (aw->last_us - aw->first_us) / 1000000;
+        avi_writer_close(aw);
+        ESP_LOGI(TAG, "Clip done: %u frames, %llds, %u dropped", frames, secs,
+                 s_dropped);
+      }
+      *open = false;
+      *failed = false;
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      s_recording = false;
+      xSemaphoreGive(s_lock);
+      return;
+    }
+  }
+}
+
+static void clip_task(void *arg) {
+  avi_writer_t aw;
+  bool open = false;
+  bool failed = false;
+  int last_level = 0;
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, CLIP_POLL_MS / portTICK_PERIOD_MS);
+    // 与ws_echo_server一样轮询按键，按下为高电平
+    int level = gpio_get_level(CLIP_BUTTON_GPIO);
+    if (level && !last_level) {
+      clip_recorder_trigger(CLIP_TRIGGER_BUTTON);
+    }
+    last_level = level;
+    write_clip(&aw, &open, &failed);
+  }
+}
+
+static bool valid_clip_name(const char *name) {
+  // 只允许 cNNNNN.avi，防止读取其他文件
+  size_t len = strlen(name);
+  if (len < 6 || tolower((unsigned char)name[0]) != 'c' ||
+      strcasecmp(name + len - 4, ".avi") != 0) {
+    return false;
+  }
+  for (size_t i = 1; i < len - 4; i++) {
+    if (!isdigit((unsigned char)name[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static esp_err_t clips_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_sendstr_chunk(req, "{\"clips\":[");
+
+  DIR *dir = s_mounted ? opendir(CLIP_DIR) : NULL;
+  if (dir) {
+    struct dirent *entry;
+    bool first = true;
+    while ((entry = readdir(dir)) != NULL) {
+      if (!valid_clip_name(entry->d_name)) {
+        continue;
+      }
+      char name[CLIP_PATH_MAX];
+      char path[CLIP_PATH_MAX + sizeof(CLIP_DIR)];
+      char json[80];
+      struct stat st;
+      snprintf(name, sizeof(name), "%s", entry->d_name);
+      for (char *p = name; *p; p++) {
+        *p = tolower((unsigned char)*p);
+      }
+      snprintf(path, sizeof(path), CLIP_DIR "/%s", name);
+      if (stat(path, &st) != 0) {
+        continue;
+      }
+      snprintf(json, sizeof(json), "%s{\"name\":\"%s\",\"size\":%ld}",
+               first ? "" : ",", name, (long)st.st_size);
+      httpd_resp_sendstr_chunk(req, json);
+      first = false;
+    }
+    closedir(dir);
+  }
+
+  char json[96];
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  snprintf(json, sizeof(json),
+           "],\"enabled\":%u,\"recording\":%u,\"dropped\":%u}", s_enabled,
+           s_recording, s_dropped);
+  xSemaphoreGive(s_lock);
+  httpd_resp_sendstr_chunk(req, json);
+  return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+static esp_err_t clip_handler(httpd_req_t *req) {
+  // 下载录像要读几百KB的文件
+  if (!async_handler_on_worker()) {
+    return async_handler_submit(req, clip_handler);
+  }
+  char query[64];
+  char name[CLIP_PATH_MAX];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+      httpd_query_key_value(query, "name", name, sizeof(name)) != ESP_OK ||
+      !valid_clip_name(name)) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  char path[CLIP_PATH_MAX + sizeof(CLIP_DIR)];
+  snprintf(path, sizeof(path), CLIP_DIR "/%s", name);
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  char *buf = (char *)malloc(4096);
+  if (!buf) {
+    fclose(f);
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, "video/x-msvideo");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  esp_err_t res = ESP_OK;
+  size_t n;
+  while (res == ESP_OK && (n = fread(buf, 1, 4096, f)) > 0) {
+    res = httpd_resp_send_chunk(req, buf, n);
+  }
+  free(buf);
+  fclose(f);
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  }
+  return res;
+}
+
+esp_err_t clip_recorder_register(httpd_handle_t server) {
+  httpd_uri_t clips_uri = {.uri = "/clips",
+                           .method = HTTP_GET,
+                           .handler = clips_handler,
+                           .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+                           ,
+                           .is_websocket = false,
+                           .handle_ws_control_frames = false,
+                           .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_uri_t clip_uri = {.uri = "/clip",
+                          .method = HTTP_GET,
+                          .handler = clip_handler,
+                          .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+                          ,
+                          .is_websocket = false,
+                          .handle_ws_control_frames = false,
+                          .supported_subprotocol = NULL
+#endif
+  };
+
+  httpd_register_uri_handler(server, &clips_uri);
+  return httpd_register_uri_handler(server, &clip_uri);
+}
+
+void clip_recorder_set_enabled(bool enable) {
+  ESP_LOGI(TAG, "Clip recorder %s", enable ? "on" : "off");
+  s_enabled = enable;
+  stream_hub_wake();
+}
+
+bool clip_recorder_enabled(void) { return s_enabled && s_ring; }
+
+bool clip_recorder_storage_ready(void) { return s_mounted; }
+
+esp_err_t clip_recorder_init(void) {
+  if (s_ring) {
+    return ESP_OK;
+  }
+  // 所有槽位一次分配好，之后每帧只做拷贝
+  s_slot_size = (size_t)resolution[CLIP_MAX_FRAMESIZE].width *
+                resolution[CLIP_MAX_FRAMESIZE].height *
+                CLIP_SLOT_BITS_PER_PIXEL / 8;
+  s_ring = (uint8_t *)mem_alloc(MEM_POOL_FRAME, CLIP_SLOT_COUNT * s_slot_size);
+  s_lock = xSemaphoreCreateMutex();
+  if (!s_ring || !s_lock) {
+    ESP_LOGE(TAG, "No memory for the clip ring");
+    free(s_ring);
+    s_ring = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  for (int i = 0; i < CLIP_SLOT_COUNT; i++) {
+    s_slots[i].data = s_ring + i * s_slot_size;
+  }
+
+  gpio_config_t io_conf = {};
+  io_conf.intr_type = GPIO_INTR_DISABLE;
+  io_conf.mode = GPIO_MODE_INPUT;
+  io_conf.pull_down_en = 1;
+  io_conf.pin_bit_mask = (1ULL << CLIP_BUTTON_GPIO);
+  gpio_config(&io_conf);
+
+  esp_vfs_fat_mount_config_t mount_config = {
+      .format_if_mount_failed = true,
+      .max_files = 4,
+      .allocation_unit_size = CONFIG_WL_SECTOR_SIZE,
+  };
+  wl_handle_t wl;
+  if (esp_vfs_fat_spiflash_mount_rw_wl(CLIP_DIR, CLIP_PARTITION,
+                                       &mount_config, &wl) == ESP_OK) {
+    int oldest, newest;
+    int count = scan_clips(&oldest, &newest);
+    s_clip_seq = newest + 1;
+    s_mounted = true;
+    ESP_LOGI(TAG, "%d clips in %s", count, CLIP_DIR);
+  } else {
+    ESP_LOGE(TAG, "Failed to mount %s, clips will not be saved",
+             CLIP_PARTITION);
+  }
+
+  if (xTaskCreatePinnedToCore(clip_task, "clip_writer", 4096, NULL, 3,
+                              &s_task, 0) != pdPASS) {
+    return ESP_FAIL;
+  }
+  stream_hub_wake();
+  return ESP_OK;
+}
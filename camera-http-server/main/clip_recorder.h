@@ -0,0 +1,59 @@
+#if !defined(__CLIP_RECORDER__)
+#define __CLIP_RECORDER__
+
+#include "esp_camera.h"
+#include "esp_http_server.h"
+#include <stdbool.h>
+
+// 门铃录像：PSRAM中的环形缓冲区一直保存最近几秒的JPEG帧，
+// 按门铃按键、检测到运动或人脸时，把触发前(pre-roll)和触发后(post-roll)的帧写成AVI文件。
+//
+// The ring is one PSRAM block split into CLIP_SLOT_COUNT fixed slots, frames
+// are copied into a slot and nothing is allocated per frame. While a clip is
+// being written the slots it still needs are not overwritten; if the writer
+// falls that far behind new frames are dropped instead. Clips are written to
+// a FAT filesystem on the "storage" flash partition (the board has no SD
+// card slot) and served by /clips and /clip?name=.
+
+#define CLIP_DIR "/storage"
+#define CLIP_PARTITION "storage"
+#define CLIP_FPS 5 // 录像的帧率，比视频流低
+#define CLIP_PREROLL_S 3
+#define CLIP_POSTROLL_S 5
+#define CLIP_MAX_S 30 // 一直触发时，一个文件最长多少秒
+#define CLIP_SLOT_COUNT 40
+// 槽位按这个分辨率的JPEG大小分配，更大的帧不录（串口会提示）。
+// 240x240: 28kB per slot, 1.1MB for the ring; VGA would need 6MB.
+#define CLIP_MAX_FRAMESIZE FRAMESIZE_240X240
+#define CLIP_SLOT_BITS_PER_PIXEL 4 // 240x240的JPEG一般在15KB以内
+// 剩余空间少于这个值加上下一帧时删除最旧的录像，录像过程中每一帧都检查
+#define CLIP_MIN_FREE_KB 512
+#define CLIP_BUTTON_GPIO 45        // 门铃按键，按下为高电平
+#define CLIP_POLL_MS 50
+
+typedef enum {
+  CLIP_TRIGGER_BUTTON,
+  CLIP_TRIGGER_MOTION,
+  CLIP_TRIGGER_FACE,
+  CLIP_TRIGGER_HTTP,
+} clip_trigger_t;
+
+esp_err_t clip_recorder_init(void);
+esp_err_t clip_recorder_register(httpd_handle_t server);
+
+// 打开后即使没有人看视频流，stream_hub也会按CLIP_FPS一直拍照
+void clip_recorder_set_enabled(bool enable);
+bool clip_recorder_enabled(void);
+// CLIP_DIR挂载好了（间隔拍照也写在这里，见timelapse.h）
+bool clip_recorder_storage_ready(void);
+
+// True when a frame captured at capture_us would be kept, so the hub can
+// skip encoding frames the ring does not need.
+bool clip_recorder_wants(int64_t capture_us);
+// Called by the stream hub with encoded frames, keeps one every 1/CLIP_FPS
+// seconds.
+void clip_recorder_push(const uint8_t *jpeg, size_t len, int width,
+                        int height, int64_t capture_us);
+void clip_recorder_trigger(clip_trigger_t trigger);
+
+#endif // __CLIP_RECORDER__
@@ -0,0 +1,241 @@
+#include "face_db.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FACE_DB_SCALE 127
+
+// 四路累加，没有依赖链，主机上的编译器会把它向量化。
+// The Xtensa toolchain does not vectorise; the int8 layout still quarters the
+// memory traffic of the float embeddings, which is what bounds the scan.
+int32_t face_db_dot(const int8_t *a, const int8_t *b) {
+  int32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  for (int i = 0; i < FACE_DB_DIM; i += 4) {
+    s0 += a[i] * b[i];
+    s1 += a[i + 1] * b[i + 1];
+    s2 += a[i + 2] * b[i + 2];
+    s3 += a[i + 3] * b[i + 3];
+  }
+  return s0 + s1 + s2 + s3;
+}
+
+void face_db_quantize(const float *emb, int8_t *out) {
+  float norm = 0;
+  for (int i = 0; i < FACE_DB_DIM; i++) {
+    norm += emb[i] * emb[i];
+  }
+  float scale = norm > 0 ? FACE_DB_SCALE / sqrtf(norm) : 0;
+  for (int i = 0; i < FACE_DB_DIM; i++) {
+    out[i] = (int8_t)lrintf(emb[i] * scale);
+  }
+}
+
+int face_db_init(face_db_t *db, int capacity, face_db_alloc_t alloc) {
+  memset(db, 0, sizeof(*db));
+  db->alloc = alloc ? alloc : malloc;
+  db->emb = (int8_t *)db->alloc((size_t)capacity * FACE_DB_DIM);
+  db->ids = (int16_t *)db->alloc(capacity * sizeof(int16_t));
+  db->names = db->alloc(capacity * sizeof(*db->names));
+  db->centroids = (int8_t *)db->alloc(FACE_DB_IVF_LISTS * FACE_DB_DIM);
+  db->list = (uint8_t *)db->alloc(capacity);
+  db->order = (uint16_t *)db->alloc(capacity * sizeof(uint16_t));
+  if (!db->emb || !db->ids || !db->names || !db->centroids || !db->list ||
+      !db->order) {
+    face_db_free(db);
+    return -1;
+  }
+  db->capacity = capacity;
+  db->next_id = 1;
+  return 0;
+}
+
+void face_db_free(face_db_t *db) {
+  free(db->emb);
+  free(db->ids);
+  free(db->names);
+  free(db->centroids);
+  free(db->list);
+  free(db->order);
+  memset(db, 0, sizeof(*db));
+}
+
+static int nearest_list(const face_db_t *db, const int8_t *emb) {
+  int best = 0;
+  int32_t best_dot = INT32_MIN;
+  for (int k = 0; k < FACE_DB_IVF_LISTS; k++) {
+    int32_t d = face_db_dot(emb, db->centroids + k * FACE_DB_DIM);
+    if (d > best_dot) {
+      best_dot = d;
+      best = k;
+    }
+  }
+  return best;
+}
+
+// 按所属的列表把条目排好（计数排序）
+static void build_order(face_db_t *db) {
+  uint16_t fill[FACE_DB_IVF_LISTS];
+  memset(db->list_start, 0, sizeof(db->list_start));
+  for (int i = 0; i < db->count; i++) {
+    db->list_start[db->list[i] + 1]++;
+  }
+  for (int k = 0; k < FACE_DB_IVF_LISTS; k++) {
+    db->list_start[k + 1] += db->list_start[k];
+    fill[k] = db->list_start[k];
+  }
+  for (int i = 0; i < db->count; i++) {
+    db->order[fill[db->list[i]]++] = i;
+  }
+}
+
+int face_db_insert(face_db_t *db, int id, const int8_t *emb,
+                   const char *name) {
+  if (db->count >= db->capacity) {
+    return -1;
+  }
+  int i = db->count++;
+  memcpy(db->emb + (size_t)i * FACE_DB_DIM, emb, FACE_DB_DIM);
+  db->ids[i] = id;
+  strncpy(db->names[i], name ? name : "", FACE_DB_NAME_LEN - 1);
+  db->names[i][FACE_DB_NAME_LEN - 1] = 0;
+  if (id >= db->next_id) {
+    db->next_id = id + 1;
+  }
+  if (db->indexed) {
+    db->list[i] = nearest_list(db, emb);
+    build_order(db);
+  }
+  return id;
+}
+
+int face_db_enroll(face_db_t *db, const int8_t *emb, const char *name) {
+  return face_db_insert(db, db->next_id, emb, name);
+}
+
+int face_db_delete(face_db_t *db, int id) {
+  for (int i = 0; i < db->count; i++) {
+    if (db->ids[i] != id) {
+      continue;
+    }
+    // 用最后一条覆盖被删除的条目
+    int last = --db->count;
+    if (i != last) {
+      memcpy(db->emb + (size_t)i * FACE_DB_DIM,
+             db->emb + (size_t)last * FACE_DB_DIM, FACE_DB_DIM);
+      db->ids[i] = db->ids[last];
+      memcpy(db->names[i], db->names[last], FACE_DB_NAME_LEN);
+      db->list[i] = db->list[last];
+    }
+    if (db->indexed) {
+      build_order(db);
+    }
+    return 0;
+  }
+  return -1;
+}
+
+static void scan(const face_db_t *db, const int8_t *emb, const uint16_t *idx,
+                 int n, int32_t *best_dot, int *best) {
+  for (int j = 0; j < n; j++) {
+    int i = idx ? idx[j] : j;
+    int32_t d = face_db_dot(emb, db->emb + (size_t)i * FACE_DB_DIM);
+    if (d > *best_dot) {
+      *best_dot = d;
+      *best = i;
+    }
+  }
+}
+
+void face_db_search(const face_db_t *db, const int8_t *emb,
+                    face_db_match_t *match) {
+  int32_t best_dot = INT32_MIN;
+  int best = -1;
+
+  if (!db->indexed) {
+    scan(db, emb, NULL, db->count, &best_dot, &best);
+  } else {
+    // 先和各个中心比较，只扫描最近的FACE_DB_IVF_PROBES个列表
+    int32_t dots[FACE_DB_IVF_LISTS];
+    for (int k = 0; k < FACE_DB_IVF_LISTS; k++) {
+      dots[k] = face_db_dot(emb, db->centroids + k * FACE_DB_DIM);
+    }
+    for (int p = 0; p < FACE_DB_IVF_PROBES; p++) {
+      int k_best = 0;
+      for (int k = 1; k < FACE_DB_IVF_LISTS; k++) {
+        if (dots[k] > dots[k_best]) {
+          k_best = k;
+        }
+      }
+      dots[k_best] = INT32_MIN;
+      int start = db->list_start[k_best];
+      scan(db, emb, db->order + start, db->list_start[k_best + 1] - start,
+           &best_dot, &best);
+    }
+  }
+
+  match->index = best;
+  match->id = -1;
+  match->similarity = 0;
+  if (best >= 0) {
+    match->similarity = (float)best_dot / (FACE_DB_SCALE * FACE_DB_SCALE);
+    if (match->similarity >= FACE_DB_THRESHOLD) {
+      match->id = db->ids[best];
+    }
+  }
+}
+
+int face_db_build_index(face_db_t *db) {
+  if (db->count < FACE_DB_IVF_MIN_COUNT) {
+    db->indexed = false;
+    return -1;
+  }
+  // 均匀取条目作为初始中心，再做几轮k-means（球面：中心归一化）
+  for (int k = 0; k < FACE_DB_IVF_LISTS; k++) {
+    int i = k * db->count / FACE_DB_IVF_LISTS;
+    memcpy(db->centroids + k * FACE_DB_DIM, db->emb + (size_t)i * FACE_DB_DIM,
+           FACE_DB_DIM);
+  }
+  int32_t *sums = (int32_t *)db->alloc(FACE_DB_DIM * sizeof(int32_t));
+  float *mean = (float *)db->alloc(FACE_DB_DIM * sizeof(float));
+  if (!sums || !mean) {
+    free(sums);
+    free(mean);
+    return -1;
+  }
+  for (int it = 0; it < FACE_DB_IVF_ITERATIONS; it++) {
+    for (int i = 0; i < db->count; i++) {
+      db->list[i] = nearest_list(db, db->emb + (size_t)i * FACE_DB_DIM);
+    }
+    for (int k = 0; k < FACE_DB_IVF_LISTS; k++) {
+      memset(sums, 0, FACE_DB_DIM * sizeof(int32_t));
+      int n = 0;
+      for (int i = 0; i < db->count; i++) {
+        if (db->list[i] != k) {
+          continue;
+        }
+        const int8_t *e = db->emb + (size_t)i * FACE_DB_DIM;
+        for (int j = 0; j < FACE_DB_DIM; j++) {
+          sums[j] += e[j];
+        }
+        n++;
+      }
+      if (n == 0) {
+        continue; // 空列表保留原来的中心
+      }
+      for (int j = 0; j < FACE_DB_DIM; j++) {
+        mean[j] = sums[j];
+      }
+      face_db_quantize(mean, db->centroids + k * FACE_DB_DIM);
+    }
+  }
+  free(sums);
+  free(mean);
+
+  for (int i = 0; i < db->count; i++) {
+    db->list[i] = nearest_list(db, db->emb + (size_t)i * FACE_DB_DIM);
+  }
+  build_order(db);
+  db->indexed = true;
+  return 0;
+}
@@ -0,0 +1,98 @@
+#if !defined(__FACE_DB__)
+#define __FACE_DB__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 人脸特征库：楼宇门口需要登记几百个住户，esp-dl自带的识别器只适合几个人。
+//
+// Embeddings are L2-normalised and quantised to int8 (x127), so cosine
+// similarity is an integer dot product divided by 127^2. Entries are stored
+// row-major in one contiguous block for sequential scans. Above
+// FACE_DB_IVF_MIN_COUNT entries an optional IVF index (k-means centroids,
+// entries grouped per list) limits a query to the FACE_DB_IVF_PROBES closest
+// lists.
+//
+// Plain C without ESP-IDF dependencies so host/face_db_bench.c can use it;
+// flash persistence lives in face_db_flash.c.
+
+#define FACE_DB_DIM 512 // FaceRecognition112V1 embedding length
+#define FACE_DB_CAPACITY 500
+#define FACE_DB_NAME_LEN 16
+#define FACE_DB_THRESHOLD 0.55f // 余弦相似度超过这个值才算同一个人
+
+#define FACE_DB_IVF_LISTS 16
+#define FACE_DB_IVF_PROBES 4
+#define FACE_DB_IVF_MIN_COUNT 128 // 人少的时候直接全部比较更快
+#define FACE_DB_IVF_ITERATIONS 8
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct {
+  int id; // -1 when nothing is above the threshold
+  int index;
+  float similarity;
+} face_db_match_t;
+
+// 分配内存的函数，用free()释放。设备上从PSRAM分配（mem_policy.h），电脑上用malloc
+typedef void *(*face_db_alloc_t)(size_t size);
+
+typedef struct {
+  face_db_alloc_t alloc;
+  int capacity;
+  int count;
+  int next_id;
+  int8_t *emb; // capacity * FACE_DB_DIM
+  int16_t *ids;
+  char (*names)[FACE_DB_NAME_LEN];
+
+  // IVF索引，indexed为false时全部比较
+  bool indexed;
+  int8_t *centroids;  // FACE_DB_IVF_LISTS * FACE_DB_DIM
+  uint8_t *list;      // entry -> list
+  uint16_t *order;    // entry indices grouped by list
+  uint16_t list_start[FACE_DB_IVF_LISTS + 1];
+} face_db_t;
+
+// Returns 0 on success, -1 when out of memory. alloc NULL means malloc; the
+// embeddings alone are capacity * FACE_DB_DIM bytes (256kB for 500 people).
+int face_db_init(face_db_t *db, int capacity, face_db_alloc_t alloc);
+void face_db_free(face_db_t *db);
+
+// float特征 -> 归一化后的int8特征
+void face_db_quantize(const float *emb, int8_t *out);
+int32_t face_db_dot(const int8_t *a, const int8_t *b);
+
+// Returns the new id, or -1 when the database is full.
+int face_db_enroll(face_db_t *db, const int8_t *emb, const char *name);
+// Inserts an entry with a known id (used when loading from flash).
+int face_db_insert(face_db_t *db, int id, const int8_t *emb, const char *name);
+int face_db_delete(face_db_t *db, int id);
+
+// Finds the most similar entry. match->id is -1 when the best similarity
+// is below FACE_DB_THRESHOLD (or the database is empty).
+void face_db_search(const face_db_t *db, const int8_t *emb,
+                    face_db_match_t *match);
+
+// Builds (or rebuilds) the IVF index. Does nothing and returns -1 below
+// FACE_DB_IVF_MIN_COUNT entries, queries then scan everything.
+int face_db_build_index(face_db_t *db);
+
+#if defined(ESP_PLATFORM)
+#include "esp_err.h"
+
+// 保存在"facedb"分区中，见 partitions.csv 和 face_db_flash.c
+#define FACE_DB_PARTITION "facedb"
+
+esp_err_t face_db_load(face_db_t *db);
+esp_err_t face_db_save(const face_db_t *db);
+#endif
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // __FACE_DB__
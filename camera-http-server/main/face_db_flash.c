@@ -0,0 +1,178 @@
+#include "esp_crc.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "face_db.h"
+#include <stddef.h>
+#include <string.h>
+
+#define TAG "face_db"
+
+#define FACE_DB_MAGIC 0x32424446 // "FDB2"
+
+// 分区分成A/B两半，每一半是头 + count条记录。保存时写另一半，头最后写，
+// generation更大且CRC正确的一半有效：写到一半断电时还能加载上一次保存的库。
+typedef struct {
+  uint32_t magic;
+  uint16_t dim;
+  uint16_t record_size;
+  uint32_t count;
+  uint32_t next_id;
+  uint32_t generation;
+  uint32_t crc;        // of all records
+  uint32_t header_crc; // of the fields above
+} face_db_header_t;
+
+typedef struct {
+  int16_t id;
+  char name[FACE_DB_NAME_LEN];
+  int8_t emb[FACE_DB_DIM];
+} __attribute__((packed)) face_db_record_t;
+
+static int s_active = -1; // 最近一次加载或保存的那一半
+static uint32_t s_generation = 0;
+
+static const esp_partition_t *find_partition(void) {
+  const esp_partition_t *part = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FACE_DB_PARTITION);
+  if (!part) {
+    ESP_LOGW(TAG, "No \"%s\" partition", FACE_DB_PARTITION);
+  }
+  return part;
+}
+
+static size_t slot_size(const esp_partition_t *part) {
+  return part->size / 2 / part->erase_size * part->erase_size;
+}
+
+static uint32_t header_crc(const face_db_header_t *header) {
+  return esp_crc32_le(0, (const uint8_t *)header,
+                      offsetof(face_db_header_t, header_crc));
+}
+
+// 读出一半的头并检查记录的CRC；这一半不能用时返回false
+static bool read_slot(const esp_partition_t *part, int slot,
+                      face_db_header_t *header) {
+  size_t base = slot * slot_size(part);
+  if (esp_partition_read(part, base, header, sizeof(*header)) != ESP_OK ||
+      header->magic != FACE_DB_MAGIC || header->dim != FACE_DB_DIM ||
+      header->record_size != sizeof(face_db_record_t) ||
+      header->header_crc != header_crc(header) ||
+      sizeof(*header) + (size_t)header->count * sizeof(face_db_record_t) >
+          slot_size(part)) {
+    return false;
+  }
+  face_db_record_t record;
+  uint32_t crc = 0;
+  size_t offset = base + sizeof(*header);
+  for (uint32_t i = 0; i < header->count; i++) {
+    if (esp_partition_read(part, offset, &record, sizeof(record)) != ESP_OK) {
+      return false;
+    }
+    offset += sizeof(record);
+    crc = esp_crc32_le(crc, (const uint8_t *)&record, sizeof(record));
+  }
+  if (crc != header->crc) {
+    ESP_LOGW(TAG, "Face database slot %c corrupted", 'A' + slot);
+    return false;
+  }
+  return true;
+}
+
+esp_err_t face_db_load(face_db_t *db) {
+  const esp_partition_t *part = find_partition();
+  if (!part) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  face_db_header_t headers[2];
+  bool valid[2];
+  for (int i = 0; i < 2; i++) {
+    valid[i] = read_slot(part, i, &headers[i]);
+  }
+  int slot;
+  if (valid[0] && valid[1]) {
+    slot = (int32_t)(headers[1].generation - headers[0].generation) > 0;
+  } else if (valid[0] || valid[1]) {
+    slot = valid[1];
+  } else {
+    ESP_LOGI(TAG, "Face database is empty");
+    return ESP_ERR_NOT_FOUND;
+  }
+  const face_db_header_t *header = &headers[slot];
+
+  face_db_record_t record;
+  size_t offset = slot * slot_size(part) + sizeof(*header);
+  db->count = 0;
+  db->indexed = false;
+  for (uint32_t i = 0; i < header->count && i < db->capacity; i++) {
+    esp_err_t err = esp_partition_read(part, offset, &record, sizeof(record));
+    if (err != ESP_OK) {
+      db->count = 0;
+      return err;
+    }
+    offset += sizeof(record);
+    record.name[FACE_DB_NAME_LEN - 1] = 0;
+    face_db_insert(db, record.id, record.emb, record.name);
+  }
+  if ((int)header->next_id > db->next_id) {
+    db->next_id = header->next_id;
+  }
+  s_active = slot;
+  s_generation = header->generation;
+  ESP_LOGI(TAG, "Loaded %d faces from slot %c (generation %u)", db->count,
+           'A' + slot, (unsigned int)s_generation);
+  return ESP_OK;
+}
+
+esp_err_t face_db_save(const face_db_t *db) {
+  const esp_partition_t *part = find_partition();
+  if (!part) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  size_t size = sizeof(face_db_header_t) +
+                (size_t)db->count * sizeof(face_db_record_t);
+  if (size > slot_size(part)) {
+    return ESP_ERR_NO_MEM;
+  }
+  // 只擦写不在用的那一半，有效的那一半直到新的头写完都不动
+  int slot = s_active == 0;
+  size_t base = slot * slot_size(part);
+  size_t erase = (size + part->erase_size - 1) / part->erase_size *
+                 part->erase_size;
+  esp_err_t err = esp_partition_erase_range(part, base, erase);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  face_db_record_t record;
+  uint32_t crc = 0;
+  size_t offset = base + sizeof(face_db_header_t);
+  for (int i = 0; i < db->count; i++) {
+    record.id = db->ids[i];
+    memcpy(record.name, db->names[i], FACE_DB_NAME_LEN);
+    memcpy(record.emb, db->emb + (size_t)i * FACE_DB_DIM, FACE_DB_DIM);
+    crc = esp_crc32_le(crc, (const uint8_t *)&record, sizeof(record));
+    err = esp_partition_write(part, offset, &record, sizeof(record));
+    if (err != ESP_OK) {
+      return err;
+    }
+    offset += sizeof(record);
+  }
+
+  face_db_header_t header = {
+      .magic = FACE_DB_MAGIC,
+      .dim = FACE_DB_DIM,
+      .record_size = sizeof(face_db_record_t),
+      .count = db->count,
+      .next_id = db->next_id,
+      .generation = s_generation + 1,
+      .crc = crc,
+  };
+  header.header_crc = header_crc(&header);
+  err = esp_partition_write(part, base, &header, sizeof(header));
+  if (err != ESP_OK) {
+    return err;
+  }
+  s_active = slot;
+  s_generation = header.generation;
+  return ESP_OK;
+}
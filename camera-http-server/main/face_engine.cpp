@@ -0,0 +1,507 @@
+#include "face_engine.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mem_policy.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "face_engine"
+
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+
+#include "human_face_detect_mnp01.hpp"
+#include "human_face_detect_msr01.hpp"
+#include <vector>
+
+#define TWO_STAGE                                                              \
+  1 /*<! 1: detect by two-stage which is more accurate but slower(with         \
+       keypoints). */
+    /*<! 0: detect by one-stage which is less accurate but faster(without
+     * keypoints). */
+
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+#pragma GCC diagnostic ignored "-Wformat"
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+#include "face_recognition_112_v1_s16.hpp"
+#include "face_recognition_112_v1_s8.hpp"
+#include "face_recognition_tool.hpp"
+#pragma GCC diagnostic error "-Wformat"
+#pragma GCC diagnostic warning "-Wstrict-aliasing"
+
+#define QUANT_TYPE                                                             \
+  0 // if set to 1 => very large firmware, very slow, reboots when streaming...
+
+#define FACE_ID_SAVE_NUMBER 7
+
+#if FACE_DB_ENABLED
+#include "face_db.h"
+#endif
+#endif
+
+#define FACE_COLOR_WHITE 0x00FFFFFF
+#define FACE_COLOR_BLACK 0x00000000
+#define FACE_COLOR_RED 0x000000FF
+#define FACE_COLOR_GREEN 0x0000FF00
+#define FACE_COLOR_BLUE 0x00FF0000
+#define FACE_COLOR_YELLOW (FACE_COLOR_RED | FACE_COLOR_GREEN)
+#define FACE_COLOR_CYAN (FACE_COLOR_BLUE | FACE_COLOR_GREEN)
+#define FACE_COLOR_PURPLE (FACE_COLOR_BLUE | FACE_COLOR_RED)
+
+typedef struct {
+  const uint8_t *buf;
+  int width;
+  int height;
+  pixformat_t format;
+  bool recognize;
+  bool enroll;
+  bool async; // buf属于推理任务，结果写到s_latest
+  face_result_t *result;
+} face_request_t;
+
+static QueueHandle_t s_queue = NULL;
+// 同步调用：同一时间只有一个调用者在等结果
+static SemaphoreHandle_t s_caller_lock = NULL;
+static SemaphoreHandle_t s_done = NULL;
+// 异步检测：同一时间最多一帧在排队或处理
+static volatile bool s_async_busy = false;
+static SemaphoreHandle_t s_latest_lock = NULL;
+static face_result_t s_latest;
+static int64_t s_latest_us = 0; // 0: no result yet
+
+static void copy_results(std::list<dl::detect::result_t> &results,
+                         face_result_t *out) {
+  out->count = 0;
+  for (auto &r : results) {
+    if (out->count == FACE_ENGINE_MAX_FACES) {
+      break;
+    }
+    face_box_t *f = &out->faces[out->count++];
+    for (int i = 0; i < 4; i++) {
+      f->box[i] = r.box[i];
+    }
+    memset(f->keypoint, 0, sizeof(f->keypoint));
+    for (size_t i = 0; i < r.keypoint.size() && i < 10; i++) {
+      f->keypoint[i] = r.keypoint[i];
+    }
+    f->score = r.score;
+  }
+}
+
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+#if FACE_DB_ENABLED
+static face_db_t s_db;
+
+// 特征库几百kB，放在PSRAM里，不和lwIP抢内部RAM
+static void *frame_pool_alloc(size_t size) {
+  return mem_alloc(MEM_POOL_FRAME, size);
+}
+#endif
+#if FACE_RECOGNITION_CROP
+static uint8_t *s_crop = NULL; // FACE_CROP_MAX_SIDE^2 * 3, PSRAM
+#endif
+
+// RGB565(高字节在前)转成与fmt2rgb888()相同的BGR888，只转换(x0, y0, w, h)这块区域
+static void rgb565_to_rgb888(const uint8_t *src, int width, int x0, int y0,
+                             int w, int h, uint8_t *dst) {
+  for (int y = y0; y < y0 + h; y++) {
+    const uint8_t *p = src + ((size_t)y * width + x0) * 2;
+    for (int x = 0; x < w; x++, p += 2) {
+      uint8_t hb = p[0], lb = p[1];
+      *dst++ = (lb & 0x1F) << 3;
+      *dst++ = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+      *dst++ = hb & 0xF8;
+    }
+  }
+}
+
+// 以人脸框为中心的正方形区域，放不进预分配的缓冲区时返回false
+static bool crop_region(const face_request_t *req, const face_box_t *face,
+                        int *x0, int *y0, int *side) {
+  int bw = face->box[2] - face->box[0] + 1;
+  int bh = face->box[3] - face->box[1] + 1;
+  int s = (bw > bh ? bw : bh) * FACE_CROP_SCALE_PCT / 100;
+  if (s > req->width) {
+    s = req->width;
+  }
+  if (s > req->height) {
+    s = req->height;
+  }
+  if (s > FACE_CROP_MAX_SIDE) {
+    return false;
+  }
+  int x = (face->box[0] + face->box[2]) / 2 - s / 2;
+  int y = (face->box[1] + face->box[3]) / 2 - s / 2;
+  *x0 = x < 0 ? 0 : (x > req->width - s ? req->width - s : x);
+  *y0 = y < 0 ? 0 : (y > req->height - s ? req->height - s : y);
+  *side = s;
+  return true;
+}
+
+template <typename T>
+static void run_face_recognition(T &recognizer, const face_request_t *req) {
+  face_result_t *out = req->result;
+  const face_box_t *face = &out->faces[0];
+  std::vector<int> landmarks(face->keypoint, face->keypoint + 10);
+  uint8_t *rgb = (uint8_t *)req->buf;
+  uint8_t *full = NULL;
+  int width = req->width;
+  int height = req->height;
+
+  if (req->format == PIXFORMAT_RGB565) {
+    int64_t t0 = esp_timer_get_time();
+    int x0, y0, side;
+#if FACE_RECOGNITION_CROP
+    if (s_crop && crop_region(req, face, &x0, &y0, &side)) {
+      // 对齐只用到关键点附近的像素，关键点换算到裁剪区域的坐标
+      rgb565_to_rgb888(req->buf, req->width, x0, y0, side, side, s_crop);
+      for (int i = 0; i < 10; i += 2) {
+        landmarks[i] -= x0;
+        landmarks[i + 1] -= y0;
+      }
+      rgb = s_crop;
+      width = height = side;
+    } else
+#endif
+    {
+      full =
+          (uint8_t *)mem_alloc(MEM_POOL_FRAME, (size_t)width * height * 3);
+      if (!full) {
+        ESP_LOGE(TAG, "rgb888 malloc failed");
+        return;
+      }
+      rgb565_to_rgb888(req->buf, width, 0, 0, width, height, full);
+      rgb = full;
+    }
+    out->convert_bytes = width * height * 3;
+    out->convert_us = esp_timer_get_time() - t0;
+  }
+
+  Tensor<uint8_t> tensor;
+  tensor.set_element(rgb).set_shape({height, width, 3}).set_auto_free(false);
+
+#if FACE_DB_ENABLED
+  // 模型只负责提取特征，比较和登记由face_db完成
+  Tensor<float> &emb = recognizer.get_face_emb(tensor, landmarks);
+  int8_t q[FACE_DB_DIM];
+  face_db_quantize(emb.get_element_ptr(), q);
+  free(full);
+
+  face_db_match_t match;
+  face_db_search(&s_db, q, &match);
+  // 已经认识的人不重复登记
+  if (req->enroll && match.id < 0) {
+    out->enrolled_id = face_db_enroll(&s_db, q, "");
+    ESP_LOGI(TAG, "Enrolled ID: %d (%d faces)", out->enrolled_id,
+             s_db.count);
+    if (out->enrolled_id > 0) {
+      if (s_db.count % FACE_DB_IVF_MIN_COUNT == 0) {
+        face_db_build_index(&s_db);
+      }
+      face_db_save(&s_db);
+      match.id = out->enrolled_id;
+      match.similarity = 1.0f;
+    }
+  }
+  out->face_id = match.id;
+  out->similarity = match.similarity;
+#else
+  int enrolled_count = recognizer.get_enrolled_id_num();
+
+  if (enrolled_count < FACE_ID_SAVE_NUMBER && req->enroll) {
+    out->enrolled_id = recognizer.enroll_id(tensor, landmarks, "", true);
+    ESP_LOGI(TAG, "Enrolled ID: %d", out->enrolled_id);
+  }
+
+  face_info_t recognize = recognizer.recognize(tensor, landmarks);
+  out->face_id = recognize.id >= 0 ? recognize.id : -1;
+  out->similarity = recognize.similarity;
+  free(full);
+#endif
+}
+#endif
+
+// 推理任务：模型在这里构造一次，任务存在期间一直复用
+static void face_engine_task(void *arg) {
+#if TWO_STAGE
+  HumanFaceDetectMSR01 s1(0.1F, 0.5F, 10, 0.2F);
+  HumanFaceDetectMNP01 s2(0.5F, 0.3F, 5);
+#else
+  HumanFaceDetectMSR01 s1(0.3F, 0.5F, 10, 0.2F);
+#endif
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+#if QUANT_TYPE
+  // S16 model
+  FaceRecognition112V1S16 recognizer;
+#else
+  // S8 model
+  FaceRecognition112V1S8 recognizer;
+#endif
+  recognizer.set_partition(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                           "fr");
+
+  // load ids from flash partition
+  recognizer.set_ids_from_flash();
+#if FACE_DB_ENABLED
+  if (face_db_init(&s_db, FACE_DB_CAPACITY, frame_pool_alloc) == 0) {
+    face_db_load(&s_db);
+    face_db_build_index(&s_db);
+  } else {
+    ESP_LOGE(TAG, "Face database init failed");
+  }
+#endif
+#endif
+  ESP_LOGI(TAG, "Face engine ready");
+
+  face_request_t req;
+  face_result_t async_result;
+  while (true) {
+    if (xQueueReceive(s_queue, &req, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    int64_t submit_us = esp_timer_get_time();
+    if (req.async) {
+      req.result = &async_result;
+    }
+    face_result_t *out = req.result;
+    memset(out, 0, sizeof(*out));
+    out->width = req.width;
+    out->height = req.height;
+    std::vector<int> shape = {req.height, req.width, 3};
+
+    int64_t t0 = esp_timer_get_time();
+    std::list<dl::detect::result_t> *results;
+    if (req.format == PIXFORMAT_RGB565) {
+      uint16_t *buf = (uint16_t *)req.buf;
+      std::list<dl::detect::result_t> &candidates = s1.infer(buf, shape);
+      out->candidates_us = esp_timer_get_time() - t0;
+#if TWO_STAGE
+      results = &s2.infer(buf, shape, candidates);
+#else
+      results = &candidates;
+#endif
+    } else {
+      uint8_t *buf = (uint8_t *)req.buf;
+      std::list<dl::detect::result_t> &candidates = s1.infer(buf, shape);
+      out->candidates_us = esp_timer_get_time() - t0;
+#if TWO_STAGE
+      results = &s2.infer(buf, shape, candidates);
+#else
+      results = &candidates;
+#endif
+    }
+    int64_t t1 = esp_timer_get_time();
+#if TWO_STAGE
+    out->refine_us = t1 - t0 - out->candidates_us;
+#endif
+    copy_results(*results, out);
+
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+    if (req.recognize && out->count > 0) {
+      run_face_recognition(recognizer, &req);
+      out->recognize_us = esp_timer_get_time() - t1;
+    }
+#endif
+    if (!req.async) {
+      xSemaphoreGive(s_done);
+      continue;
+    }
+    free((void *)req.buf);
+    ESP_LOGD(TAG, "FACE(stream): %d faces, cand %ums, refine %ums",
+             out->count, (unsigned int)(out->candidates_us / 1000),
+             (unsigned int)(out->refine_us / 1000));
+    xSemaphoreTake(s_latest_lock, portMAX_DELAY);
+    s_latest = *out;
+    s_latest_us = submit_us;
+    xSemaphoreGive(s_latest_lock);
+    s_async_busy = false;
+  }
+}
+
+extern "C" esp_err_t face_engine_init(void) {
+  if (s_queue) {
+    return ESP_OK;
+  }
+  s_queue = xQueueCreate(FACE_ENGINE_QUEUE_LEN, sizeof(face_request_t));
+  s_caller_lock = xSemaphoreCreateMutex();
+  s_done = xSemaphoreCreateBinary();
+  s_latest_lock = xSemaphoreCreateMutex();
+  if (!s_queue || !s_caller_lock || !s_done || !s_latest_lock) {
+    return ESP_ERR_NO_MEM;
+  }
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED && FACE_RECOGNITION_CROP
+  s_crop = (uint8_t *)mem_alloc(MEM_POOL_FRAME,
+                                FACE_CROP_MAX_SIDE * FACE_CROP_MAX_SIDE * 3);
+  ESP_LOGI(TAG, "Recognition scratch: %uB", s_crop ? FACE_CROP_MAX_SIDE *
+                                                         FACE_CROP_MAX_SIDE * 3
+                                                   : 0);
+#endif
+  if (xTaskCreatePinnedToCore(face_engine_task, "face_engine",
+                              FACE_ENGINE_TASK_STACK, NULL, 4, NULL,
+                              FACE_ENGINE_TASK_CORE) != pdPASS) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+extern "C" esp_err_t face_engine_detect(const uint8_t *buf, int width,
+                                        int height, pixformat_t format,
+                                        bool recognize, bool enroll,
+                                        face_result_t *result) {
+  if (!s_queue) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (format != PIXFORMAT_RGB565 && format != PIXFORMAT_RGB888) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  face_request_t req = {buf,       width,  height, format,
+                        recognize, enroll, false,  result};
+  xSemaphoreTake(s_caller_lock, portMAX_DELAY);
+  // 推理任务处理完之前不能返回：buf和result都属于调用者
+  xQueueSend(s_queue, &req, portMAX_DELAY);
+  xSemaphoreTake(s_done, portMAX_DELAY);
+  xSemaphoreGive(s_caller_lock);
+  return ESP_OK;
+}
+
+extern "C" esp_err_t face_engine_submit(uint8_t *buf, int width, int height,
+                                        pixformat_t format) {
+  if (!s_queue) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (format != PIXFORMAT_RGB565 && format != PIXFORMAT_RGB888) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  if (s_async_busy) {
+    return ESP_ERR_TIMEOUT;
+  }
+  face_request_t req = {buf, width, height, format, false, false, true, NULL};
+  s_async_busy = true;
+  if (xQueueSend(s_queue, &req, 0) != pdTRUE) {
+    s_async_busy = false;
+    return ESP_ERR_TIMEOUT;
+  }
+  return ESP_OK;
+}
+
+extern "C" bool face_engine_latest(face_result_t *result, int64_t *submit_us) {
+  if (!s_latest_lock) {
+    return false;
+  }
+  xSemaphoreTake(s_latest_lock, portMAX_DELAY);
+  bool ok = s_latest_us != 0;
+  if (ok) {
+    *result = s_latest;
+    *submit_us = s_latest_us;
+  }
+  xSemaphoreGive(s_latest_lock);
+  return ok;
+}
+
+// FACE_COLOR_*是24位颜色，画在RGB565的画面上要先转换
+static unsigned int fb_color(const fb_data_t *fb, unsigned int color) {
+  if (fb->bytes_per_pixel == 2) {
+    // color = ((color >> 8) & 0xF800) | ((color >> 3) & 0x07E0) | (color &
+    // 0x001F);
+    color = ((color >> 16) & 0x001F) | ((color >> 3) & 0x07E0) |
+            ((color << 8) & 0xF800);
+  }
+  return color;
+}
+
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+static void rgb_print(fb_data_t *fb, unsigned int color, const char *str) {
+  fb_gfx_print(fb, (fb->width - (strlen(str) * 14)) / 2, 10,
+               fb_color(fb, color), str);
+}
+
+static int rgb_printf(fb_data_t *fb, unsigned int color, const char *format,
+                      ...) {
+  char loc_buf[64];
+  va_list arg;
+  va_start(arg, format);
+  int len = vsnprintf(loc_buf, sizeof(loc_buf), format, arg);
+  va_end(arg);
+  rgb_print(fb, color, loc_buf);
+  return len;
+}
+#endif
+
+extern "C" void face_engine_draw(fb_data_t *fb, const face_result_t *result) {
+  int x, y, w, h;
+  unsigned int color = FACE_COLOR_YELLOW;
+  if (result->face_id < 0) {
+    color = FACE_COLOR_RED;
+  } else if (result->face_id > 0) {
+    color = FACE_COLOR_GREEN;
+  }
+  color = fb_color(fb, color);
+  for (int i = 0; i < result->count; i++) {
+    const face_box_t *prediction = &result->faces[i];
+    // rectangle box
+    x = prediction->box[0];
+    y = prediction->box[1];
+    w = prediction->box[2] - x + 1;
+    h = prediction->box[3] - y + 1;
+    if ((x + w) > fb->width) {
+      w = fb->width - x;
+    }
+    if ((y + h) > fb->height) {
+      h = fb->height - y;
+    }
+    fb_gfx_drawFastHLine(fb, x, y, w, color);
+    fb_gfx_drawFastHLine(fb, x, y + h - 1, w, color);
+    fb_gfx_drawFastVLine(fb, x, y, h, color);
+    fb_gfx_drawFastVLine(fb, x + w - 1, y, h, color);
+#if TWO_STAGE
+    // landmarks (left eye, mouth left, nose, right eye, mouth right)
+    int x0, y0, j;
+    for (j = 0; j < 10; j += 2) {
+      x0 = prediction->keypoint[j];
+      y0 = prediction->keypoint[j + 1];
+      fb_gfx_fillRect(fb, x0, y0, 3, 3, color);
+    }
+#endif
+  }
+
+#if CONFIG_ESP_FACE_RECOGNITION_ENABLED
+  if (result->count == 0 || result->face_id == 0) {
+    return;
+  }
+  if (result->enrolled_id > 0) {
+    rgb_printf(fb, FACE_COLOR_CYAN, "ID[%u]", result->enrolled_id);
+  }
+  if (result->face_id > 0) {
+    rgb_printf(fb, FACE_COLOR_GREEN, "ID[%u]: %.2f", result->face_id,
+               result->similarity);
+  } else {
+    rgb_print(fb, FACE_COLOR_RED, "Intruder Alert!");
+  }
+#endif
+}
+
+#else
+
+extern "C" esp_err_t face_engine_init(void) { return ESP_ERR_NOT_SUPPORTED; }
+
+extern "C" esp_err_t face_engine_detect(const uint8_t *buf, int width,
+                                        int height, pixformat_t format,
+                                        bool recognize, bool enroll,
+                                        face_result_t *result) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+extern "C" esp_err_t face_engine_submit(uint8_t *buf, int width, int height,
+                                        pixformat_t format) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+extern "C" bool face_engine_latest(face_result_t *result, int64_t *submit_us) {
+  return false;
+}
+
+#endif
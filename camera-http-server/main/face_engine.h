@@ -0,0 +1,110 @@
+#if !defined(__FACE_ENGINE__)
+#define __FACE_ENGINE__
+
+#include "esp_camera.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// Face Detection will not work on boards without (or with disabled) PSRAM
+#ifdef BOARD_HAS_PSRAM
+// Face Recognition takes upward from 15 seconds per frame on chips other than
+// ESP32S3 Makes no sense to have it enabled for them
+#if CONFIG_IDF_TARGET_ESP32S3
+#define CONFIG_ESP_FACE_RECOGNITION_ENABLED 1
+#define CONFIG_ESP_FACE_DETECT_ENABLED 1
+#else
+#define CONFIG_ESP_FACE_RECOGNITION_ENABLED 0
+#define CONFIG_ESP_FACE_DETECT_ENABLED 0
+#endif
+#else
+#define CONFIG_ESP_FACE_DETECT_ENABLED 0
+#define CONFIG_ESP_FACE_RECOGNITION_ENABLED 0
+#endif
+
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+#include "fb_gfx.h" // 和esp-dl一起提供，关闭人脸检测时不需要
+#endif
+
+// 人脸检测/识别引擎
+//
+// MSR01/MNP01检测器和识别模型只在推理任务里构造一次，之后一直复用，
+// 不再每次拍照都重新初始化模型。其他任务通过队列提交请求。
+// The models come from esp-dl (C++), this header is the C interface for
+// camera_server.c. When CONFIG_ESP_FACE_DETECT_ENABLED is 0 the functions
+// return ESP_ERR_NOT_SUPPORTED; enabling it also needs espressif/esp-dl in
+// main/idf_component.yml.
+
+#define FACE_ENGINE_MAX_FACES 4
+#define FACE_ENGINE_TASK_STACK (8 * 1024)
+// 与stream_hub的采集任务(core 1)错开，检测慢也不会拖慢视频流
+#define FACE_ENGINE_TASK_CORE 0
+#define FACE_ENGINE_QUEUE_LEN 2
+
+// 识别RGB565的帧时只把人脸附近的区域转成RGB888（预先分配的缓冲区），
+// 不再为整帧分配 width*height*3 字节。0: 旧的做法，/capture 先把整帧转成RGB888。
+#define FACE_RECOGNITION_CROP 1
+#define FACE_CROP_SCALE_PCT 200 // 裁剪区域的边长是人脸框的几倍(%)
+#define FACE_CROP_MAX_SIDE 160  // 预分配 160*160*3 字节
+
+// 1: 特征保存在face_db中（几百人，见 face_db.h），0: esp-dl识别器自带的库（7人）
+#define FACE_DB_ENABLED 1
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct {
+  int16_t box[4];       // x0, y0, x1, y1
+  int16_t keypoint[10]; // left eye, mouth left, nose, right eye, mouth right
+  float score;
+} face_box_t;
+
+typedef struct {
+  int width; // frame the boxes belong to
+  int height;
+  int count;
+  face_box_t faces[FACE_ENGINE_MAX_FACES];
+  // 识别结果：0 没有做识别，>0 已登记的id，<0 陌生人
+  int face_id;
+  int enrolled_id; // >0 when this frame enrolled a new face
+  float similarity;
+  // 每个阶段的耗时
+  uint32_t candidates_us; // MSR01
+  uint32_t refine_us;     // MNP01, 0 for one stage detection
+  uint32_t recognize_us;
+  // 为识别转换成RGB888的字节数和耗时（整帧或人脸区域）
+  uint32_t convert_bytes;
+  uint32_t convert_us;
+} face_result_t;
+
+esp_err_t face_engine_init(void);
+
+// 在推理任务中检测（并可选识别）一帧，调用者阻塞到结果返回。
+// buf is RGB565 (esp32-camera byte order) or RGB888 as produced by
+// fmt2rgb888(). For RGB565 the recognizer gets an RGB888 copy of the face
+// region only, see FACE_RECOGNITION_CROP. buf must stay valid until the call
+// returns.
+esp_err_t face_engine_detect(const uint8_t *buf, int width, int height,
+                             pixformat_t format, bool recognize, bool enroll,
+                             face_result_t *result);
+
+// 异步检测：不等结果，buf（heap分配）的所有权交给推理任务，用完后由它free。
+// Returns ESP_ERR_TIMEOUT while an earlier asynchronous frame is still being
+// processed; buf then still belongs to the caller. Only detection runs on
+// this path, recognition stays with face_engine_detect().
+esp_err_t face_engine_submit(uint8_t *buf, int width, int height,
+                             pixformat_t format);
+
+// 最近一次异步检测的结果和提交时间(esp_timer)，还没有结果时返回false
+bool face_engine_latest(face_result_t *result, int64_t *submit_us);
+
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+// 在画面上画出人脸框、关键点和识别结果
+void face_engine_draw(fb_data_t *fb, const face_result_t *result);
+#endif
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // __FACE_ENGINE__
@@ -0,0 +1,209 @@
+#include "frame_replay.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static char s_dir[REPLAY_PATH_MAX];
+static char **s_files = NULL; // sorted names
+static int s_count = 0;
+static int s_next = 0;
+static int64_t s_period_us = 0;
+static int64_t s_due_us = 0;
+static int s_width = 0;
+static int s_height = 0;
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(int64_t due_us) {
+  int64_t wait = due_us - now_us();
+  if (wait > 0) {
+    struct timespec ts = {.tv_sec = wait / 1000000,
+                          .tv_nsec = (wait % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+  }
+}
+
+static bool has_suffix(const char *name, const char *suffix) {
+  size_t n = strlen(name);
+  size_t m = strlen(suffix);
+  return n > m && strcasecmp(name + n - m, suffix) == 0;
+}
+
+static pixformat_t file_format(const char *name) {
+  if (has_suffix(name, ".jpg") || has_suffix(name, ".jpeg")) {
+    return PIXFORMAT_JPEG;
+  }
+  return PIXFORMAT_RGB565; // only .rgb gets listed
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// 调用者需要持有s_lock
+static void scan(void) {
+  DIR *dir = opendir(s_dir);
+  if (!dir) {
+    return;
+  }
+  int capacity = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    const char *name = entry->d_name;
+    if (!has_suffix(name, ".jpg") && !has_suffix(name, ".jpeg") &&
+        !has_suffix(name, ".rgb")) {
+      continue;
+    }
+    if (s_count == capacity) {
+      capacity = capacity ? capacity * 2 : 32;
+      char **files = (char **)realloc(s_files, capacity * sizeof(char *));
+      if (!files) {
+        break;
+      }
+      s_files = files;
+    }
+    s_files[s_count] = strdup(name);
+    if (s_files[s_count]) {
+      s_count++;
+    }
+  }
+  closedir(dir);
+  qsort(s_files, s_count, sizeof(char *), compare_names);
+}
+
+// 从SOF段读出图片的大小
+static int jpeg_size(const uint8_t *buf, size_t len, int *width,
+                     int *height) {
+  size_t i = 2;
+  if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8) {
+    return -1;
+  }
+  while (i + 9 < len && buf[i] == 0xFF) {
+    uint8_t marker = buf[i + 1];
+    if (marker >= 0xC0 && marker <= 0xC3) {
+      *height = (buf[i + 5] << 8) | buf[i + 6];
+      *width = (buf[i + 7] << 8) | buf[i + 8];
+      return 0;
+    }
+    i += 2 + ((buf[i + 2] << 8) | buf[i + 3]);
+  }
+  return -1;
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *buf = size > 0 ? (uint8_t *)malloc(size) : NULL;
+  if (buf && fread(buf, 1, size, f) != (size_t)size) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  *len = size;
+  return buf;
+}
+
+int frame_replay_open(const char *dir, int fps, int width, int height) {
+  if (strlen(dir) >= sizeof(s_dir) - 1 || fps < 0) {
+    return -1;
+  }
+  pthread_mutex_lock(&s_lock);
+  for (int i = 0; i < s_count; i++) {
+    free(s_files[i]);
+  }
+  s_count = 0;
+  s_next = 0;
+  strcpy(s_dir, dir);
+  s_period_us = fps > 0 ? 1000000 / fps : 0;
+  s_due_us = 0;
+  s_width = width;
+  s_height = height;
+  pthread_mutex_unlock(&s_lock);
+  return 0;
+}
+
+camera_fb_t *frame_replay_fb_get(void) {
+  char path[REPLAY_PATH_MAX + 256];
+  pthread_mutex_lock(&s_lock);
+  if (s_count == 0) {
+    scan();
+  }
+  if (s_count == 0) {
+    pthread_mutex_unlock(&s_lock);
+    return NULL;
+  }
+  snprintf(path, sizeof(path), "%s/%s", s_dir, s_files[s_next]);
+  pixformat_t format = file_format(s_files[s_next]);
+  s_next = (s_next + 1) % s_count;
+  // 像传感器一样按帧率出帧：来早了就等到下一帧的时间
+  int64_t now = now_us();
+  int64_t due = s_due_us > now ? s_due_us : now;
+  s_due_us = due + s_period_us;
+  int width = s_width;
+  int height = s_height;
+  pthread_mutex_unlock(&s_lock);
+
+  camera_fb_t *fb = (camera_fb_t *)calloc(1, sizeof(camera_fb_t));
+  if (!fb) {
+    return NULL;
+  }
+  fb->buf = read_file(path, &fb->len);
+  if (fb->buf && format == PIXFORMAT_JPEG) {
+    if (jpeg_size(fb->buf, fb->len, &width, &height) != 0) {
+      free(fb->buf);
+      fb->buf = NULL;
+    }
+  } else if (fb->buf && fb->len != (size_t)width * height * 2) {
+    free(fb->buf); // 原始数据的大小和设置的分辨率不一致
+    fb->buf = NULL;
+  }
+  if (!fb->buf) {
+    free(fb);
+    return NULL;
+  }
+  fb->width = width;
+  fb->height = height;
+  fb->format = format;
+
+  sleep_until(due);
+  fb->timestamp.tv_sec = due / 1000000;
+  fb->timestamp.tv_usec = due % 1000000;
+  return fb;
+}
+
+void frame_replay_fb_return(camera_fb_t *fb) {
+  if (fb) {
+    free(fb->buf);
+    free(fb);
+  }
+}
+
+int frame_replay_count(void) {
+  pthread_mutex_lock(&s_lock);
+  int count = s_count;
+  pthread_mutex_unlock(&s_lock);
+  return count;
+}
+
+const frame_source_t frame_replay_source = {
+    .name = "replay",
+    .fb_get = frame_replay_fb_get,
+    .fb_return = frame_replay_fb_return,
+    .sensor_get = NULL,
+};
@@ -0,0 +1,34 @@
+#if !defined(__FRAME_REPLAY__)
+#define __FRAME_REPLAY__
+
+#include "frame_source.h"
+
+// 从一个目录回放录好的帧，按设定的帧率交给frame_source的使用者。
+//
+// The directory is listed in name order and replayed in a loop:
+//   *.jpg, *.jpeg  one JPEG per file, size read from the SOF header
+//   *.rgb          raw RGB565 in driver byte order, width x height from
+//                  frame_replay_open()
+// Frames are paced like a sensor: a caller asking early waits until the next
+// frame is due, and the timestamp is the due time on the monotonic clock.
+// Every frame is read into its own buffer, so several callers can hold frames
+// at once. The directory is listed on the first frame_replay_fb_get() (and
+// again while it has no frames), so it may sit on a file system that is
+// mounted later.
+//
+// Only libc and POSIX: host/replay_bench.c uses the same code on Linux.
+
+#define REPLAY_PATH_MAX 128
+
+// fps 0 replays as fast as the files can be read. Returns 0 on success.
+int frame_replay_open(const char *dir, int fps, int width, int height);
+
+camera_fb_t *frame_replay_fb_get(void);
+void frame_replay_fb_return(camera_fb_t *fb);
+
+// Number of frames in the directory, 0 before the first frame_replay_fb_get()
+int frame_replay_count(void);
+
+extern const frame_source_t frame_replay_source;
+
+#endif // __FRAME_REPLAY__
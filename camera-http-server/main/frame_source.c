@@ -0,0 +1,22 @@
+#include "frame_source.h"
+
+const frame_source_t frame_source_camera = {
+    .name = "camera",
+    .fb_get = esp_camera_fb_get,
+    .fb_return = esp_camera_fb_return,
+    .sensor_get = esp_camera_sensor_get,
+};
+
+static const frame_source_t *s_source = &frame_source_camera;
+
+void frame_source_set(const frame_source_t *source) { s_source = source; }
+
+const frame_source_t *frame_source_get(void) { return s_source; }
+
+camera_fb_t *frame_source_fb_get(void) { return s_source->fb_get(); }
+
+void frame_source_fb_return(camera_fb_t *fb) { s_source->fb_return(fb); }
+
+sensor_t *frame_source_sensor_get(void) {
+  return s_source->sensor_get ? s_source->sensor_get() : NULL;
+}
@@ -0,0 +1,33 @@
+#if !defined(__FRAME_SOURCE__)
+#define __FRAME_SOURCE__
+
+#include "esp_camera.h"
+
+// 帧的来源：平时是摄像头，没有摄像头时可以换成回放文件(frame_replay.h)。
+//
+// Everything that grabs frames (stream_hub, snapshot, the face detection path
+// of /capture) goes through frame_source_fb_get()/frame_source_fb_return()
+// instead of calling the esp32-camera driver directly, so the whole server
+// can run, and be benchmarked, on recorded frames. Sources without a sensor
+// return NULL from frame_source_sensor_get(); sensor settings then fail and
+// /status reports no settings.
+
+typedef struct {
+  const char *name;
+  camera_fb_t *(*fb_get)(void);
+  void (*fb_return)(camera_fb_t *fb);
+  sensor_t *(*sensor_get)(void); // may be NULL
+} frame_source_t;
+
+// esp_camera_fb_get()/esp_camera_fb_return()/esp_camera_sensor_get()
+extern const frame_source_t frame_source_camera;
+
+// 在开始拿帧之前调用，默认是frame_source_camera
+void frame_source_set(const frame_source_t *source);
+const frame_source_t *frame_source_get(void);
+
+camera_fb_t *frame_source_fb_get(void);
+void frame_source_fb_return(camera_fb_t *fb);
+sensor_t *frame_source_sensor_get(void);
+
+#endif // __FRAME_SOURCE__
@@ -0,0 +1,36 @@
+#if !defined(__IMG_SCALE__)
+#define __IMG_SCALE__
+
+#include <stdint.h>
+
+// 软件裁剪和缩小：从RGB565的帧中取出一块区域(ROI)，用盒式滤波缩小到指定大小，
+// 不用改传感器的寄存器，每个请求可以要不同的大小。
+//
+// Every output pixel is the average of the source pixels it covers. The
+// filter is separable: source rows are summed into per-column accumulators
+// (one array per channel, so the inner loops are plain adds over contiguous
+// memory) and every output row is then divided with a fixed-point reciprocal.
+// Only downscaling is supported.
+//
+// RGB565 is in the byte order of the esp32-camera driver (high byte first),
+// for both input and output. No ESP-IDF dependencies: see
+// host/img_scale_bench.c.
+
+typedef struct {
+  int x;
+  int y;
+  int w;
+  int h;
+} img_rect_t;
+
+// Clamps roi to the frame. Returns 0 if something is left of it.
+int img_rect_clip(img_rect_t *roi, int width, int height);
+
+// Scales roi of src (width x height) to dst (dst_w x dst_h). roi must be
+// clipped and at least dst_w x dst_h. Returns 0 on success, -1 on bad sizes
+// or when the accumulators cannot be allocated.
+int img_scale_rgb565(const uint8_t *src, int width, int height,
+                     const img_rect_t *roi, uint8_t *dst, int dst_w,
+                     int dst_h);
+
+#endif // __IMG_SCALE__
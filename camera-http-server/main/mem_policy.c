@@ -0,0 +1,180 @@
+#include "mem_policy.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_memory_utils.h"
+#include "freertos/FreeRTOS.h"
+#include "img_converters.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "mem_policy"
+
+static const char *s_pool_names[MEM_POOL_COUNT] = {"frame", "dma", "internal"};
+// 每种用途的主堆；只有FRAME可以回退到内部RAM
+static const uint32_t s_pool_caps[MEM_POOL_COUNT] = {
+    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+    MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL,
+    MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+};
+#define FALLBACK_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+
+typedef struct {
+  uint32_t allocs;
+  uint32_t failures;
+  uint32_t fallbacks;
+  uint32_t largest_request;
+} pool_counters_t;
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static pool_counters_t s_counters[MEM_POOL_COUNT];
+
+static void count(mem_pool_t pool, size_t size, bool ok, bool fallback) {
+  portENTER_CRITICAL(&s_mux);
+  pool_counters_t *c = &s_counters[pool];
+  c->allocs++;
+  c->failures += !ok;
+  c->fallbacks += fallback;
+  if (size > c->largest_request) {
+    c->largest_request = size;
+  }
+  portEXIT_CRITICAL(&s_mux);
+}
+
+static void log_failure(mem_pool_t pool, size_t size) {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, s_pool_caps[pool]);
+  ESP_LOGE(TAG,
+           "%s: %uB failed, free %uB, largest block %uB, internal free %uB",
+           s_pool_names[pool], (unsigned int)size,
+           (unsigned int)info.total_free_bytes,
+           (unsigned int)info.largest_free_block,
+           (unsigned int)heap_caps_get_free_size(FALLBACK_CAPS));
+}
+
+// FRAME用内部RAM之后还要给网络栈留够
+static bool fallback_allowed(size_t size) {
+  return heap_caps_get_free_size(FALLBACK_CAPS) >= size + MEM_INTERNAL_RESERVE;
+}
+
+void *mem_alloc(mem_pool_t pool, size_t size) {
+  void *p = heap_caps_malloc(size, s_pool_caps[pool]);
+  bool fallback = false;
+  if (!p && pool == MEM_POOL_FRAME && fallback_allowed(size)) {
+    p = heap_caps_malloc(size, FALLBACK_CAPS);
+    fallback = p != NULL;
+  }
+  count(pool, size, p != NULL, fallback);
+  if (!p) {
+    log_failure(pool, size);
+  }
+  return p;
+}
+
+void *mem_calloc(mem_pool_t pool, size_t n, size_t size) {
+  void *p = mem_alloc(pool, n * size);
+  if (p) {
+    memset(p, 0, n * size);
+  }
+  return p;
+}
+
+void *mem_realloc(mem_pool_t pool, void *ptr, size_t size) {
+  void *p = heap_caps_realloc(ptr, size, s_pool_caps[pool]);
+  bool fallback = false;
+  if (!p && pool == MEM_POOL_FRAME && fallback_allowed(size)) {
+    p = heap_caps_realloc(ptr, size, FALLBACK_CAPS);
+    fallback = p != NULL;
+  }
+  count(pool, size, p != NULL, fallback);
+  if (!p) {
+    log_failure(pool, size); // ptr仍然有效
+  }
+  return p;
+}
+
+typedef struct {
+  uint8_t *buf;
+  size_t cap;
+  size_t len;
+} jpeg_out_t;
+
+static size_t jpeg_out(void *arg, size_t index, const void *data, size_t len) {
+  jpeg_out_t *out = (jpeg_out_t *)arg;
+  if (index + len > out->cap) {
+    size_t cap = out->cap * 2;
+    while (cap < index + len) {
+      cap *= 2;
+    }
+    uint8_t *buf = (uint8_t *)mem_realloc(MEM_POOL_FRAME, out->buf, cap);
+    if (!buf) {
+      return 0; // 编码中止
+    }
+    out->buf = buf;
+    out->cap = cap;
+  }
+  memcpy(out->buf + index, data, len);
+  if (index + len > out->len) {
+    out->len = index + len;
+  }
+  return len;
+}
+
+bool mem_fmt2jpg(const uint8_t *src, size_t src_len, uint16_t width,
+                 uint16_t height, pixformat_t format, uint8_t quality,
+                 uint8_t **out, size_t *out_len) {
+  jpeg_out_t jpeg = {
+      .cap = (size_t)width * height * MEM_JPEG_INITIAL_BPP / 8 + 1024,
+  };
+  jpeg.buf = (uint8_t *)mem_alloc(MEM_POOL_FRAME, jpeg.cap);
+  if (!jpeg.buf) {
+    return false;
+  }
+  if (!fmt2jpg_cb((uint8_t *)src, src_len, width, height, format, quality,
+                  jpeg_out, &jpeg) ||
+      jpeg.len == 0) {
+    free(jpeg.buf);
+    return false;
+  }
+  // 缩小到实际大小：帧在发送槽位里排队时只占JPEG本身的内存
+  // (same caps as the heap it is in, so the block shrinks in place)
+  uint32_t caps = esp_ptr_external_ram(jpeg.buf) ? s_pool_caps[MEM_POOL_FRAME]
+                                                 : FALLBACK_CAPS;
+  uint8_t *shrunk = (uint8_t *)heap_caps_realloc(jpeg.buf, jpeg.len, caps);
+  *out = shrunk ? shrunk : jpeg.buf;
+  *out_len = jpeg.len;
+  return true;
+}
+
+bool mem_frame2jpg(const camera_fb_t *fb, uint8_t quality, uint8_t **out,
+                   size_t *out_len) {
+  return mem_fmt2jpg(fb->buf, fb->len, fb->width, fb->height, fb->format,
+                     quality, out, out_len);
+}
+
+const char *mem_pool_name(mem_pool_t pool) {
+  return pool < MEM_POOL_COUNT ? s_pool_names[pool] : "unknown";
+}
+
+void mem_policy_get_stats(mem_pool_t pool, mem_pool_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (pool >= MEM_POOL_COUNT) {
+    return;
+  }
+  portENTER_CRITICAL(&s_mux);
+  stats->allocs = s_counters[pool].allocs;
+  stats->failures = s_counters[pool].failures;
+  stats->fallbacks = s_counters[pool].fallbacks;
+  stats->largest_request = s_counters[pool].largest_request;
+  portEXIT_CRITICAL(&s_mux);
+
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, s_pool_caps[pool]);
+  stats->free_bytes = info.total_free_bytes;
+  stats->min_free_bytes = info.minimum_free_bytes;
+  stats->largest_free_block = info.largest_free_block;
+  stats->fragmentation =
+      info.total_free_bytes
+          ? 100 - (uint8_t)((uint64_t)info.largest_free_block * 100 /
+                            info.total_free_bytes)
+          : 0;
+}
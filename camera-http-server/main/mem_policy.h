@@ -0,0 +1,65 @@
+#if !defined(__MEM_POLICY__)
+#define __MEM_POLICY__
+
+#include "esp_camera.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 大块内存按用途从不同的堆分配，不再和lwIP/WiFi抢内部RAM。
+//
+// MEM_POOL_FRAME (images, JPEGs, recordings) lives in PSRAM and only falls
+// back to internal RAM when that still leaves MEM_INTERNAL_RESERVE free for
+// the network stack. MEM_POOL_DMA is internal DMA-capable memory for
+// peripherals like I2S, MEM_POOL_INTERNAL is plain internal RAM for small
+// buffers on hot paths. Everything is released with free().
+//
+// mem_fmt2jpg() replaces fmt2jpg(): the library always allocates a 128kB
+// output buffer with malloc() and hands it over at that size, this version
+// encodes into a MEM_POOL_FRAME buffer and shrinks it to the JPEG.
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define MEM_INTERNAL_RESERVE (48 * 1024)
+#define MEM_JPEG_INITIAL_BPP 4 // JPEG缓冲区初始大小：每像素几比特，不够时翻倍
+
+typedef enum {
+  MEM_POOL_FRAME,
+  MEM_POOL_DMA,
+  MEM_POOL_INTERNAL,
+  MEM_POOL_COUNT,
+} mem_pool_t;
+
+typedef struct {
+  uint32_t allocs;
+  uint32_t failures;
+  uint32_t fallbacks; // MEM_POOL_FRAME: served from internal RAM
+  uint32_t largest_request;
+  // 主堆（FRAME是PSRAM）的当前状态
+  uint32_t free_bytes;
+  uint32_t min_free_bytes;
+  uint32_t largest_free_block;
+  uint8_t fragmentation; // 100 - largest_free_block * 100 / free_bytes
+} mem_pool_stats_t;
+
+// 失败时打印这个堆的空闲内存和碎片情况，返回NULL
+void *mem_alloc(mem_pool_t pool, size_t size);
+void *mem_calloc(mem_pool_t pool, size_t n, size_t size);
+void *mem_realloc(mem_pool_t pool, void *ptr, size_t size);
+
+bool mem_fmt2jpg(const uint8_t *src, size_t src_len, uint16_t width,
+                 uint16_t height, pixformat_t format, uint8_t quality,
+                 uint8_t **out, size_t *out_len);
+bool mem_frame2jpg(const camera_fb_t *fb, uint8_t quality, uint8_t **out,
+                   size_t *out_len);
+
+const char *mem_pool_name(mem_pool_t pool);
+void mem_policy_get_stats(mem_pool_t pool, mem_pool_stats_t *stats);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif // __MEM_POLICY__
@@ -0,0 +1,289 @@
+#include "metrics.h"
+#include "async_handler.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "mem_policy.h"
+#include "stream_hub.h"
+#include "timelapse.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define METRICS_LINE_MAX 192
+
+typedef struct {
+  uint32_t buckets[16]; // cumulative counts are computed when printing
+  uint32_t count;
+  uint64_t sum;
+} histogram_t;
+
+// 耗时桶的上界（微秒）；最后一个是+Inf
+static const uint32_t s_time_bounds[] = {1000,   2000,   5000,   10000,
+                                         20000,  50000,  100000, 200000,
+                                         500000, 1000000};
+#define TIME_BUCKETS (sizeof(s_time_bounds) / sizeof(s_time_bounds[0]))
+// 帧大小桶的上界（字节）
+static const uint32_t s_size_bounds[] = {2048,  4096,  8192,  16384,
+                                         32768, 65536, 131072};
+#define SIZE_BUCKETS (sizeof(s_size_bounds) / sizeof(s_size_bounds[0]))
+
+static const char *s_stage_names[METRIC_STAGE_COUNT] = {
+    "sensor_wait", "convert", "encode", "send"};
+static const char *s_counter_names[METRIC_COUNTER_COUNT] = {
+    "camera_frames_captured_total", "camera_frames_published_total",
+    "camera_frames_still_total", "camera_frames_dropped_total",
+    "camera_capture_errors_total"};
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static histogram_t s_stages[METRIC_STAGE_COUNT];
+static histogram_t s_frame_size;
+static uint32_t s_counters[METRIC_COUNTER_COUNT];
+
+static void observe(histogram_t *h, const uint32_t *bounds, size_t n,
+                    uint32_t value) {
+  size_t i = 0;
+  while (i < n && value > bounds[i]) {
+    i++;
+  }
+  portENTER_CRITICAL(&s_mux);
+  h->buckets[i]++;
+  h->count++;
+  h->sum += value;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+void metrics_stage(metric_stage_t stage, uint32_t us) {
+  observe(&s_stages[stage], s_time_bounds, TIME_BUCKETS, us);
+}
+
+void metrics_frame_size(uint32_t bytes) {
+  observe(&s_frame_size, s_size_bounds, SIZE_BUCKETS, bytes);
+}
+
+void metrics_inc(metric_counter_t counter) {
+  portENTER_CRITICAL(&s_mux);
+  s_counters[counter]++;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+static esp_err_t send_line(httpd_req_t *req, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static esp_err_t send_line(httpd_req_t *req, const char *fmt, ...) {
+  char line[METRICS_LINE_MAX];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  return httpd_resp_sendstr_chunk(req, line);
+}
+
+// scale把桶的上界和总和换算成Prometheus的单位（秒或字节）
+static void send_histogram(httpd_req_t *req, const char *name,
+                           const char *labels, const histogram_t *h,
+                           const uint32_t *bounds, size_t n, double scale) {
+  histogram_t copy;
+  portENTER_CRITICAL(&s_mux);
+  copy = *h;
+  portEXIT_CRITICAL(&s_mux);
+
+  const char *sep = labels[0] ? "," : "";
+  char braces[48] = "";
+  if (labels[0]) {
+    snprintf(braces, sizeof(braces), "{%s}", labels);
+  }
+  uint32_t cumulative = 0;
+  for (size_t i = 0; i < n; i++) {
+    cumulative += copy.buckets[i];
+    send_line(req, "%s_bucket{%s%sle=\"%g\"} %u\n", name, labels, sep,
+              bounds[i] * scale, cumulative);
+  }
+  send_line(req, "%s_bucket{%s%sle=\"+Inf\"} %u\n", name, labels, sep,
+            copy.count);
+  send_line(req, "%s_sum%s %.6f\n", name, braces, copy.sum * scale);
+  send_line(req, "%s_count%s %u\n", name, braces, copy.count);
+}
+
+// 一层视频流最近几个窗口的summary，最小/最大值用quantile 0和1表示
+static void send_stream_stats(httpd_req_t *req, const char *name,
+                              const char *layer,
+                              const stream_stats_summary_t *st, double scale) {
+  for (int w = 0; w < STREAM_STATS_WINDOWS; w++) {
+    const stream_stats_window_t *win = &st->windows[w];
+    char labels[48];
+    snprintf(labels, sizeof(labels), "layer=\"%s\",window=\"%gs\"", layer,
+             win->window_ms / 1000.0);
+    if (win->count) {
+      const struct {
+        const char *q;
+        uint32_t value;
+      } quantiles[] = {{"0", win->min},    {"0.5", win->p50}, {"0.9", win->p90},
+                       {"0.99", win->p99}, {"1", win->max}};
+      for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        send_line(req, "%s{%s,quantile=\"%s\"} %g\n", name, labels,
+                  quantiles[i].q, quantiles[i].value * scale);
+      }
+    }
+    send_line(req, "%s_sum{%s} %g\n", name, labels,
+              (double)win->mean * win->count * scale);
+    send_line(req, "%s_count{%s} %u\n", name, labels, win->count);
+  }
+  send_line(req, "%s_ewma{layer=\"%s\"} %g\n", name, layer, st->ewma * scale);
+}
+
+static esp_err_t metrics_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+  httpd_resp_sendstr_chunk(req, "# TYPE camera_stage_seconds histogram\n");
+  for (int i = 0; i < METRIC_STAGE_COUNT; i++) {
+    char labels[32];
+    snprintf(labels, sizeof(labels), "stage=\"%s\"", s_stage_names[i]);
+    send_histogram(req, "camera_stage_seconds", labels, &s_stages[i],
+                   s_time_bounds, TIME_BUCKETS, 1e-6);
+  }
+  httpd_resp_sendstr_chunk(req, "# TYPE camera_frame_bytes histogram\n");
+  send_histogram(req, "camera_frame_bytes", "", &s_frame_size, s_size_bounds,
+                 SIZE_BUCKETS, 1);
+
+  uint32_t counters[METRIC_COUNTER_COUNT];
+  portENTER_CRITICAL(&s_mux);
+  memcpy(counters, s_counters, sizeof(counters));
+  portEXIT_CRITICAL(&s_mux);
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    send_line(req, "# TYPE %s counter\n%s %u\n", s_counter_names[i],
+              s_counter_names[i], counters[i]);
+  }
+
+  // 内存：当前空闲和开机以来的最低值
+  httpd_resp_sendstr_chunk(req, "# TYPE camera_heap_free_bytes gauge\n");
+  send_line(req, "camera_heap_free_bytes{pool=\"internal\"} %u\n",
+            (unsigned int)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+  send_line(req, "camera_heap_free_bytes{pool=\"psram\"} %u\n",
+            (unsigned int)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+  httpd_resp_sendstr_chunk(req, "# TYPE camera_heap_min_free_bytes gauge\n");
+  send_line(req, "camera_heap_min_free_bytes{pool=\"internal\"} %u\n",
+            (unsigned int)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+  send_line(req, "camera_heap_min_free_bytes{pool=\"psram\"} %u\n",
+            (unsigned int)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+
+  // 按用途分配的大块内存（mem_policy.h）：次数、失败、回退和所在堆的碎片
+  httpd_resp_sendstr_chunk(
+      req, "# TYPE camera_mem_allocs_total counter\n"
+           "# TYPE camera_mem_alloc_failures_total counter\n"
+           "# TYPE camera_mem_fallbacks_total counter\n"
+           "# TYPE camera_mem_free_bytes gauge\n"
+           "# TYPE camera_mem_largest_free_block_bytes gauge\n"
+           "# TYPE camera_mem_fragmentation_ratio gauge\n");
+  for (int i = 0; i < MEM_POOL_COUNT; i++) {
+    mem_pool_stats_t mem;
+    mem_policy_get_stats((mem_pool_t)i, &mem);
+    const char *use = mem_pool_name((mem_pool_t)i);
+    send_line(req, "camera_mem_allocs_total{use=\"%s\"} %u\n", use,
+              mem.allocs);
+    send_line(req, "camera_mem_alloc_failures_total{use=\"%s\"} %u\n", use,
+              mem.failures);
+    send_line(req, "camera_mem_fallbacks_total{use=\"%s\"} %u\n", use,
+              mem.fallbacks);
+    send_line(req, "camera_mem_free_bytes{use=\"%s\"} %u\n", use,
+              mem.free_bytes);
+    send_line(req, "camera_mem_largest_free_block_bytes{use=\"%s\"} %u\n",
+              use, mem.largest_free_block);
+    send_line(req, "camera_mem_fragmentation_ratio{use=\"%s\"} %.2f\n", use,
+              mem.fragmentation / 100.0);
+  }
+
+  // 每个视频流客户端
+  stream_client_stats_t clients[STREAM_HUB_MAX_CLIENTS];
+  int count = stream_hub_get_stats(clients, STREAM_HUB_MAX_CLIENTS);
+  if (count > STREAM_HUB_MAX_CLIENTS) {
+    count = STREAM_HUB_MAX_CLIENTS;
+  }
+  int64_t now = esp_timer_get_time();
+  httpd_resp_sendstr_chunk(req, "# TYPE camera_clients gauge\n");
+  send_line(req, "camera_clients %d\n", count);
+  for (int i = 0; i < count; i++) {
+    const stream_client_stats_t *c = &clients[i];
+    char labels[64];
+    snprintf(labels, sizeof(labels), "fd=\"%d\",type=\"%s\",layer=\"%s\"",
+             c->fd,
+             c->type == STREAM_CLIENT_WS    ? "ws"
+             : c->type == STREAM_CLIENT_RTP ? "rtp"
+                                            : "multipart",
+             stream_hub_layer_name(c->layer));
+    double secs = (now - c->connected_us) / 1e6;
+    send_line(req, "camera_client_sent_frames_total{%s} %u\n", labels,
+              c->sent);
+    send_line(req, "camera_client_dropped_frames_total{%s} %u\n", labels,
+              c->dropped);
+    send_line(req, "camera_client_sent_bytes_total{%s} %llu\n", labels,
+              (unsigned long long)c->bytes);
+    send_line(req, "camera_client_bytes_per_second{%s} %.0f\n", labels,
+              secs > 0 ? c->bytes / secs : 0);
+    if (c->type == STREAM_CLIENT_RTP) {
+      send_line(req, "camera_client_sent_packets_total{%s} %u\n", labels,
+                c->packets);
+    }
+  }
+
+  // 每层视频流的帧间隔和帧大小：最近1s/5s的分位数和EWMA
+  httpd_resp_sendstr_chunk(
+      req, "# TYPE camera_stream_frame_interval_seconds summary\n"
+           "# TYPE camera_stream_frame_size_bytes summary\n");
+  for (int i = 0; i < STREAM_LAYER_COUNT; i++) {
+    stream_stats_summary_t interval, bytes;
+    if (!stream_hub_get_layer_stats((stream_layer_t)i, now, &interval,
+                                    &bytes)) {
+      continue; // 这次没读到一致的快照，下次抓取再说
+    }
+    const char *layer = stream_hub_layer_name((stream_layer_t)i);
+    send_stream_stats(req, "camera_stream_frame_interval_seconds", layer,
+                      &interval, 1e-6);
+    send_stream_stats(req, "camera_stream_frame_size_bytes", layer, &bytes, 1);
+  }
+
+  async_handler_stats_t async;
+  async_handler_get_stats(&async);
+  send_line(req, "camera_async_queue_depth %u\n", async.depth);
+  send_line(req, "camera_async_queue_max_depth %u\n", async.max_depth);
+  send_line(req, "camera_async_busy_workers %u\n", async.busy);
+  send_line(req, "camera_async_completed_total %u\n", async.completed);
+  send_line(req, "camera_async_rejected_total %u\n", async.rejected);
+  send_line(req, "camera_async_wait_seconds_sum %.6f\n", async.wait_us / 1e6);
+  send_line(req, "camera_async_wait_seconds_max %.6f\n",
+            async.max_wait_us / 1e6);
+
+  // 传感器上电/休眠时间和间隔拍照
+  timelapse_stats_t tl;
+  timelapse_get_stats(&tl);
+  send_line(req, "camera_sensor_on_seconds_total %.3f\n",
+            tl.sensor_on_us / 1e6);
+  send_line(req, "camera_sensor_off_seconds_total %.3f\n",
+            tl.sensor_off_us / 1e6);
+  send_line(req, "camera_sensor_wakeups_total %u\n", tl.sensor_wakeups);
+  send_line(req, "camera_timelapse_frames_total %u\n", tl.frames);
+  send_line(req, "camera_timelapse_failures_total %u\n", tl.failures);
+  send_line(req, "camera_timelapse_bytes_total %llu\n",
+            (unsigned long long)tl.bytes);
+  send_line(req, "camera_timelapse_awake_seconds_total %.3f\n",
+            tl.awake_us / 1e6);
+  send_line(req, "camera_timelapse_sleeps_total %u\n", tl.sleeps);
+
+  return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+esp_err_t metrics_register(httpd_handle_t server) {
+  httpd_uri_t metrics_uri = {.uri = "/metrics",
+                             .method = HTTP_GET,
+                             .handler = metrics_handler,
+                             .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+                             ,
+                             .is_websocket = false,
+                             .handle_ws_control_frames = false,
+                             .supported_subprotocol = NULL
+#endif
+  };
+  return httpd_register_uri_handler(server, &metrics_uri);
+}
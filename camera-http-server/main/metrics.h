@@ -0,0 +1,37 @@
+#if !defined(__METRICS__)
+#define __METRICS__
+
+#include "esp_http_server.h"
+#include <stdint.h>
+
+// 视频流各阶段的耗时直方图和计数器，通过 /metrics 以Prometheus文本格式输出。
+//
+// Recording a value is a bucket search over a dozen bounds and a few adds in
+// a short critical section, so the counters stay enabled in production.
+// Client throughput, heap high-water marks and async queue stats are read
+// from their owners when /metrics is requested.
+
+typedef enum {
+  METRIC_SENSOR_WAIT, // esp_camera_fb_get()
+  METRIC_CONVERT,     // motion analysis (incl. JPEG decode) and face overlay
+  METRIC_ENCODE,      // frame2jpg() or the copy of a sensor JPEG
+  METRIC_SEND,        // publish until the first client has the whole frame
+  METRIC_STAGE_COUNT,
+} metric_stage_t;
+
+typedef enum {
+  METRIC_FRAMES_CAPTURED,
+  METRIC_FRAMES_PUBLISHED,
+  METRIC_FRAMES_STILL,   // skipped by the motion gate
+  METRIC_FRAMES_DROPPED, // replaced in a client slot before they were sent
+  METRIC_CAPTURE_ERRORS,
+  METRIC_COUNTER_COUNT,
+} metric_counter_t;
+
+void metrics_stage(metric_stage_t stage, uint32_t us);
+void metrics_frame_size(uint32_t bytes);
+void metrics_inc(metric_counter_t counter);
+
+esp_err_t metrics_register(httpd_handle_t server);
+
+#endif // __METRICS__
@@ -0,0 +1,53 @@
+#if !defined(__MOTION_DETECT__)
+#define __MOTION_DETECT__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 基于分块亮度均值的帧差检测，用来判断门口的画面有没有变化。
+//
+// The frame is split into MOTION_GRID_W x MOTION_GRID_H blocks. Every block is
+// reduced to the mean luma of a sparse sample of its pixels, and a block
+// counts as changed when its mean moved more than the threshold relative to
+// the reference grid. The average shift over all blocks is subtracted first
+// so that auto exposure brightening the whole picture is not motion.
+//
+// No ESP-IDF dependencies: host/motion_replay.c runs the same code on
+// recorded frames.
+
+#define MOTION_GRID_W 16
+#define MOTION_GRID_H 12
+#define MOTION_BLOCKS (MOTION_GRID_W * MOTION_GRID_H)
+#define MOTION_SAMPLE_STEP 2 // 每隔几个像素/几行采样一次
+
+typedef struct {
+  int threshold;          // block mean change (0..255) that counts as changed
+  int min_changed_blocks; // this many changed blocks mean motion
+  bool has_reference;
+  int changed_blocks; // result of the last call
+  uint8_t reference[MOTION_BLOCKS];
+  uint8_t current[MOTION_BLOCKS];
+} motion_detect_t;
+
+void motion_detect_init(motion_detect_t *md, int threshold,
+                        int min_changed_blocks);
+
+// Both return the number of changed blocks compared to the reference. Without
+// a reference every block counts as changed.
+// RGB565 is in the byte order of the esp32-camera driver (high byte first).
+int motion_detect_rgb565(motion_detect_t *md, const uint8_t *buf, int width,
+                         int height);
+int motion_detect_gray(motion_detect_t *md, const uint8_t *buf, int width,
+                       int height);
+
+static inline bool motion_detect_moved(const motion_detect_t *md) {
+  return !md->has_reference ||
+         md->changed_blocks >= md->min_changed_blocks;
+}
+
+// Makes the grid of the last analysed frame the new reference. Call it for
+// frames that are actually sent, so slow drift adds up until it is sent too.
+void motion_detect_accept(motion_detect_t *md);
+
+#endif // __MOTION_DETECT__
@@ -0,0 +1,152 @@
+#include "rate_control.h"
+
+// 连续多少帧超出预算才降低质量，连续多少帧有余量才提高质量
+#define OVER_FRAMES 3
+#define UNDER_FRAMES 15
+// 调整之后等待多少帧再做判断，给编码器和网络一点反应时间
+#define HOLD_AFTER_DECREASE 5
+#define HOLD_AFTER_INCREASE 10
+#define HOLD_AFTER_RESIZE 10
+
+#define QUALITY_UP_STEP 3
+#define QUALITY_MIN_DOWN_STEP 2
+#define QUALITY_MAX_DOWN_STEP 15
+
+static int clamp(int v, int lo, int hi) {
+  if (v < lo) {
+    return lo;
+  }
+  if (v > hi) {
+    return hi;
+  }
+  return v;
+}
+
+// EWMA with alpha = 1/8, seeded by the first sample
+static int64_t ewma(int64_t avg, int64_t value) {
+  if (avg == 0) {
+    return value;
+  }
+  return avg + (value - avg) / 8;
+}
+
+static void reset_averages(rate_control_t *rc) {
+  rc->avg_frame_us = 0;
+  rc->avg_send_us = 0;
+  rc->avg_bytes = 0;
+  rc->over_count = 0;
+  rc->under_count = 0;
+}
+
+void rate_control_init(rate_control_t *rc, int target_fps, int min_quality,
+                       int max_quality, int max_size_step) {
+  if (target_fps < 1) {
+    target_fps = 1;
+  }
+  rc->target_fps = target_fps;
+  rc->budget_us = 1000000 / target_fps;
+  rc->min_quality = clamp(min_quality, 1, 100);
+  rc->max_quality = clamp(max_quality, rc->min_quality, 100);
+  rc->max_size_step = max_size_step < 0 ? 0 : max_size_step;
+  rc->quality = rc->max_quality;
+  rc->size_step = 0;
+  rc->hold = 0;
+  reset_averages(rc);
+}
+
+static bool step_size_down(rate_control_t *rc) {
+  if (rc->size_step >= rc->max_size_step) {
+    return false;
+  }
+  rc->size_step++;
+  rc->quality = (rc->min_quality + rc->max_quality) / 2;
+  rc->hold = HOLD_AFTER_RESIZE;
+  reset_averages(rc);
+  return true;
+}
+
+static bool step_size_up(rate_control_t *rc) {
+  if (rc->size_step == 0) {
+    return false;
+  }
+  rc->size_step--;
+  // 分辨率升一档后每帧字节数大约翻倍，从中间质量开始重新收敛
+  rc->quality = (rc->min_quality + rc->max_quality) / 2;
+  rc->hold = HOLD_AFTER_RESIZE;
+  reset_averages(rc);
+  return true;
+}
+
+bool rate_control_update(rate_control_t *rc, const rate_sample_t *sample) {
+  rc->avg_frame_us = ewma(rc->avg_frame_us, sample->frame_us);
+  rc->avg_send_us = ewma(rc->avg_send_us, sample->send_us);
+  rc->avg_bytes = (uint32_t)ewma(rc->avg_bytes, sample->bytes);
+
+  if (rc->hold > 0 && !sample->backpressure) {
+    rc->hold--;
+    return false;
+  }
+
+  // 发送阻塞：立即按比例降低质量（乘性减）
+  if (sample->backpressure) {
+    if (rc->quality <= rc->min_quality) {
+      return step_size_down(rc);
+    }
+    rc->quality = clamp(rc->quality * 3 / 4, rc->min_quality, rc->max_quality);
+    rc->hold = HOLD_AFTER_DECREASE;
+    rc->over_count = 0;
+    rc->under_count = 0;
+    return false;
+  }
+
+  // Only the network side is under our control: if the frame period is long
+  // but the send time is short the sensor itself is the bottleneck and
+  // lowering the quality would not buy any fps.
+  bool over = rc->avg_frame_us > rc->budget_us * 11 / 10 &&
+              rc->avg_send_us * 2 > rc->budget_us;
+  bool under = rc->avg_send_us * 3 < rc->budget_us;
+
+  if (over) {
+    rc->under_count = 0;
+    if (++rc->over_count < OVER_FRAMES) {
+      return false;
+    }
+    rc->over_count = 0;
+    if (rc->quality <= rc->min_quality) {
+      return step_size_down(rc);
+    }
+    // Frame size is roughly proportional to quality in the useful range, so
+    // scale it by how far we are over budget.
+    int target = (int)(rc->quality * rc->budget_us / rc->avg_frame_us);
+    target = clamp(target, rc->quality - QUALITY_MAX_DOWN_STEP,
+                   rc->quality - QUALITY_MIN_DOWN_STEP);
+    rc->quality = clamp(target, rc->min_quality, rc->max_quality);
+    rc->hold = HOLD_AFTER_DECREASE;
+    return false;
+  }
+
+  if (under) {
+    rc->over_count = 0;
+    if (++rc->under_count < UNDER_FRAMES) {
+      return false;
+    }
+    rc->under_count = 0;
+    // 加性增：先提高质量，质量到顶后再提高分辨率
+    if (rc->quality < rc->max_quality) {
+      rc->quality =
+          clamp(rc->quality + QUALITY_UP_STEP, rc->min_quality, rc->max_quality);
+      rc->hold = HOLD_AFTER_INCREASE;
+      return false;
+    }
+    return step_size_up(rc);
+  }
+
+  rc->over_count = 0;
+  rc->under_count = 0;
+  return false;
+}
+
+int rate_control_sensor_quality(int quality) {
+  quality = clamp(quality, 1, 100);
+  return 63 - (quality - 1) * (63 - 10) / 99;
+}
@@ -0,0 +1,52 @@
+#if !defined(__RATE_CONTROL__)
+#define __RATE_CONTROL__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 码率控制器：根据每帧的发送耗时和发送是否受阻，动态调整JPEG质量和分辨率，
+// 使视频流尽量维持在目标帧率。
+// This file has no ESP-IDF dependencies so it can be built on the host
+// (see host/rate_control_sim.c).
+
+typedef struct {
+  int64_t frame_us; // time between the previous frame and this one
+  int64_t send_us;  // time spent pushing this frame into the socket
+  size_t bytes;     // encoded frame size
+  bool backpressure; // the send failed, timed out or the frame was dropped
+} rate_sample_t;
+
+typedef struct {
+  // configuration
+  int64_t budget_us; // 1s / target fps
+  int target_fps;
+  int min_quality;   // frame2jpg() quality range, higher is better
+  int max_quality;
+  int max_size_step; // how many frame sizes below the configured one we may go
+
+  // output
+  int quality;
+  int size_step; // 0 = configured frame size, 1 = one size smaller, ...
+
+  // state
+  int64_t avg_frame_us; // EWMA of frame_us
+  int64_t avg_send_us;  // EWMA of send_us
+  uint32_t avg_bytes;   // EWMA of bytes
+  int over_count;       // consecutive frames over budget
+  int under_count;      // consecutive frames with spare budget
+  int hold;             // frames to wait after a change before judging again
+} rate_control_t;
+
+void rate_control_init(rate_control_t *rc, int target_fps, int min_quality,
+                       int max_quality, int max_size_step);
+
+// Feeds one frame worth of measurements. Returns true when size_step changed
+// and the caller has to reconfigure the sensor.
+bool rate_control_update(rate_control_t *rc, const rate_sample_t *sample);
+
+// Maps a frame2jpg() quality (1..100, higher is better) to the sensor's own
+// JPEG quality register (10..63, lower is better) for PIXFORMAT_JPEG sensors.
+int rate_control_sensor_quality(int quality);
+
+#endif // __RATE_CONTROL__
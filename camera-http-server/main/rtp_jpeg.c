@@ -0,0 +1,152 @@
+#include "rtp_jpeg.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+static uint16_t be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+  p[0] = v >> 8;
+  p[1] = v & 0xFF;
+  return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+  p = put16(p, v >> 16);
+  return put16(p, v & 0xFFFF);
+}
+
+// SOF0：三个分量，亮度2x1或2x2采样，两个色度1x1
+static int parse_sof(const uint8_t *p, size_t len, rtp_jpeg_frame_t *frame) {
+  if (len < 15 || p[0] != 8 || p[5] != 3 || p[10] != 0x11 || p[13] != 0x11) {
+    return -1;
+  }
+  frame->height = be16(p + 1);
+  frame->width = be16(p + 3);
+  if (p[7] == 0x21) {
+    frame->type = 0;
+  } else if (p[7] == 0x22) {
+    frame->type = 1;
+  } else {
+    return -1;
+  }
+  // 宽高以8像素为单位放在一个字节里
+  return frame->width > 0 && frame->height > 0 && frame->width <= 2040 &&
+                 frame->height <= 2040
+             ? 0
+             : -1;
+}
+
+// DQT段可能包含多个表；只支持8位精度的表0（亮度）和表1（色度）
+static int parse_dqt(const uint8_t *p, size_t len, rtp_jpeg_frame_t *frame,
+                     int *tables) {
+  size_t i = 0;
+  while (i < len) {
+    int id = p[i] & 0x0F;
+    if ((p[i] >> 4) != 0 || id > 1 || i + 65 > len) {
+      return -1;
+    }
+    memcpy(frame->qtables + id * 64, p + i + 1, 64);
+    *tables |= 1 << id;
+    i += 65;
+  }
+  return 0;
+}
+
+int rtp_jpeg_parse(const uint8_t *jpeg, size_t len, rtp_jpeg_frame_t *frame) {
+  memset(frame, 0, sizeof(*frame));
+  if (len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+    return -1;
+  }
+  int tables = 0;
+  bool has_sof = false;
+  size_t i = 2;
+  while (i + 4 <= len) {
+    if (jpeg[i] != 0xFF) {
+      return -1;
+    }
+    uint8_t marker = jpeg[i + 1];
+    if (marker == 0xFF) {
+      i++; // fill byte
+      continue;
+    }
+    size_t seg = be16(jpeg + i + 2);
+    if (seg < 2 || i + 2 + seg > len) {
+      return -1;
+    }
+    const uint8_t *p = jpeg + i + 4;
+    size_t plen = seg - 2;
+    if (marker == 0xC0) {
+      if (parse_sof(p, plen, frame) != 0) {
+        return -1;
+      }
+      has_sof = true;
+    } else if ((marker & 0xF0) == 0xC0 && marker != 0xC4 && marker != 0xC8 &&
+               marker != 0xCC) {
+      return -1; // progressive, lossless, arithmetic coded...
+    } else if (marker == 0xDB) {
+      if (parse_dqt(p, plen, frame, &tables) != 0) {
+        return -1;
+      }
+    } else if (marker == 0xDD && plen >= 2) {
+      frame->restart_interval = be16(p);
+    } else if (marker == 0xDA) {
+      if (!has_sof || tables != 3) {
+        return -1;
+      }
+      frame->scan = jpeg + i + 2 + seg;
+      frame->scan_len = len - (i + 2 + seg);
+      // 去掉结尾的EOI（后面可能还有填充）
+      while (frame->scan_len >= 2 &&
+             !(frame->scan[frame->scan_len - 2] == 0xFF &&
+               frame->scan[frame->scan_len - 1] == 0xD9)) {
+        frame->scan_len--;
+      }
+      if (frame->scan_len < 2) {
+        return -1;
+      }
+      frame->scan_len -= 2;
+      if (frame->restart_interval) {
+        frame->type += 64;
+      }
+      return 0;
+    }
+    i += 2 + seg;
+  }
+  return -1;
+}
+
+size_t rtp_jpeg_packet(const rtp_jpeg_frame_t *frame, size_t offset,
+                       size_t max_packet, rtp_jpeg_stream_t *stream,
+                       uint8_t *header, size_t *payload_len) {
+  uint8_t *p = header + RTP_HEADER_LEN;
+  // JPEG头：type-specific, fragment offset(24位), type, Q, 宽/8, 高/8
+  p = put32(p, offset & 0xFFFFFF);
+  *p++ = frame->type;
+  *p++ = 255; // 量化表在第一个包里
+  *p++ = (frame->width + 7) / 8;
+  *p++ = (frame->height + 7) / 8;
+  if (frame->type >= 64) {
+    p = put16(p, frame->restart_interval);
+    p = put16(p, 0xFFFF); // F = L = 1, count 0x3FFF: not aligned to restarts
+  }
+  if (offset == 0) {
+    *p++ = 0; // MBZ
+    *p++ = 0; // 8 bit precision
+    p = put16(p, sizeof(frame->qtables));
+    memcpy(p, frame->qtables, sizeof(frame->qtables));
+    p += sizeof(frame->qtables);
+  }
+  size_t header_len = p - header;
+  size_t left = frame->scan_len - offset;
+  size_t room = max_packet > header_len ? max_packet - header_len : 1;
+  *payload_len = left < room ? left : room;
+
+  bool last = offset + *payload_len == frame->scan_len;
+  header[0] = 0x80; // version 2
+  header[1] = (last ? 0x80 : 0) | RTP_JPEG_PAYLOAD_TYPE;
+  put16(header + 2, stream->seq++);
+  put32(header + 4, stream->timestamp);
+  put32(header + 8, stream->ssrc);
+  return header_len;
+}
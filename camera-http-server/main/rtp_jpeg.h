@@ -0,0 +1,57 @@
+#if !defined(__RTP_JPEG__)
+#define __RTP_JPEG__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// JPEG帧的RTP封包（RFC 2435，payload type 26），RTSP服务器和stream_hub用。
+//
+// rtp_jpeg_parse() finds what RFC 2435 carries out of band or in its own
+// headers: size, sampling type, restart interval and the quantization
+// tables, plus the entropy coded scan, which is what the packets carry.
+// rtp_jpeg_packet() then builds the headers of one packet; the payload is a
+// slice of the scan that the caller sends straight from the frame buffer
+// (sendmsg() with two iovecs), so the frame is never copied into packets.
+//
+// Only baseline YCbCr JPEGs with 4:2:2 or 4:2:0 sampling and the standard
+// Huffman tables can be carried, which is what frame2jpg() and the camera
+// sensors produce. Quantization tables are sent in band (Q = 255) in the
+// first packet of every frame.
+//
+// No ESP-IDF dependencies: see host/rtp_replay.c.
+
+#define RTP_JPEG_PAYLOAD_TYPE 26
+#define RTP_JPEG_CLOCK_RATE 90000
+#define RTP_HEADER_LEN 12
+// RTP + JPEG + restart marker + quantization table headers
+#define RTP_JPEG_HEADER_MAX (RTP_HEADER_LEN + 8 + 4 + 4 + 128)
+
+typedef struct {
+  const uint8_t *scan; // entropy coded data, between SOS and EOI
+  size_t scan_len;
+  uint16_t width;
+  uint16_t height;
+  uint8_t type; // RFC 2435 type: 0 = 4:2:2, 1 = 4:2:0, +64 with restarts
+  uint16_t restart_interval;
+  uint8_t qtables[128]; // luma then chroma, 8 bit, zigzag order
+} rtp_jpeg_frame_t;
+
+typedef struct {
+  uint32_t ssrc;
+  uint16_t seq;       // of the next packet, incremented by rtp_jpeg_packet()
+  uint32_t timestamp; // of the frame being sent, 90 kHz
+} rtp_jpeg_stream_t;
+
+// Returns 0 when the JPEG can be sent, -1 otherwise. The frame points into
+// jpeg, which must stay valid while packets are built from it.
+int rtp_jpeg_parse(const uint8_t *jpeg, size_t len, rtp_jpeg_frame_t *frame);
+
+// Writes the headers of the packet that carries the scan from offset on and
+// returns their length; *payload_len is how much of the scan follows them so
+// that the packet stays within max_packet bytes. The last packet of the frame
+// has the marker bit set.
+size_t rtp_jpeg_packet(const rtp_jpeg_frame_t *frame, size_t offset,
+                       size_t max_packet, rtp_jpeg_stream_t *stream,
+                       uint8_t *header, size_t *payload_len);
+
+#endif // __RTP_JPEG__
@@ -0,0 +1,576 @@
+#include "rtsp_server.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "rtp_jpeg.h"
+#include "stream_hub.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+
+#define TAG "rtsp_server"
+
+// 多留一个连接，会话满了的客户端还能收到453
+#define RTSP_MAX_CONNECTIONS (RTSP_MAX_SESSIONS + 1)
+#define RTSP_REPLY_MAX 1024
+#define RTSP_URL_MAX 128
+// 1970到1900年（NTP的起点）的秒数
+#define NTP_OFFSET 2208988800UL
+
+typedef struct {
+  int fd; // -1 when the slot is free
+  size_t len;
+  char buf[RTSP_REQUEST_MAX];
+} rtsp_conn_t;
+
+typedef struct {
+  bool active;
+  bool playing;
+  uint32_t id;
+  int rtp_fd;
+  int rtcp_fd;
+  stream_rtp_params_t rtp;
+  int64_t last_seen_us;
+  int64_t next_report_us;
+} rtsp_session_t;
+
+static int s_listen_fd = -1;
+static rtsp_conn_t s_conns[RTSP_MAX_CONNECTIONS];
+static rtsp_session_t s_sessions[RTSP_MAX_SESSIONS];
+static char s_reply[RTSP_REPLY_MAX];
+
+static const char *_RTSP_PUBLIC =
+    "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER, "
+    "SET_PARAMETER\r\n";
+
+// 在请求头里找name，值（去掉前后空白）拷到out
+static bool find_header(const char *req, const char *name, char *out,
+                        size_t size) {
+  size_t n = strlen(name);
+  for (const char *line = strstr(req, "\r\n"); line;
+       line = strstr(line, "\r\n")) {
+    line += 2;
+    if (strncasecmp(line, name, n) != 0 || line[n] != ':') {
+      continue;
+    }
+    const char *value = line + n + 1;
+    while (*value == ' ' || *value == '\t') {
+      value++;
+    }
+    size_t len = strcspn(value, "\r\n");
+    if (len >= size) {
+      return false;
+    }
+    memcpy(out, value, len);
+    out[len] = '\0';
+    return true;
+  }
+  return false;
+}
+
+static void send_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    int n = send(fd, data, len, 0);
+    if (n <= 0) {
+      return; // 连接出错时recv()会发现
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+// extra是附加的头，每行以\r\n结尾
+static void reply(int fd, int code, const char *reason, const char *cseq,
+                  const char *extra, const char *body) {
+  int n = snprintf(s_reply, sizeof(s_reply),
+                   "RTSP/1.0 %d %s\r\nCSeq: %s\r\nServer: esp32-camera\r\n%s",
+                   code, reason, cseq, extra ? extra : "");
+  if (body && n < (int)sizeof(s_reply)) {
+    n += snprintf(s_reply + n, sizeof(s_reply) - n,
+                  "Content-Length: %u\r\n\r\n%s", (unsigned int)strlen(body),
+                  body);
+  } else if (n < (int)sizeof(s_reply)) {
+    n += snprintf(s_reply + n, sizeof(s_reply) - n, "\r\n");
+  }
+  if (n >= (int)sizeof(s_reply)) {
+    ESP_LOGE(TAG, "Reply too long");
+    return;
+  }
+  send_all(fd, s_reply, n);
+}
+
+static rtsp_session_t *find_session(const char *req) {
+  char value[32];
+  if (!find_header(req, "Session", value, sizeof(value))) {
+    return NULL;
+  }
+  uint32_t id = strtoul(value, NULL, 16); // 后面可能还有;timeout=
+  for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+    if (s_sessions[i].active && s_sessions[i].id == id) {
+      return &s_sessions[i];
+    }
+  }
+  return NULL;
+}
+
+static void end_session(rtsp_session_t *s, const char *why) {
+  ESP_LOGI(TAG, "Session %08X ended: %s", (unsigned int)s->id, why);
+  stream_hub_detach(s->rtp_fd);
+  close(s->rtp_fd);
+  close(s->rtcp_fd);
+  memset(s, 0, sizeof(*s));
+}
+
+static int udp_socket(uint16_t port, const struct sockaddr_in *peer,
+                      uint16_t peer_port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd < 0) {
+    return -1;
+  }
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(port),
+      .sin_addr.s_addr = htonl(INADDR_ANY),
+  };
+  struct sockaddr_in to = *peer;
+  to.sin_port = htons(peer_port);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      connect(fd, (struct sockaddr *)&to, sizeof(to)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// 会话的RTP时间戳，和stream_hub给帧打的时间戳用同一个换算
+static uint32_t rtp_time(const rtsp_session_t *s, int64_t now_us) {
+  return s->rtp.timestamp + (uint32_t)((now_us - s->rtp.base_us) * 9 / 100);
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+  return p + 4;
+}
+
+// 会话在stream_hub里的发送计数；hub已经放弃了这个客户端时返回false
+static bool session_stats(const rtsp_session_t *s,
+                          stream_client_stats_t *out) {
+  stream_client_stats_t clients[STREAM_HUB_MAX_CLIENTS];
+  int count = stream_hub_get_stats(clients, STREAM_HUB_MAX_CLIENTS);
+  for (int i = 0; i < count && i < STREAM_HUB_MAX_CLIENTS; i++) {
+    if (clients[i].fd == s->rtp_fd && clients[i].type == STREAM_CLIENT_RTP) {
+      *out = clients[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+// RTCP SR + SDES CNAME。Returns false when the hub no longer has the client.
+static bool send_report(rtsp_session_t *s) {
+  stream_client_stats_t stats;
+  if (!session_stats(s, &stats)) {
+    return false;
+  }
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  int64_t now = esp_timer_get_time();
+  uint8_t packet[28 + 24];
+  uint8_t *p = packet;
+  *p++ = 0x80; // V=2, no reception report blocks
+  *p++ = 200;  // SR
+  *p++ = 0;
+  *p++ = 6; // length in 32 bit words - 1
+  p = put32(p, s->rtp.ssrc);
+  p = put32(p, tv.tv_sec + NTP_OFFSET);
+  p = put32(p, (uint32_t)(((uint64_t)tv.tv_usec << 32) / 1000000));
+  p = put32(p, rtp_time(s, now));
+  p = put32(p, stats.packets);
+  p = put32(p, (uint32_t)stats.bytes);
+
+  static const char cname[] = "esp32-camera";
+  uint8_t *sdes = p;
+  *p++ = 0x81; // V=2, one chunk
+  *p++ = 202;  // SDES
+  p += 2;      // length, below
+  p = put32(p, s->rtp.ssrc);
+  *p++ = 1; // CNAME
+  *p++ = sizeof(cname) - 1;
+  memcpy(p, cname, sizeof(cname) - 1);
+  p += sizeof(cname) - 1;
+  do {
+    *p++ = 0; // end of items, padded to 32 bits
+  } while ((p - sdes) % 4);
+  size_t words = (p - sdes) / 4 - 1;
+  sdes[2] = words >> 8;
+  sdes[3] = words & 0xFF;
+
+  send(s->rtcp_fd, packet, p - packet, MSG_DONTWAIT);
+  return true;
+}
+
+// 一路视频；a=control是相对Content-Base的
+static void handle_describe(int fd, const char *cseq, const char *url) {
+  struct sockaddr_in local;
+  socklen_t len = sizeof(local);
+  getsockname(fd, (struct sockaddr *)&local, &len);
+  char ip[16];
+  inet_ntop(AF_INET, &local.sin_addr, ip, sizeof(ip));
+
+  char sdp[256];
+  snprintf(sdp, sizeof(sdp),
+           "v=0\r\n"
+           "o=- %u 1 IN IP4 %s\r\n"
+           "s=ESP32 camera\r\n"
+           "c=IN IP4 0.0.0.0\r\n"
+           "t=0 0\r\n"
+           "a=control:*\r\n"
+           "m=video 0 RTP/AVP %d\r\n"
+           "a=rtpmap:%d JPEG/%d\r\n"
+           "a=control:track1\r\n",
+           (unsigned int)esp_random(), ip, RTP_JPEG_PAYLOAD_TYPE,
+           RTP_JPEG_PAYLOAD_TYPE, RTP_JPEG_CLOCK_RATE);
+  char extra[RTSP_URL_MAX + 64];
+  snprintf(extra, sizeof(extra),
+           "Content-Type: application/sdp\r\nContent-Base: %s%s\r\n", url,
+           url[strlen(url) - 1] == '/' ? "" : "/");
+  reply(fd, 200, "OK", cseq, extra, sdp);
+}
+
+static void handle_setup(int fd, const char *cseq, const char *req) {
+  char transport[128];
+  if (!find_header(req, "Transport", transport, sizeof(transport))) {
+    reply(fd, 400, "Bad Request", cseq, NULL, NULL);
+    return;
+  }
+  const char *ports = strstr(transport, "client_port=");
+  if (strstr(transport, "RTP/AVP") != transport ||
+      strstr(transport, "/TCP") || strstr(transport, "interleaved") ||
+      strstr(transport, "multicast") || !ports) {
+    reply(fd, 461, "Unsupported Transport", cseq, NULL, NULL);
+    return;
+  }
+  int client_port = atoi(ports + strlen("client_port="));
+  if (client_port <= 0 || client_port >= 65535) {
+    reply(fd, 461, "Unsupported Transport", cseq, NULL, NULL);
+    return;
+  }
+
+  // 同一个会话再次SETUP（比如换了端口）就重新建socket
+  rtsp_session_t *s = find_session(req);
+  if (s) {
+    end_session(s, "setup again");
+  }
+  int slot = -1;
+  for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+    if (!s_sessions[i].active) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    reply(fd, 453, "Not Enough Bandwidth", cseq, NULL, NULL);
+    return;
+  }
+  s = &s_sessions[slot];
+
+  struct sockaddr_in peer;
+  socklen_t len = sizeof(peer);
+  getpeername(fd, (struct sockaddr *)&peer, &len);
+  uint16_t server_port = RTSP_RTP_PORT + 2 * slot;
+  s->rtp_fd = udp_socket(server_port, &peer, client_port);
+  s->rtcp_fd = udp_socket(server_port + 1, &peer, client_port + 1);
+  if (s->rtp_fd < 0 || s->rtcp_fd < 0) {
+    ESP_LOGE(TAG, "UDP socket setup failed");
+    if (s->rtp_fd >= 0) {
+      close(s->rtp_fd);
+    }
+    if (s->rtcp_fd >= 0) {
+      close(s->rtcp_fd);
+    }
+    reply(fd, 500, "Internal Server Error", cseq, NULL, NULL);
+    return;
+  }
+  s->active = true;
+  s->id = esp_random();
+  s->rtp.ssrc = esp_random();
+  s->rtp.seq = esp_random() & 0xFFFF;
+  s->rtp.timestamp = esp_random();
+  s->last_seen_us = esp_timer_get_time();
+
+  char extra[192];
+  snprintf(extra, sizeof(extra),
+           "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d;"
+           "ssrc=%08X\r\nSession: %08X;timeout=%d\r\n",
+           client_port, client_port + 1, server_port, server_port + 1,
+           (unsigned int)s->rtp.ssrc, (unsigned int)s->id,
+           RTSP_SESSION_TIMEOUT_S);
+  reply(fd, 200, "OK", cseq, extra, NULL);
+  ESP_LOGI(TAG, "Session %08X: RTP to port %d", (unsigned int)s->id,
+           client_port);
+}
+
+// rtsp://<ip>/stream?layer=low 选低分辨率层；客户端会在后面接上/track1
+static stream_layer_t url_layer(const char *url) {
+  const char *query = strstr(url, "layer=");
+  if (!query) {
+    return STREAM_LAYER_FULL;
+  }
+  char name[8];
+  size_t len = strcspn(query + strlen("layer="), "/&");
+  if (len >= sizeof(name)) {
+    return STREAM_LAYER_FULL;
+  }
+  memcpy(name, query + strlen("layer="), len);
+  name[len] = '\0';
+  int layer = stream_hub_layer_from_name(name);
+  return layer < 0 ? STREAM_LAYER_FULL : (stream_layer_t)layer;
+}
+
+static void handle_play(int fd, const char *cseq, const char *url,
+                        rtsp_session_t *s) {
+  if (!s->playing && stream_hub_set_paused(s->rtp_fd, false) != ESP_OK) {
+    // 第一次PLAY：从现在开始算RTP时间戳，序号接着SETUP时选的
+    s->rtp.base_us = esp_timer_get_time();
+    if (stream_hub_attach_rtp(s->rtp_fd, &s->rtp) != ESP_OK) {
+      reply(fd, 453, "Not Enough Bandwidth", cseq, NULL, NULL);
+      return;
+    }
+  }
+  stream_hub_set_layer(s->rtp_fd, url_layer(url));
+  s->playing = true;
+  int64_t now = esp_timer_get_time();
+  s->next_report_us = now + RTSP_RTCP_INTERVAL_MS * 1000LL;
+
+  // 下一个包的序号，和不晚于下一帧的RTP时间戳（PAUSE以后也对）
+  stream_client_stats_t stats = {0};
+  session_stats(s, &stats);
+  size_t n = strlen(url);
+  bool track = n >= 6 && strcmp(url + n - 6, "track1") == 0;
+  char extra[RTSP_URL_MAX + 96];
+  snprintf(extra, sizeof(extra),
+           "Range: npt=0.000-\r\nSession: %08X\r\n"
+           "RTP-Info: url=%s%s;seq=%u;rtptime=%u\r\n",
+           (unsigned int)s->id, url,
+           track ? "" : (url[n - 1] == '/' ? "track1" : "/track1"),
+           (uint16_t)(s->rtp.seq + stats.packets),
+           (unsigned int)rtp_time(s, now));
+  reply(fd, 200, "OK", cseq, extra, NULL);
+}
+
+static void handle_request(int fd, const char *req) {
+  char method[16], url[RTSP_URL_MAX], cseq[16];
+  if (sscanf(req, "%15s %127s RTSP/1.0", method, url) != 2 ||
+      !find_header(req, "CSeq", cseq, sizeof(cseq))) {
+    reply(fd, 400, "Bad Request", "0", NULL, NULL);
+    return;
+  }
+  ESP_LOGD(TAG, "%s %s", method, url);
+
+  rtsp_session_t *s = find_session(req);
+  if (s) {
+    s->last_seen_us = esp_timer_get_time();
+  }
+  char session[32];
+  snprintf(session, sizeof(session), "Session: %08X\r\n",
+           s ? (unsigned int)s->id : 0);
+
+  if (strcmp(method, "OPTIONS") == 0) {
+    reply(fd, 200, "OK", cseq, _RTSP_PUBLIC, NULL);
+  } else if (strcmp(method, "DESCRIBE") == 0) {
+    handle_describe(fd, cseq, url);
+  } else if (strcmp(method, "SETUP") == 0) {
+    handle_setup(fd, cseq, req);
+  } else if (strcmp(method, "PLAY") != 0 && strcmp(method, "PAUSE") != 0 &&
+             strcmp(method, "TEARDOWN") != 0 &&
+             strcmp(method, "GET_PARAMETER") != 0 &&
+             strcmp(method, "SET_PARAMETER") != 0) {
+    reply(fd, 501, "Not Implemented", cseq, _RTSP_PUBLIC, NULL);
+  } else if (!s && strstr(method, "_PARAMETER")) {
+    reply(fd, 200, "OK", cseq, NULL, NULL); // 没有会话时当作保活
+  } else if (!s) {
+    reply(fd, 454, "Session Not Found", cseq, NULL, NULL);
+  } else if (strcmp(method, "PLAY") == 0) {
+    handle_play(fd, cseq, url, s);
+  } else if (strcmp(method, "PAUSE") == 0) {
+    stream_hub_set_paused(s->rtp_fd, true);
+    s->playing = false;
+    reply(fd, 200, "OK", cseq, session, NULL);
+  } else if (strcmp(method, "TEARDOWN") == 0) {
+    end_session(s, "teardown");
+    reply(fd, 200, "OK", cseq, NULL, NULL);
+  } else {
+    reply(fd, 200, "OK", cseq, session, NULL); // GET/SET_PARAMETER：保活
+  }
+}
+
+// 处理缓冲区里完整的请求；返回false表示连接要关掉
+static bool handle_input(rtsp_conn_t *conn) {
+  while (true) {
+    char *end = strstr(conn->buf, "\r\n\r\n");
+    if (!end) {
+      return conn->len < sizeof(conn->buf) - 1; // 请求头太长
+    }
+    char length[16];
+    size_t head = end + 4 - conn->buf;
+    size_t body = 0;
+    end[2] = '\0'; // 只看请求头
+    if (find_header(conn->buf, "Content-Length", length, sizeof(length))) {
+      body = strtoul(length, NULL, 10);
+    }
+    if (head + body >= sizeof(conn->buf)) {
+      return false;
+    }
+    if (head + body > conn->len) {
+      end[2] = '\r';
+      return true; // 请求体还没收完
+    }
+    handle_request(conn->fd, conn->buf);
+    conn->len -= head + body;
+    memmove(conn->buf, conn->buf + head + body, conn->len);
+    conn->buf[conn->len] = '\0';
+  }
+}
+
+static void close_conn(rtsp_conn_t *conn) {
+  close(conn->fd);
+  conn->fd = -1;
+  conn->len = 0;
+}
+
+// 检查会话超时，按时发RTCP SR
+static void check_sessions(void) {
+  int64_t now = esp_timer_get_time();
+  for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+    rtsp_session_t *s = &s_sessions[i];
+    if (!s->active) {
+      continue;
+    }
+    if (now - s->last_seen_us > RTSP_SESSION_TIMEOUT_S * 1000000LL) {
+      end_session(s, "timeout");
+    } else if (s->playing && now >= s->next_report_us) {
+      s->next_report_us = now + RTSP_RTCP_INTERVAL_MS * 1000LL;
+      if (!send_report(s)) {
+        end_session(s, "stream failed");
+      }
+    }
+  }
+}
+
+static void rtsp_task(void *arg) {
+  while (true) {
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    int maxfd = s_listen_fd;
+    FD_SET(s_listen_fd, &rfds);
+    for (int i = 0; i < RTSP_MAX_CONNECTIONS; i++) {
+      if (s_conns[i].fd >= 0) {
+        FD_SET(s_conns[i].fd, &rfds);
+        maxfd = s_conns[i].fd > maxfd ? s_conns[i].fd : maxfd;
+      }
+    }
+    for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+      if (s_sessions[i].active) {
+        FD_SET(s_sessions[i].rtcp_fd, &rfds);
+        maxfd = s_sessions[i].rtcp_fd > maxfd ? s_sessions[i].rtcp_fd : maxfd;
+      }
+    }
+    struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+    if (select(maxfd + 1, &rfds, NULL, NULL, &tv) < 0) {
+      vTaskDelay(100 / portTICK_PERIOD_MS);
+      continue;
+    }
+
+    if (FD_ISSET(s_listen_fd, &rfds)) {
+      int fd = accept(s_listen_fd, NULL, NULL);
+      rtsp_conn_t *conn = NULL;
+      for (int i = 0; i < RTSP_MAX_CONNECTIONS && fd >= 0 && !conn; i++) {
+        if (s_conns[i].fd < 0) {
+          conn = &s_conns[i];
+        }
+      }
+      if (conn) {
+        conn->fd = fd;
+        conn->len = 0;
+        conn->buf[0] = '\0';
+      } else if (fd >= 0) {
+        ESP_LOGW(TAG, "Too many connections");
+        close(fd);
+      }
+    }
+    for (int i = 0; i < RTSP_MAX_CONNECTIONS; i++) {
+      rtsp_conn_t *conn = &s_conns[i];
+      if (conn->fd < 0 || !FD_ISSET(conn->fd, &rfds)) {
+        continue;
+      }
+      int n = recv(conn->fd, conn->buf + conn->len,
+                   sizeof(conn->buf) - 1 - conn->len, 0);
+      if (n <= 0) {
+        close_conn(conn); // 会话还在，等TEARDOWN或者超时
+        continue;
+      }
+      conn->len += n;
+      conn->buf[conn->len] = '\0';
+      if (!handle_input(conn)) {
+        close_conn(conn);
+      }
+    }
+    for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+      rtsp_session_t *s = &s_sessions[i];
+      if (s->active && FD_ISSET(s->rtcp_fd, &rfds)) {
+        // 客户端的RTCP RR，只用来说明它还活着
+        uint8_t rr[128];
+        if (recv(s->rtcp_fd, rr, sizeof(rr), MSG_DONTWAIT) > 0) {
+          s->last_seen_us = esp_timer_get_time();
+        }
+      }
+    }
+    check_sessions();
+  }
+}
+
+esp_err_t rtsp_server_start(void) {
+  if (s_listen_fd >= 0) {
+    return ESP_OK;
+  }
+  for (int i = 0; i < RTSP_MAX_CONNECTIONS; i++) {
+    s_conns[i].fd = -1;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) {
+    return ESP_FAIL;
+  }
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(RTSP_PORT),
+      .sin_addr.s_addr = htonl(INADDR_ANY),
+  };
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 2) != 0) {
+    close(fd);
+    return ESP_FAIL;
+  }
+  s_listen_fd = fd;
+  if (xTaskCreatePinnedToCore(rtsp_task, "rtsp", 4096, NULL, 4, NULL, 0) !=
+      pdPASS) {
+    close(fd);
+    s_listen_fd = -1;
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "Starting RTSP server on port: '%d'", RTSP_PORT);
+  return ESP_OK;
+}
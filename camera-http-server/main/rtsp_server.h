@@ -0,0 +1,30 @@
+#if !defined(__RTSP_SERVER__)
+#define __RTSP_SERVER__
+
+#include "esp_err.h"
+
+// RTSP服务器：给NVR、VLC、ffmpeg看的MJPEG视频流，rtsp://<ip>/stream
+//
+// Video is JPEG over RTP/UDP (RFC 2435, payload type 26) with RTCP sender
+// reports. Frames come from stream_hub like every other stream, so an RTSP
+// viewer shares capture, rate control and the motion gate with the web
+// clients and takes one of the STREAM_HUB_MAX_CLIENTS slots while playing.
+// The request path is not checked. Only unicast UDP is offered: interleaved
+// TCP gets 461 Unsupported Transport (ffmpeg: -rtsp_transport udp).
+//
+// A session outlives its TCP connection, as RTSP allows. It ends with
+// TEARDOWN, when the client has been silent (no request, no RTCP receiver
+// report) for RTSP_SESSION_TIMEOUT_S, or when stream_hub gives up on its
+// socket.
+
+#define RTSP_PORT 554
+#define RTSP_MAX_SESSIONS 2
+// 会话i的RTP端口是RTSP_RTP_PORT + 2i，RTCP端口是RTSP_RTP_PORT + 2i + 1
+#define RTSP_RTP_PORT 6970
+#define RTSP_RTCP_INTERVAL_MS 5000 // 多久发一个RTCP SR
+#define RTSP_SESSION_TIMEOUT_S 60
+#define RTSP_REQUEST_MAX 1024
+
+esp_err_t rtsp_server_start(void);
+
+#endif // __RTSP_SERVER__
@@ -0,0 +1,166 @@
+#include "snapshot.h"
+#include "camera_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "frame_source.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "img_converters.h"
+#include "mem_policy.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "snapshot"
+
+// 保护缓存和所有快照的引用计数；编码也在锁内做，同时到的请求等同一次编码
+static SemaphoreHandle_t s_lock = NULL;
+static snapshot_t *s_current = NULL;
+
+// 以下几个函数的调用者需要持有s_lock
+static void unref(snapshot_t *snap) {
+  if (snap && --snap->refs == 0) {
+    if (snap->jpeg != snap->fb.buf) {
+      free(snap->jpeg);
+    }
+    free(snap->bmp);
+    if (snap->rgb565 != snap->fb.buf) {
+      free(snap->rgb565);
+    }
+    free(snap->fb.buf);
+    free(snap);
+  }
+}
+
+static snapshot_t *lookup(void) {
+  if (s_current &&
+      esp_timer_get_time() - s_current->taken_us < SNAPSHOT_TTL_MS * 1000LL) {
+    s_current->refs++;
+    return s_current;
+  }
+  return NULL;
+}
+
+// 拷贝一份帧数据，马上把图片缓冲区还给驱动
+static snapshot_t *grab(void) {
+  snapshot_t *snap = (snapshot_t *)calloc(1, sizeof(snapshot_t));
+  if (!snap) {
+    return NULL;
+  }
+  camera_sensor_lock();
+  camera_fb_t *fb = frame_source_fb_get();
+  camera_sensor_unlock();
+  if (!fb) {
+    free(snap);
+    return NULL;
+  }
+  snap->taken_us = esp_timer_get_time();
+  snap->fb = *fb;
+  snap->fb.buf = (uint8_t *)mem_alloc(MEM_POOL_FRAME, fb->len);
+  if (snap->fb.buf) {
+    memcpy(snap->fb.buf, fb->buf, fb->len);
+  }
+  frame_source_fb_return(fb);
+  if (!snap->fb.buf) {
+    ESP_LOGE(TAG, "No memory for a %uB snapshot", (unsigned int)fb->len);
+    free(snap);
+    return NULL;
+  }
+  if (snap->fb.format == PIXFORMAT_JPEG) {
+    // 传感器输出的就是jpg，不用再编码
+    snap->jpeg = snap->fb.buf;
+    snap->jpeg_len = snap->fb.len;
+  } else if (snap->fb.format == PIXFORMAT_RGB565) {
+    snap->rgb565 = snap->fb.buf;
+  }
+  snap->refs = 1;
+  return snap;
+}
+
+esp_err_t snapshot_init(void) {
+  if (!s_lock) {
+    s_lock = xSemaphoreCreateMutex();
+  }
+  return s_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+snapshot_t *snapshot_cached(void) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  snapshot_t *snap = lookup();
+  xSemaphoreGive(s_lock);
+  return snap;
+}
+
+snapshot_t *snapshot_take(void) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  // 等锁的时候别的请求可能已经拍好了
+  snapshot_t *snap = lookup();
+  if (!snap) {
+    snap = grab();
+    if (snap) {
+      unref(s_current);
+      s_current = snap;
+      snap->refs++; // one for the cache, one for the caller
+    }
+  }
+  xSemaphoreGive(s_lock);
+  return snap;
+}
+
+void snapshot_release(snapshot_t *snap) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  unref(snap);
+  xSemaphoreGive(s_lock);
+}
+
+const uint8_t *snapshot_jpeg(snapshot_t *snap, size_t *len) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  if (!snap->jpeg &&
+      !mem_frame2jpg(&snap->fb, SNAPSHOT_JPEG_QUALITY, &snap->jpeg,
+                     &snap->jpeg_len)) {
+    snap->jpeg = NULL;
+    ESP_LOGE(TAG, "JPEG compression failed");
+  }
+  *len = snap->jpeg_len;
+  const uint8_t *jpeg = snap->jpeg;
+  xSemaphoreGive(s_lock);
+  return jpeg;
+}
+
+const uint8_t *snapshot_bmp(snapshot_t *snap, size_t *len) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  if (!snap->bmp && !frame2bmp(&snap->fb, &snap->bmp, &snap->bmp_len)) {
+    snap->bmp = NULL;
+    ESP_LOGE(TAG, "BMP Conversion failed");
+  }
+  *len = snap->bmp_len;
+  const uint8_t *bmp = snap->bmp;
+  xSemaphoreGive(s_lock);
+  return bmp;
+}
+
+const uint8_t *snapshot_rgb565(snapshot_t *snap) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  if (!snap->rgb565 && snap->fb.format == PIXFORMAT_JPEG) {
+    size_t len = snap->fb.width * snap->fb.height * 2;
+    snap->rgb565 = (uint8_t *)mem_alloc(MEM_POOL_FRAME, len);
+    if (snap->rgb565 && !jpg2rgb565(snap->fb.buf, snap->fb.len, snap->rgb565,
+                                    JPG_SCALE_NONE)) {
+      ESP_LOGE(TAG, "JPEG decode failed");
+      free(snap->rgb565);
+      snap->rgb565 = NULL;
+    }
+  }
+  const uint8_t *rgb565 = snap->rgb565;
+  xSemaphoreGive(s_lock);
+  return rgb565;
+}
+
+void snapshot_invalidate(void) {
+  if (!s_lock) {
+    return;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  unref(s_current);
+  s_current = NULL;
+  xSemaphoreGive(s_lock);
+}
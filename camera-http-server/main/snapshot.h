@@ -0,0 +1,50 @@
+#if !defined(__SNAPSHOT__)
+#define __SNAPSHOT__
+
+#include "esp_camera.h"
+#include <stdbool.h>
+
+// 快照缓存：/capture 和 /bmp 在 SNAPSHOT_TTL_MS 内的请求共用一次拍照。
+//
+// A snapshot is a copy of one frame buffer, so the driver gets its buffer back
+// right away. The JPEG and BMP encodings are made the first time a request
+// asks for them and kept with the snapshot, so back-to-back or concurrent
+// requests within the window cost one exposure and at most one encode per
+// format. Snapshots are reference counted: a request keeps its snapshot alive
+// while sending even if a newer one replaced it in the cache.
+
+#define SNAPSHOT_TTL_MS 500
+#define SNAPSHOT_JPEG_QUALITY 80
+
+typedef struct {
+  int refs; // protected by the snapshot lock
+  int64_t taken_us; // esp_timer_get_time() when the frame was grabbed
+  camera_fb_t fb;   // copy of the frame, fb.buf is owned by the snapshot
+  uint8_t *jpeg;    // lazily encoded, NULL until the first snapshot_jpeg()
+  size_t jpeg_len;
+  uint8_t *bmp;
+  size_t bmp_len;
+  uint8_t *rgb565; // decoded JPEG frame, or fb.buf if it already is RGB565
+} snapshot_t;
+
+esp_err_t snapshot_init(void);
+
+// Returns a snapshot younger than SNAPSHOT_TTL_MS without touching the
+// camera, or NULL. Release it with snapshot_release().
+snapshot_t *snapshot_cached(void);
+// Same as snapshot_cached(), but grabs a new frame when the cache is stale.
+// Returns NULL when the capture failed.
+snapshot_t *snapshot_take(void);
+void snapshot_release(snapshot_t *snap);
+
+// Encoded frame, memoized in the snapshot. NULL when encoding failed.
+const uint8_t *snapshot_jpeg(snapshot_t *snap, size_t *len);
+const uint8_t *snapshot_bmp(snapshot_t *snap, size_t *len);
+// Pixels as RGB565 in driver byte order (fb.width x fb.height), for cropping
+// and scaling. NULL for other pixel formats or when decoding failed.
+const uint8_t *snapshot_rgb565(snapshot_t *snap);
+
+// 修改了传感器设置后调用，下一个请求重新拍照
+void snapshot_invalidate(void);
+
+#endif // __SNAPSHOT__
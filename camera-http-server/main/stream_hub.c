@@ -0,0 +1,1060 @@
+#include "stream_hub.h"
+#include "camera_server.h"
+#include "clip_recorder.h"
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "face_engine.h"
+#include "frame_source.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "img_converters.h"
+#include "img_scale.h"
+#include "lwip/sockets.h"
+#include "mem_policy.h"
+#include "metrics.h"
+#include "motion_detect.h"
+#include "rate_control.h"
+#include "rtp_jpeg.h"
+#include "stream_stats.h"
+#include "ws_video.h"
+
+#define TAG "stream_hub"
+
+#define HUB_PREFIX_MAX 256
+#define HUB_TEXT_MAX 256
+// 有客户端发不动时，每隔多久检查一次其他客户端有没有新帧
+#define HUB_SELECT_TIMEOUT_US 10000
+// 包括IP和UDP头不超过以太网的MTU
+#define HUB_RTP_MAX_PACKET 1400
+
+static const char *_STREAM_PART =
+    "\r\n--" STREAM_PART_BOUNDARY "\r\n"
+    "Content-Type: image/jpeg\r\nContent-Length: %u\r\n"
+    "X-Timestamp: %d.%06d\r\n\r\n";
+
+// 延迟探测模式的part头：多了帧序号和设备上几个时刻（esp_timer，微秒），
+// 每个客户端开始发送这一帧时生成
+static const char *_STREAM_PART_PROBE =
+    "\r\n--" STREAM_PART_BOUNDARY "\r\n"
+    "Content-Type: image/jpeg\r\nContent-Length: %u\r\n"
+    "X-Timestamp: %d.%06d\r\n"
+    "X-Frame-Seq: %u\r\n"
+    "X-Capture-Us: %lld\r\n"
+    "X-Publish-Us: %lld\r\n"
+    "X-Send-Us: %lld\r\n\r\n";
+
+typedef struct {
+  int refs; // protected by s_lock
+  uint32_t seq;
+  int64_t capture_us;
+  int64_t publish_us;
+  // 第一个发送完这一帧的客户端用了多久，0表示还没有客户端发完。
+  // Written once by the send task, read by the capture task; 32 bit so the
+  // access is atomic.
+  volatile uint32_t first_done_us;
+  uint16_t width;
+  uint16_t height;
+  stream_layer_t layer;
+  uint8_t *buf;
+  size_t len;
+  size_t part_len;
+  char part[128]; // multipart boundary + part header
+} hub_frame_t;
+
+typedef struct {
+  int fd; // -1 when the slot is free
+  httpd_handle_t hd;
+  stream_client_type_t type;
+  stream_layer_t layer;
+  bool paused;
+  bool probe;
+  hub_frame_t *pending; // 深度为1的发送队列
+  hub_frame_t *sending;
+  size_t offset; // bytes of prefix + frame already written; RTP: of the scan
+  size_t prefix_len;
+  uint8_t prefix[HUB_PREFIX_MAX]; // RTP: headers of the next packet
+  size_t payload_len;             // RTP: scan bytes after the prefix
+  rtp_jpeg_frame_t jpeg;          // RTP: the frame being sent
+  rtp_jpeg_stream_t rtp;
+  uint32_t rtp_base_ts;
+  int64_t rtp_base_us;
+  size_t text_len;
+  char text[HUB_TEXT_MAX]; // framed WebSocket text messages waiting to go out
+  uint32_t sent;
+  uint32_t dropped;
+  uint64_t bytes;
+  uint32_t packets;
+  int64_t connected_us;
+} hub_client_t;
+
+static hub_client_t s_clients[STREAM_HUB_MAX_CLIENTS];
+static SemaphoreHandle_t s_lock = NULL;
+static TaskHandle_t s_capture_task = NULL;
+static TaskHandle_t s_send_task = NULL;
+static uint32_t s_seq[STREAM_LAYER_COUNT]; // 每层单独编号，断号就是丢帧
+// 每层的帧间隔(us)和帧大小，只有采集任务写，/metrics随时可以读
+static stream_stats_t s_interval_stats[STREAM_LAYER_COUNT];
+static stream_stats_t s_bytes_stats[STREAM_LAYER_COUNT];
+static int64_t s_prev_publish_us[STREAM_LAYER_COUNT];
+static volatile bool s_motion_gate = STREAM_MOTION_GATE;
+// 新客户端加入或恢复播放时不等保活间隔，马上发一帧
+static volatile bool s_motion_resync = false;
+static motion_detect_t s_motion;
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+static volatile bool s_face_detect = false;
+static int64_t s_face_submit_us = 0;
+static int64_t s_face_result_us = 0; // 已经触发过录像的检测结果
+#endif
+static uint8_t *s_motion_scratch = NULL; // JPEG传感器：1/8缩小后的RGB565
+static size_t s_motion_scratch_len = 0;
+static uint8_t *s_low_buf = NULL; // 低分辨率层缩小后的RGB565，等待编码
+static size_t s_low_buf_len = 0;
+static uint16_t s_low_width = 0;
+static uint16_t s_low_height = 0;
+
+// 以下几个函数的调用者需要持有s_lock
+static void frame_unref(hub_frame_t *frame) {
+  if (frame && --frame->refs == 0) {
+    free(frame->buf);
+    free(frame);
+  }
+}
+
+static hub_client_t *find_client(int fd) {
+  for (int i = 0; i < STREAM_HUB_MAX_CLIENTS; i++) {
+    if (s_clients[i].fd == fd) {
+      return &s_clients[i];
+    }
+  }
+  return NULL;
+}
+
+// layer为STREAM_LAYER_COUNT时统计所有层
+static int active_client_count(stream_layer_t layer) {
+  int count = 0;
+  for (int i = 0; i < STREAM_HUB_MAX_CLIENTS; i++) {
+    if (s_clients[i].fd >= 0 && !s_clients[i].paused &&
+        (layer == STREAM_LAYER_COUNT || s_clients[i].layer == layer)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+static void release_client(hub_client_t *c) {
+  int64_t secs = (esp_timer_get_time() - c->connected_us) / 1000000;
+  ESP_LOGI(TAG, "Client %d left: %u sent, %u dropped, %llukB in %llds",
+           c->fd, c->sent, c->dropped, c->bytes / 1024, secs);
+  frame_unref(c->pending);
+  frame_unref(c->sending);
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+}
+
+// 把这一帧和参考帧比较，返回变化的块数；没法检测时返回-1。
+// Runs on the raw frame before it is encoded, so static frames cost a sparse
+// luma pass instead of a JPEG encode and a send.
+static int motion_check(camera_fb_t *fb) {
+  if (fb->format == PIXFORMAT_RGB565) {
+    return motion_detect_rgb565(&s_motion, fb->buf, fb->width, fb->height);
+  }
+  if (fb->format != PIXFORMAT_JPEG) {
+    return -1;
+  }
+  // 只解码1/8大小，足够用来比较块的亮度
+  int w = fb->width / 8;
+  int h = fb->height / 8;
+  size_t len = (size_t)w * h * 2;
+  if (len > s_motion_scratch_len) {
+    free(s_motion_scratch);
+    s_motion_scratch = (uint8_t *)mem_alloc(MEM_POOL_INTERNAL, len);
+    s_motion_scratch_len = s_motion_scratch ? len : 0;
+  }
+  if (!s_motion_scratch ||
+      !jpg2rgb565(fb->buf, fb->len, s_motion_scratch, JPG_SCALE_8X)) {
+    return -1;
+  }
+  return motion_detect_rgb565(&s_motion, s_motion_scratch, w, h);
+}
+
+// 判断这一帧要不要发出去：画面有变化，或者离上一次发送已经超过保活间隔。
+// changed是motion_check()的结果。
+static bool motion_gate_pass(int changed, int64_t last_publish_us) {
+  if (!s_motion_gate || changed < 0) {
+    return true; // 门控关闭，或者画面太小没法分块
+  }
+  int64_t now = esp_timer_get_time();
+  return motion_detect_moved(&s_motion) || s_motion_resync ||
+         now - last_publish_us >= STREAM_KEEPALIVE_MS * 1000LL;
+}
+
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+// 按STREAM_FACE_FPS把帧的拷贝交给推理任务（另一个核），不等结果；
+// 把最近一次的检测结果画在这一帧上，视频流的帧率不受检测速度影响。
+static void face_overlay(camera_fb_t *fb) {
+  if (!s_face_detect || fb->format != PIXFORMAT_RGB565) {
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  if (now - s_face_submit_us >= 1000000 / STREAM_FACE_FPS) {
+    uint8_t *copy = (uint8_t *)mem_alloc(MEM_POOL_FRAME, fb->len);
+    if (copy) {
+      memcpy(copy, fb->buf, fb->len);
+      if (face_engine_submit(copy, fb->width, fb->height, PIXFORMAT_RGB565) ==
+          ESP_OK) {
+        s_face_submit_us = now;
+      } else {
+        free(copy); // 上一帧还没检测完
+      }
+    }
+  }
+
+  face_result_t result;
+  int64_t result_us;
+  bool fresh = face_engine_latest(&result, &result_us);
+  if (fresh && result.count > 0 && result_us != s_face_result_us) {
+    s_face_result_us = result_us;
+    clip_recorder_trigger(CLIP_TRIGGER_FACE);
+  }
+  if (!fresh || result.count == 0 ||
+      now - result_us > STREAM_FACE_MAX_AGE_MS * 1000LL ||
+      result.width != fb->width || result.height != fb->height) {
+    return;
+  }
+  fb_data_t rfb = {
+      .width = fb->width,
+      .height = fb->height,
+      .bytes_per_pixel = 2,
+      .format = FB_RGB565,
+      .data = fb->buf,
+  };
+  face_engine_draw(&rfb, &result);
+}
+#endif
+
+// 编码，尽快归还图片缓冲区
+static hub_frame_t *capture_frame(camera_fb_t *fb, int quality) {
+  hub_frame_t *frame = (hub_frame_t *)calloc(1, sizeof(hub_frame_t));
+  if (!frame) {
+    frame_source_fb_return(fb);
+    return NULL;
+  }
+  frame->capture_us =
+      (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+  frame->width = fb->width;
+  frame->height = fb->height;
+  frame->layer = STREAM_LAYER_FULL;
+
+  bool ok;
+  if (fb->format == PIXFORMAT_JPEG) {
+    // 传感器输出的就是jpg，拷贝一份，图片缓冲区马上还给驱动
+    frame->buf = (uint8_t *)mem_alloc(MEM_POOL_FRAME, fb->len);
+    ok = frame->buf != NULL;
+    if (ok) {
+      memcpy(frame->buf, fb->buf, fb->len);
+      frame->len = fb->len;
+    }
+  } else {
+    ok = mem_frame2jpg(fb, quality, &frame->buf, &frame->len);
+  }
+  frame->part_len = snprintf(frame->part, sizeof(frame->part), _STREAM_PART,
+                             frame->len, (int)fb->timestamp.tv_sec,
+                             (int)fb->timestamp.tv_usec);
+  frame_source_fb_return(fb);
+
+  if (!ok) {
+    ESP_LOGE(TAG, "JPEG compression failed");
+    free(frame->buf);
+    free(frame);
+    return NULL;
+  }
+  frame->refs = 1;
+  return frame;
+}
+
+// 低分辨率层：把原始帧缩小到s_low_buf。RGB565帧用img_scale_rgb565()，
+// JPEG帧直接按1/2、1/4或1/8解码。图片缓冲区归还之前调用
+static bool low_scale(camera_fb_t *fb) {
+  int target = fb->width > STREAM_LOW_WIDTH ? STREAM_LOW_WIDTH : fb->width / 2;
+  int shift = 0;
+  int width, height;
+  if (fb->format == PIXFORMAT_JPEG) {
+    while (shift < 3 && (fb->width >> shift) > target) {
+      shift++;
+    }
+    width = fb->width >> shift;
+    height = fb->height >> shift;
+  } else if (fb->format == PIXFORMAT_RGB565) {
+    width = target;
+    height = (fb->height * width + fb->width / 2) / fb->width;
+  } else {
+    return false;
+  }
+  if (width < 8 || height < 8) {
+    return false;
+  }
+  size_t len = (size_t)width * height * 2;
+  if (len > s_low_buf_len) {
+    free(s_low_buf);
+    s_low_buf = (uint8_t *)mem_alloc(MEM_POOL_FRAME, len);
+    s_low_buf_len = s_low_buf ? len : 0;
+  }
+  if (!s_low_buf) {
+    return false;
+  }
+  s_low_width = width;
+  s_low_height = height;
+  if (fb->format == PIXFORMAT_JPEG) {
+    // JPG_SCALE_NONE..JPG_SCALE_8X依次是1、1/2、1/4、1/8
+    return jpg2rgb565(fb->buf, fb->len, s_low_buf, (jpg_scale_t)shift);
+  }
+  img_rect_t roi = {0, 0, fb->width, fb->height};
+  return img_scale_rgb565(fb->buf, fb->width, fb->height, &roi, s_low_buf,
+                          width, height) == 0;
+}
+
+// 编码low_scale()缩小好的画面，不占用图片缓冲区
+static hub_frame_t *low_frame(int64_t capture_us, int quality) {
+  hub_frame_t *frame = (hub_frame_t *)calloc(1, sizeof(hub_frame_t));
+  if (!frame) {
+    return NULL;
+  }
+  if (!mem_fmt2jpg(s_low_buf, (size_t)s_low_width * s_low_height * 2,
+                   s_low_width, s_low_height, PIXFORMAT_RGB565, quality,
+                   &frame->buf, &frame->len)) {
+    ESP_LOGE(TAG, "Low layer JPEG compression failed");
+    free(frame);
+    return NULL;
+  }
+  frame->capture_us = capture_us;
+  frame->width = s_low_width;
+  frame->height = s_low_height;
+  frame->layer = STREAM_LAYER_LOW;
+  frame->part_len = snprintf(frame->part, sizeof(frame->part), _STREAM_PART,
+                             frame->len, (int)(capture_us / 1000000),
+                             (int)(capture_us % 1000000));
+  frame->refs = 1;
+  return frame;
+}
+
+// 把新帧放进每个客户端的槽位，槽位里还没发出去的旧帧直接丢弃
+static void publish(hub_frame_t *frame) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  frame->seq = s_seq[frame->layer]++;
+  frame->publish_us = esp_timer_get_time();
+  for (int i = 0; i < STREAM_HUB_MAX_CLIENTS; i++) {
+    hub_client_t *c = &s_clients[i];
+    if (c->fd < 0 || c->paused || c->layer != frame->layer) {
+      continue;
+    }
+    if (c->pending) {
+      frame_unref(c->pending);
+      c->dropped++;
+      metrics_inc(METRIC_FRAMES_DROPPED);
+    }
+    frame->refs++;
+    c->pending = frame;
+  }
+  xSemaphoreGive(s_lock);
+  metrics_inc(METRIC_FRAMES_PUBLISHED);
+  xTaskNotifyGive(s_send_task);
+
+  int64_t *prev_us = &s_prev_publish_us[frame->layer];
+  if (*prev_us) {
+    stream_stats_add(&s_interval_stats[frame->layer],
+                     (uint32_t)(frame->publish_us - *prev_us),
+                     frame->publish_us);
+  }
+  *prev_us = frame->publish_us;
+  stream_stats_add(&s_bytes_stats[frame->layer], frame->len,
+                   frame->publish_us);
+}
+
+static void capture_task(void *arg) {
+  // 回放录好的帧时没有传感器，码率控制只调编码质量
+  sensor_t *s = frame_source_sensor_get();
+  rate_control_t rc;
+  framesize_t base_size = FRAMESIZE_INVALID;
+  int base_quality = 0;
+  int sensor_quality = -1;
+  bool streaming = false;
+  hub_frame_t *prev = NULL; // 上一个发布的原始分辨率帧，码率控制用
+  int64_t last_publish_us = 0;
+  int64_t low_publish_us = 0;
+  uint32_t still = 0; // 两次发送之间被门控跳过的帧数
+
+  while (true) {
+    int clients = active_client_count(STREAM_LAYER_COUNT);
+    int low_clients = active_client_count(STREAM_LAYER_LOW);
+    if (clients == 0 && streaming) {
+      // 所有客户端都走了，恢复用户设置的分辨率和质量
+      camera_sensor_lock();
+      if (s && rc.size_step != 0) {
+        s->set_framesize(s, base_size);
+      }
+      if (s && sensor_quality >= 0) {
+        s->set_quality(s, base_quality);
+      }
+      camera_sensor_unlock();
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      frame_unref(prev);
+      xSemaphoreGive(s_lock);
+      prev = NULL;
+      streaming = false;
+      s_motion.has_reference = false;
+      ESP_LOGI(TAG, "Stream stopped");
+    }
+    if (clients == low_clients && prev) {
+      // 原始分辨率层没人看了，再有人来时码率控制从头比较
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      frame_unref(prev);
+      xSemaphoreGive(s_lock);
+      prev = NULL;
+    }
+    // 没有人看视频流时，录像打开的话还要按CLIP_FPS拍照
+    bool recorder = clip_recorder_enabled();
+    if (clients == 0 && !recorder) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+
+    if (clients > 0 && !streaming) {
+      base_size = s ? s->status.framesize : STREAM_MIN_FRAMESIZE;
+      base_quality = s ? s->status.quality : 0;
+      sensor_quality = -1;
+      int max_size_step = (int)base_size - STREAM_MIN_FRAMESIZE;
+      if (max_size_step > STREAM_MAX_SIZE_STEP) {
+        max_size_step = STREAM_MAX_SIZE_STEP;
+      }
+      rate_control_init(&rc, STREAM_TARGET_FPS, STREAM_MIN_QUALITY,
+                        STREAM_MAX_QUALITY, max_size_step);
+      last_publish_us = 0;
+      low_publish_us = 0;
+      // 停播期间不算帧间隔
+      memset(s_prev_publish_us, 0, sizeof(s_prev_publish_us));
+      streaming = true;
+    }
+
+    int64_t wait_start = esp_timer_get_time();
+    camera_sensor_lock();
+    // JPEG传感器由传感器自己压缩，质量通过寄存器设置
+    if (clients > 0 && s && s->pixformat == PIXFORMAT_JPEG &&
+        sensor_quality != rate_control_sensor_quality(rc.quality)) {
+      sensor_quality = rate_control_sensor_quality(rc.quality);
+      s->set_quality(s, sensor_quality);
+    }
+    camera_fb_t *fb = frame_source_fb_get();
+    camera_sensor_unlock();
+    int64_t convert_start = esp_timer_get_time();
+    if (!fb) {
+      metrics_inc(METRIC_CAPTURE_ERRORS);
+      ESP_LOGE(TAG, "Camera capture failed");
+      vTaskDelay(100 / portTICK_PERIOD_MS);
+      continue;
+    }
+    metrics_stage(METRIC_SENSOR_WAIT, convert_start - wait_start);
+    metrics_inc(METRIC_FRAMES_CAPTURED);
+
+    int changed = -1;
+    if (s_motion_gate || recorder) {
+      bool had_reference = s_motion.has_reference;
+      changed = motion_check(fb);
+      if (had_reference && changed >= 0 && motion_detect_moved(&s_motion)) {
+        clip_recorder_trigger(CLIP_TRIGGER_MOTION);
+      }
+    }
+    bool pass = clients > 0 && motion_gate_pass(changed, last_publish_us);
+    if (changed >= 0 && (pass || !s_motion_gate || clients == 0)) {
+      // 门控只在发送时更新参考帧；只为录像检测时和上一帧比较
+      motion_detect_accept(&s_motion);
+    }
+    if (pass) {
+      s_motion_resync = false;
+    }
+    int64_t capture_us =
+        (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    // 每一层分别决定要不要这一帧：低分辨率层按STREAM_LOW_FPS降低占空比，
+    // 没有人看原始分辨率时也不编码它（除非录像要）
+    bool full = pass && clients > low_clients;
+    bool low = pass && low_clients > 0 &&
+               capture_us - low_publish_us >= 1000000 / STREAM_LOW_FPS;
+    bool record = clip_recorder_wants(capture_us);
+    if (!full && !low && !record) {
+      frame_source_fb_return(fb);
+      if (clients > 0 && !pass) {
+        still++;
+        metrics_inc(METRIC_FRAMES_STILL);
+      }
+      if (clients == 0) {
+        vTaskDelay(1000 / CLIP_FPS / portTICK_PERIOD_MS);
+      }
+      continue;
+    }
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+    face_overlay(fb);
+#endif
+    // 低分辨率层先缩小到自己的缓冲区，编码放到图片缓冲区归还以后
+    low = low && low_scale(fb);
+    int64_t encode_start = esp_timer_get_time();
+    metrics_stage(METRIC_CONVERT, encode_start - convert_start);
+    hub_frame_t *frame = NULL;
+    if (full || record) {
+      frame = capture_frame(fb, clients > 0 ? rc.quality : STREAM_MAX_QUALITY);
+      if (!frame) {
+        metrics_inc(METRIC_CAPTURE_ERRORS);
+        vTaskDelay(100 / portTICK_PERIOD_MS);
+        continue;
+      }
+      metrics_stage(METRIC_ENCODE, esp_timer_get_time() - encode_start);
+      metrics_frame_size(frame->len);
+    } else {
+      frame_source_fb_return(fb);
+    }
+
+    if (low) {
+      hub_frame_t *small = low_frame(capture_us, rc.quality);
+      if (small) {
+        publish(small);
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        frame_unref(small);
+        xSemaphoreGive(s_lock);
+        low_publish_us = capture_us;
+        last_publish_us = esp_timer_get_time();
+      }
+    }
+    if (!frame) {
+      still = 0; // 只有低分辨率层的客户端
+      continue;
+    }
+    if (full) {
+      publish(frame);
+      last_publish_us = frame->publish_us;
+    }
+    // 发布以后帧数据不会再改，录像直接从里面拷贝
+    clip_recorder_push(frame->buf, frame->len, frame->width, frame->height,
+                       frame->capture_us);
+
+    if (!full) {
+      // 只是给录像用的帧
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      frame_unref(frame);
+      xSemaphoreGive(s_lock);
+      if (clients == 0) {
+        vTaskDelay(1000 / CLIP_FPS / portTICK_PERIOD_MS);
+      }
+      continue;
+    }
+
+    if (prev) {
+      // 码率控制只看最快的那个客户端：它在一个帧周期内发完上一帧就不算拥塞，
+      // 慢的客户端只会丢自己的帧，不会拉低所有人的画质
+      rate_sample_t sample = {
+          .frame_us = frame->publish_us - prev->publish_us,
+          .bytes = prev->len,
+      };
+      if (prev->first_done_us) {
+        sample.send_us = prev->first_done_us;
+      } else {
+        sample.send_us = frame->publish_us - prev->publish_us;
+        sample.backpressure = sample.send_us > 2 * rc.budget_us;
+      }
+      if (rate_control_update(&rc, &sample)) {
+        ESP_LOGI(TAG, "Stream frame size step %d", rc.size_step);
+        camera_sensor_lock();
+        s->set_framesize(s, (framesize_t)(base_size - rc.size_step));
+        camera_sensor_unlock();
+      }
+
+      int64_t frame_time = sample.frame_us / 1000;
+      float avg_frame_time =
+          stream_stats_ewma(&s_interval_stats[STREAM_LAYER_FULL]) / 1000;
+      ESP_LOGI(TAG,
+               "MJPG: %uB %ums (%.1ffps), AVG: %.0fms (%.1ffps), Q: %d, "
+               "still: %u, motion: %d",
+               (unsigned int)(frame->len), (unsigned int)frame_time,
+               1000.0 / (unsigned int)frame_time, avg_frame_time,
+               1000.0 / avg_frame_time, rc.quality, still,
+               s_motion.changed_blocks);
+
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      frame_unref(prev);
+      xSemaphoreGive(s_lock);
+    }
+    prev = frame;
+    still = 0;
+  }
+}
+
+// websocket服务端发给浏览器的帧不加掩码，帧头最长10字节
+#define WS_HEADER_MAX 10
+static size_t ws_frame_header(uint8_t *out, uint8_t opcode, size_t len) {
+  size_t n = 0;
+  out[n++] = 0x80 | opcode; // FIN
+  if (len < 126) {
+    out[n++] = len;
+  } else if (len < 65536) {
+    out[n++] = 126;
+    out[n++] = len >> 8;
+    out[n++] = len & 0xFF;
+  } else {
+    out[n++] = 127;
+    for (int i = 7; i >= 0; i--) {
+      out[n++] = (uint64_t)len >> (i * 8);
+    }
+  }
+  return n;
+}
+
+static const char *client_type_name(stream_client_type_t type) {
+  switch (type) {
+  case STREAM_CLIENT_WS:
+    return "ws";
+  case STREAM_CLIENT_RTP:
+    return "rtp";
+  default:
+    return "multipart";
+  }
+}
+
+static void start_frame(hub_client_t *c) {
+  hub_frame_t *frame = c->pending;
+  c->pending = NULL;
+  c->sending = frame;
+  c->offset = 0;
+  if (c->type == STREAM_CLIENT_RTP) {
+    // 包头在pump_rtp()里逐个生成，payload直接指向帧里的扫描数据
+    c->prefix_len = 0;
+    c->rtp.timestamp =
+        c->rtp_base_ts +
+        (uint32_t)((frame->capture_us - c->rtp_base_us) * 9 / 100);
+    if (rtp_jpeg_parse(frame->buf, frame->len, &c->jpeg) != 0) {
+      c->jpeg.scan_len = 0; // pump_rtp() drops it
+    }
+    return;
+  }
+  if (c->type == STREAM_CLIENT_MULTIPART && c->probe) {
+    c->prefix_len = snprintf(
+        (char *)c->prefix, sizeof(c->prefix), _STREAM_PART_PROBE, frame->len,
+        (int)(frame->capture_us / 1000000), (int)(frame->capture_us % 1000000),
+        frame->seq, frame->capture_us, frame->publish_us, esp_timer_get_time());
+    return;
+  }
+  if (c->type == STREAM_CLIENT_MULTIPART) {
+    memcpy(c->prefix, frame->part, frame->part_len);
+    c->prefix_len = frame->part_len;
+    return;
+  }
+  ws_video_header_t header = {
+      .magic = WS_VIDEO_MAGIC,
+      .header_len = sizeof(ws_video_header_t),
+      .version = WS_VIDEO_VERSION,
+      .seq = frame->seq,
+      .jpeg_len = frame->len,
+      .capture_us = frame->capture_us,
+      .send_us = esp_timer_get_time(),
+  };
+  c->prefix_len = ws_frame_header(c->prefix, HTTPD_WS_TYPE_BINARY,
+                                  sizeof(header) + frame->len);
+  memcpy(c->prefix + c->prefix_len, &header, sizeof(header));
+  c->prefix_len += sizeof(header);
+}
+
+// 非阻塞写，返回写出的字节数；socket写满返回0，出错返回-1
+static int write_some(int fd, const void *data, size_t len) {
+  int n = send(fd, data, len, MSG_DONTWAIT);
+  if (n < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+  return n;
+}
+
+static void frame_done(hub_client_t *c, hub_frame_t *frame) {
+  if (!frame->first_done_us) {
+    uint32_t took = esp_timer_get_time() - frame->publish_us;
+    frame->first_done_us = took ? took : 1;
+    metrics_stage(METRIC_SEND, took);
+  }
+  c->sent++;
+  c->sending = NULL;
+  frame_unref(frame);
+}
+
+// RTP客户端一个包一个包地发：sendmsg()把包头和帧里的一段扫描数据一起交给
+// 协议栈，帧不用先拷贝成一个个包。返回值和pump()一样
+static int pump_rtp(hub_client_t *c) {
+  while (true) {
+    if (!c->sending) {
+      if (!c->pending) {
+        return 0;
+      }
+      start_frame(c);
+    }
+    hub_frame_t *frame = c->sending;
+    if (c->jpeg.scan_len == 0) {
+      // RFC 2435传不了的JPEG（渐进式、4:4:4等）
+      c->dropped++;
+      c->sending = NULL;
+      frame_unref(frame);
+      continue;
+    }
+    if (c->prefix_len == 0) {
+      c->prefix_len =
+          rtp_jpeg_packet(&c->jpeg, c->offset, HUB_RTP_MAX_PACKET, &c->rtp,
+                          c->prefix, &c->payload_len);
+    }
+    struct iovec iov[2] = {
+        {.iov_base = c->prefix, .iov_len = c->prefix_len},
+        {.iov_base = (void *)(c->jpeg.scan + c->offset),
+         .iov_len = c->payload_len},
+    };
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+    if (sendmsg(c->fd, &msg, MSG_DONTWAIT) < 0) {
+      // UDP没有写满的说法，lwIP的缓冲区不够时返回ENOMEM，这个包下次再发
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOMEM) ? 1
+                                                                          : -1;
+    }
+    c->bytes += c->prefix_len - RTP_HEADER_LEN + c->payload_len;
+    c->packets++;
+    c->offset += c->payload_len;
+    c->prefix_len = 0;
+    if (c->offset == c->jpeg.scan_len) {
+      frame_done(c, frame);
+    }
+  }
+}
+
+// 尽可能多地往客户端写数据
+// 返回: 0 没有数据要发, 1 socket写满了, -1 出错
+static int pump(hub_client_t *c) {
+  if (c->type == STREAM_CLIENT_RTP) {
+    return pump_rtp(c);
+  }
+  while (true) {
+    if (!c->sending && c->text_len) {
+      int n = write_some(c->fd, c->text, c->text_len);
+      if (n <= 0) {
+        return n < 0 ? -1 : 1;
+      }
+      memmove(c->text, c->text + n, c->text_len - n);
+      c->text_len -= n;
+      continue;
+    }
+    if (!c->sending) {
+      if (!c->pending) {
+        return 0;
+      }
+      start_frame(c);
+    }
+
+    hub_frame_t *frame = c->sending;
+    size_t total = c->prefix_len + frame->len;
+    int n;
+    if (c->offset < c->prefix_len) {
+      n = write_some(c->fd, c->prefix + c->offset, c->prefix_len - c->offset);
+    } else {
+      size_t pos = c->offset - c->prefix_len;
+      n = write_some(c->fd, frame->buf + pos, frame->len - pos);
+    }
+    if (n <= 0) {
+      return n < 0 ? -1 : 1;
+    }
+    c->offset += n;
+    c->bytes += n;
+    if (c->offset == total) {
+      frame_done(c, frame);
+    }
+  }
+}
+
+static void send_task(void *arg) {
+  while (true) {
+    fd_set wfds;
+    int maxfd = -1;
+    int closing[STREAM_HUB_MAX_CLIENTS];
+    httpd_handle_t closing_hd[STREAM_HUB_MAX_CLIENTS];
+    int closing_count = 0;
+    bool backoff = false; // 有RTP客户端发不出去
+
+    FD_ZERO(&wfds);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < STREAM_HUB_MAX_CLIENTS; i++) {
+      hub_client_t *c = &s_clients[i];
+      if (c->fd < 0) {
+        continue;
+      }
+      int r = pump(c);
+      if (r < 0) {
+        closing[closing_count] = c->fd;
+        closing_hd[closing_count] = c->hd;
+        closing_count++;
+        release_client(c);
+      } else if (r > 0 && c->type == STREAM_CLIENT_RTP) {
+        backoff = true;
+      } else if (r > 0) {
+        FD_SET(c->fd, &wfds);
+        if (c->fd > maxfd) {
+          maxfd = c->fd;
+        }
+      }
+    }
+    xSemaphoreGive(s_lock);
+
+    for (int i = 0; i < closing_count; i++) {
+      if (closing_hd[i]) { // RTP的socket归RTSP服务器管
+        httpd_sess_trigger_close(closing_hd[i], closing[i]);
+      }
+    }
+
+    if (maxfd >= 0) {
+      // 等待发不动的socket变为可写；其他客户端的新帧最多晚
+      // HUB_SELECT_TIMEOUT_US发出
+      struct timeval tv = {.tv_sec = 0, .tv_usec = HUB_SELECT_TIMEOUT_US};
+      select(maxfd + 1, NULL, &wfds, NULL, &tv);
+      ulTaskNotifyTake(pdTRUE, 0);
+    } else {
+      // UDP socket在select()里总是可写的，发不出去时等一个tick再试
+      ulTaskNotifyTake(pdTRUE, backoff ? 1 : portMAX_DELAY);
+    }
+  }
+}
+
+esp_err_t stream_hub_init(void) {
+  if (s_lock) {
+    return ESP_OK;
+  }
+  for (int i = 0; i < STREAM_HUB_MAX_CLIENTS; i++) {
+    s_clients[i].fd = -1;
+  }
+  for (int i = 0; i < STREAM_LAYER_COUNT; i++) {
+    stream_stats_init(&s_interval_stats[i]);
+    stream_stats_init(&s_bytes_stats[i]);
+  }
+  motion_detect_init(&s_motion, STREAM_MOTION_THRESHOLD,
+                     STREAM_MOTION_MIN_BLOCKS);
+  s_lock = xSemaphoreCreateMutex();
+  if (!s_lock) {
+    return ESP_ERR_NO_MEM;
+  }
+  // 采集编码在core 1，网络发送在core 0
+  if (xTaskCreatePinnedToCore(capture_task, "stream_cap", 4096, NULL, 5,
+                              &s_capture_task, 1) != pdPASS ||
+      xTaskCreatePinnedToCore(send_task, "stream_send", 4096, NULL, 5,
+                              &s_send_task, 0) != pdPASS) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t attach_client(httpd_handle_t hd, int fd,
+                               stream_client_type_t type,
+                               const stream_rtp_params_t *rtp) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  hub_client_t *c = find_client(fd);
+  if (!c) {
+    c = find_client(-1);
+  }
+  if (c) {
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->hd = hd;
+    c->type = type;
+    c->connected_us = esp_timer_get_time();
+    if (rtp) {
+      c->rtp.ssrc = rtp->ssrc;
+      c->rtp.seq = rtp->seq;
+      c->rtp_base_ts = rtp->timestamp;
+      c->rtp_base_us = rtp->base_us;
+    }
+  }
+  xSemaphoreGive(s_lock);
+  if (!c) {
+    ESP_LOGW(TAG, "Too many clients, rejecting %d", fd);
+    return ESP_ERR_NO_MEM;
+  }
+  ESP_LOGI(TAG, "Client %d joined (%s)", fd, client_type_name(type));
+  s_motion_resync = true;
+  xTaskNotifyGive(s_capture_task);
+  return ESP_OK;
+}
+
+esp_err_t stream_hub_attach(httpd_handle_t hd, int fd,
+                            stream_client_type_t type) {
+  return attach_client(hd, fd, type, NULL);
+}
+
+esp_err_t stream_hub_attach_rtp(int fd, const stream_rtp_params_t *params) {
+  return attach_client(NULL, fd, STREAM_CLIENT_RTP, params);
+}
+
+void stream_hub_detach(int fd) {
+  if (!s_lock || fd < 0) {
+    return;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  hub_client_t *c = find_client(fd);
+  if (c) {
+    release_client(c);
+  }
+  xSemaphoreGive(s_lock);
+}
+
+void stream_hub_close_fn(httpd_handle_t hd, int fd) {
+  // 先让发送任务放开这个socket，再关闭
+  stream_hub_detach(fd);
+  close(fd);
+}
+
+esp_err_t stream_hub_set_paused(int fd, bool paused) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  hub_client_t *c = find_client(fd);
+  if (c) {
+    c->paused = paused;
+    if (paused) {
+      frame_unref(c->pending);
+      c->pending = NULL;
+    }
+  }
+  xSemaphoreGive(s_lock);
+  if (!c) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (!paused) {
+    s_motion_resync = true;
+  }
+  xTaskNotifyGive(s_capture_task);
+  return ESP_OK;
+}
+
+esp_err_t stream_hub_set_probe(int fd, bool probe) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  hub_client_t *c = find_client(fd);
+  if (c) {
+    c->probe = probe;
+  }
+  xSemaphoreGive(s_lock);
+  return c ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t stream_hub_set_layer(int fd, stream_layer_t layer) {
+  if (layer < 0 || layer >= STREAM_LAYER_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  hub_client_t *c = find_client(fd);
+  bool changed = c && c->layer != layer;
+  if (changed) {
+    // 槽位里是另一层的帧，丢掉，下一帧马上按新的层发
+    c->layer = layer;
+    frame_unref(c->pending);
+    c->pending = NULL;
+  }
+  xSemaphoreGive(s_lock);
+  if (!c) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (changed) {
+    ESP_LOGI(TAG, "Client %d: %s layer", fd, stream_hub_layer_name(layer));
+    s_motion_resync = true;
+    xTaskNotifyGive(s_capture_task);
+  }
+  return ESP_OK;
+}
+
+int stream_hub_layer_from_name(const char *name) {
+  if (strcmp(name, "full") == 0 || strcmp(name, "0") == 0) {
+    return STREAM_LAYER_FULL;
+  }
+  if (strcmp(name, "low") == 0 || strcmp(name, "1") == 0) {
+    return STREAM_LAYER_LOW;
+  }
+  return -1;
+}
+
+const char *stream_hub_layer_name(stream_layer_t layer) {
+  return layer == STREAM_LAYER_LOW ? "low" : "full";
+}
+
+void stream_hub_set_motion_gate(bool enable) {
+  ESP_LOGI(TAG, "Motion gate %s", enable ? "on" : "off");
+  s_motion_gate = enable;
+}
+
+bool stream_hub_get_motion_gate(void) { return s_motion_gate; }
+
+void stream_hub_wake(void) {
+  if (s_capture_task) {
+    xTaskNotifyGive(s_capture_task);
+  }
+}
+
+void stream_hub_set_face_detect(bool enable) {
+#if CONFIG_ESP_FACE_DETECT_ENABLED
+  s_face_detect = enable;
+#endif
+}
+
+esp_err_t stream_hub_send_text(int fd, const char *text) {
+  size_t len = strlen(text);
+  if (len >= 65536) {
+    return ESP_ERR_NO_MEM; // 文本消息只用2字节长度的帧头
+  }
+  uint8_t header[WS_HEADER_MAX];
+  size_t header_len = ws_frame_header(header, HTTPD_WS_TYPE_TEXT, len);
+  esp_err_t ret = ESP_OK;
+
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  hub_client_t *c = find_client(fd);
+  if (!c || c->type != STREAM_CLIENT_WS) {
+    ret = ESP_ERR_NOT_FOUND;
+  } else if (c->text_len + header_len + len > sizeof(c->text)) {
+    ret = ESP_ERR_NO_MEM;
+  } else {
+    memcpy(c->text + c->text_len, header, header_len);
+    memcpy(c->text + c->text_len + header_len, text, len);
+    c->text_len += header_len + len;
+  }
+  xSemaphoreGive(s_lock);
+  if (ret == ESP_OK) {
+    xTaskNotifyGive(s_send_task);
+  }
+  return ret;
+}
+
+bool stream_hub_get_layer_stats(stream_layer_t layer, int64_t now_us,
+                                stream_stats_summary_t *interval,
+                                stream_stats_summary_t *bytes) {
+  if (layer >= STREAM_LAYER_COUNT) {
+    return false;
+  }
+  return stream_stats_read(&s_interval_stats[layer], now_us, interval) &&
+         stream_stats_read(&s_bytes_stats[layer], now_us, bytes);
+}
+
+int stream_hub_get_stats(stream_client_stats_t *stats, int max) {
+  int count = 0;
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (int i = 0; i < STREAM_HUB_MAX_CLIENTS; i++) {
+    hub_client_t *c = &s_clients[i];
+    if (c->fd < 0) {
+      continue;
+    }
+    if (count < max) {
+      stats[count] = (stream_client_stats_t){
+          .fd = c->fd,
+          .type = c->type,
+          .layer = c->layer,
+          .paused = c->paused,
+          .sent = c->sent,
+          .dropped = c->dropped,
+          .bytes = c->bytes,
+          .packets = c->packets,
+          .connected_us = c->connected_us,
+      };
+    }
+    count++;
+  }
+  xSemaphoreGive(s_lock);
+  return count;
+}
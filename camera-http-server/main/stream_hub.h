@@ -0,0 +1,107 @@
+#if !defined(__STREAM_HUB__)
+#define __STREAM_HUB__
+
+#include "esp_http_server.h"
+#include "stream_stats.h"
+
+// 视频帧分发中心
+//
+// 采集任务只负责拍照、编码，然后立即归还图片缓冲区，传感器不会被网络拖住。
+// 每个客户端只有一个待发送槽位（深度为1的队列，新帧覆盖旧帧），
+// 发送任务用非阻塞的方式写socket，慢的客户端只会丢掉自己的帧。
+//
+// Clients are attached after their HTTP response headers (multipart) or
+// WebSocket handshake have been sent; from then on only the hub writes to the
+// socket. Register stream_hub_close_fn as httpd_config_t.close_fn so the hub
+// lets go of a socket before httpd closes it.
+
+#define STREAM_PART_BOUNDARY "123456789000000000000987654321"
+#define STREAM_HUB_MAX_CLIENTS 4
+
+typedef enum {
+  STREAM_CLIENT_MULTIPART, // multipart/x-mixed-replace, see stream_handler()
+  STREAM_CLIENT_WS,        // /ws/video binary messages, see ws_video.h
+  STREAM_CLIENT_RTP,       // RTP/UDP (RFC 2435) for RTSP, see rtsp_server.h
+} stream_client_type_t;
+
+// 同一次采集出两种分辨率（simulcast），每个客户端选一层，默认是原始分辨率。
+// The low layer is downscaled from the raw frame (or decoded at 1/2..1/8 when
+// the sensor outputs JPEG) and encoded separately at most STREAM_LOW_FPS
+// times a second, see camera_server.h. Rate control only follows the full
+// layer; when nobody watches it, it is not encoded at all.
+typedef enum {
+  STREAM_LAYER_FULL,
+  STREAM_LAYER_LOW,
+  STREAM_LAYER_COUNT,
+} stream_layer_t;
+
+// RTP客户端的参数，由RTSP服务器在PLAY时决定（RTP-Info和RTCP SR要用）。
+// A frame captured at capture_us gets the RTP timestamp
+// timestamp + (capture_us - base_us) * 90 kHz.
+typedef struct {
+  uint32_t ssrc;
+  uint16_t seq; // of the first packet
+  uint32_t timestamp;
+  int64_t base_us; // esp_timer
+} stream_rtp_params_t;
+
+typedef struct {
+  int fd;
+  stream_client_type_t type;
+  stream_layer_t layer;
+  bool paused;
+  uint32_t sent;    // frames fully written to the socket
+  uint32_t dropped; // frames replaced in the slot before they were sent
+  uint64_t bytes;   // RTP: payload octets, as counted by RTCP
+  uint32_t packets; // RTP only
+  int64_t connected_us;
+} stream_client_stats_t;
+
+esp_err_t stream_hub_init(void);
+
+esp_err_t stream_hub_attach(httpd_handle_t hd, int fd,
+                            stream_client_type_t type);
+// fd是已经connect()到客户端RTP端口的UDP socket。The hub never closes it:
+// the caller owns the socket and detaches it before closing. A client whose
+// sends fail is dropped from the hub, which the caller sees in
+// stream_hub_get_stats().
+esp_err_t stream_hub_attach_rtp(int fd, const stream_rtp_params_t *params);
+void stream_hub_detach(int fd);
+void stream_hub_close_fn(httpd_handle_t hd, int fd);
+
+esp_err_t stream_hub_set_paused(int fd, bool paused);
+// Latency probe mode for a STREAM_CLIENT_MULTIPART client: every part header
+// also carries X-Frame-Seq and the device times (esp_timer microseconds)
+// X-Capture-Us, X-Publish-Us and X-Send-Us, see host/latency_probe.py.
+// Parts already started when it is set keep the plain header.
+esp_err_t stream_hub_set_probe(int fd, bool probe);
+// 换一层分辨率，从下一帧开始生效
+esp_err_t stream_hub_set_layer(int fd, stream_layer_t layer);
+// "full"/"0" or "low"/"1" as used in ?layer=, -1 when unknown.
+int stream_hub_layer_from_name(const char *name);
+const char *stream_hub_layer_name(stream_layer_t layer);
+// Queues a text message for a STREAM_CLIENT_WS client. It is written between
+// two frames so it never ends up in the middle of a binary message.
+esp_err_t stream_hub_send_text(int fd, const char *text);
+
+// 运动检测门控：画面静止时不编码、不发送，见 motion_detect.h
+void stream_hub_set_motion_gate(bool enable);
+bool stream_hub_get_motion_gate(void);
+
+// 在视频流上叠加人脸框（需要CONFIG_ESP_FACE_DETECT_ENABLED），见 face_engine.h
+void stream_hub_set_face_detect(bool enable);
+
+// 录像开关改变后叫醒采集任务，见 clip_recorder.h
+void stream_hub_wake(void);
+
+// Copies up to max client stats, returns the number of clients.
+int stream_hub_get_stats(stream_client_stats_t *stats, int max);
+
+// 一层视频流的帧间隔(us)和帧大小(B)统计，见 stream_stats.h。
+// Safe from any task; returns false when the capture task kept updating the
+// stats while they were being copied, try again on the next scrape.
+bool stream_hub_get_layer_stats(stream_layer_t layer, int64_t now_us,
+                                stream_stats_summary_t *interval,
+                                stream_stats_summary_t *bytes);
+
+#endif // __STREAM_HUB__
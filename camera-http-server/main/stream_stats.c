@@ -0,0 +1,112 @@
+#include "stream_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const uint32_t s_window_ms[STREAM_STATS_WINDOWS] =
+    STREAM_STATS_WINDOW_MS;
+
+void stream_stats_init(stream_stats_t *st) {
+  memset(st, 0, sizeof(*st));
+  atomic_init(&st->seq, 0);
+}
+
+void stream_stats_add(stream_stats_t *st, uint32_t value, int64_t now_us) {
+  unsigned int seq = atomic_load_explicit(&st->seq, memory_order_relaxed);
+  atomic_store_explicit(&st->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  st->values[st->head] = value;
+  st->times_ms[st->head] = (uint32_t)(now_us / 1000);
+  st->head = (st->head + 1) % STREAM_STATS_SAMPLES;
+  if (st->filled < STREAM_STATS_SAMPLES) {
+    st->filled++;
+  }
+  st->last = value;
+  if (st->count == 0) {
+    st->ewma = value;
+  } else {
+    st->ewma += ((float)value - st->ewma) * STREAM_STATS_EWMA_ALPHA;
+  }
+  st->count++;
+  st->sum += value;
+
+  atomic_store_explicit(&st->seq, seq + 2, memory_order_release);
+}
+
+float stream_stats_ewma(const stream_stats_t *st) { return st->ewma; }
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// 最近邻秩：排好序的n个值中第ceil(p * n)个
+static uint32_t percentile(const uint32_t *sorted, uint32_t n, int p) {
+  uint32_t rank = (n * p + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void summarize(const stream_stats_t *copy, uint32_t now_ms,
+                      uint32_t window_ms, uint32_t *scratch,
+                      stream_stats_window_t *out) {
+  memset(out, 0, sizeof(*out));
+  out->window_ms = window_ms;
+  // 从最新的样本往回找，环是按时间顺序写的
+  uint32_t n = 0;
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < copy->filled; i++) {
+    uint32_t slot =
+        (copy->head + STREAM_STATS_SAMPLES - 1 - i) % STREAM_STATS_SAMPLES;
+    // 有符号的差：毫秒数回绕没关系，读者取了now以后才写进来的样本算作0
+    int32_t age = (int32_t)(now_ms - copy->times_ms[slot]);
+    if (age > (int32_t)window_ms) {
+      break;
+    }
+    scratch[n++] = copy->values[slot];
+    sum += copy->values[slot];
+  }
+  if (n == 0) {
+    return;
+  }
+  qsort(scratch, n, sizeof(uint32_t), compare_u32);
+  out->count = n;
+  out->min = scratch[0];
+  out->max = scratch[n - 1];
+  out->mean = (uint32_t)((sum + n / 2) / n);
+  out->p50 = percentile(scratch, n, 50);
+  out->p90 = percentile(scratch, n, 90);
+  out->p99 = percentile(scratch, n, 99);
+}
+
+bool stream_stats_read(const stream_stats_t *st, int64_t now_us,
+                       stream_stats_summary_t *out) {
+  // 拷贝和排序都在读者这边，写者只管往环里放
+  stream_stats_t *copy = (stream_stats_t *)malloc(sizeof(stream_stats_t));
+  uint32_t *scratch =
+      (uint32_t *)malloc(STREAM_STATS_SAMPLES * sizeof(uint32_t));
+  bool ok = false;
+  for (int i = 0; copy && scratch && i < STREAM_STATS_READ_TRIES && !ok; i++) {
+    unsigned int before = atomic_load_explicit(&st->seq, memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    memcpy(copy, st, sizeof(*copy));
+    atomic_thread_fence(memory_order_acquire);
+    ok = atomic_load_explicit(&st->seq, memory_order_relaxed) == before;
+  }
+  if (ok) {
+    out->count = copy->count;
+    out->sum = copy->sum;
+    out->last = copy->last;
+    out->ewma = copy->ewma;
+    for (int i = 0; i < STREAM_STATS_WINDOWS; i++) {
+      summarize(copy, (uint32_t)(now_us / 1000), s_window_ms[i], scratch,
+                &out->windows[i]);
+    }
+  }
+  free(copy);
+  free(scratch);
+  return ok;
+}
@@ -0,0 +1,70 @@
+#if !defined(__STREAM_STATS__)
+#define __STREAM_STATS__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// 一路视频流的统计：EWMA、最近几个时间窗口内的最小/最大值和分位数。
+//
+// One writer (the capture task) adds samples in O(1) into a fixed ring of
+// STREAM_STATS_SAMPLES; readers (/metrics) never block it. The writer bumps
+// a sequence counter around every update (odd while writing) and a reader
+// copies the ring and retries when the counter moved, so a reader always
+// sees a consistent snapshot. A reader gives up after a few tries instead of
+// spinning on a writer that was preempted mid-update. Windows are capped at
+// the ring size: count in the summary tells how many samples were used.
+//
+// No ESP-IDF dependencies: see host/stream_stats_bench.c.
+
+#define STREAM_STATS_SAMPLES 128
+#define STREAM_STATS_WINDOWS 2
+#define STREAM_STATS_WINDOW_MS {1000, 5000}
+#define STREAM_STATS_EWMA_ALPHA 0.125f // 新样本的权重
+#define STREAM_STATS_READ_TRIES 8
+
+typedef struct {
+  atomic_uint seq; // odd while the writer is updating
+  uint32_t head;   // next slot in the ring
+  uint32_t filled;
+  uint32_t values[STREAM_STATS_SAMPLES];
+  uint32_t times_ms[STREAM_STATS_SAMPLES];
+  uint32_t last;
+  float ewma;
+  uint64_t count; // all time
+  uint64_t sum;
+} stream_stats_t;
+
+typedef struct {
+  uint32_t window_ms;
+  uint32_t count; // samples in the window, 0 means no other field is valid
+  uint32_t min;
+  uint32_t max;
+  uint32_t mean;
+  uint32_t p50;
+  uint32_t p90;
+  uint32_t p99;
+} stream_stats_window_t;
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint32_t last;
+  float ewma;
+  stream_stats_window_t windows[STREAM_STATS_WINDOWS];
+} stream_stats_summary_t;
+
+void stream_stats_init(stream_stats_t *st);
+
+// 只能有一个写者
+void stream_stats_add(stream_stats_t *st, uint32_t value, int64_t now_us);
+
+// The EWMA alone, without copying the ring: a single aligned 32 bit load.
+float stream_stats_ewma(const stream_stats_t *st);
+
+// Summarizes the windows ending at now_us. Returns false when the writer kept
+// the ring busy for STREAM_STATS_READ_TRIES copies or memory ran out.
+bool stream_stats_read(const stream_stats_t *st, int64_t now_us,
+                       stream_stats_summary_t *out);
+
+#endif // __STREAM_STATS__
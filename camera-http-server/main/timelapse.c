@@ -0,0 +1,436 @@
+#include "timelapse.h"
+#include "async_handler.h"
+#include "camera_server.h"
+#include "clip_recorder.h"
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "frame_source.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mem_policy.h"
+#include "stream_hub.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TAG "timelapse"
+
+#define TIMELAPSE_PATH_MAX 32
+
+static SemaphoreHandle_t s_lock = NULL; // protects s_stats
+static TaskHandle_t s_task = NULL;
+static volatile bool s_enabled = TIMELAPSE_ENABLED;
+static volatile uint32_t s_interval_s = TIMELAPSE_INTERVAL_S;
+static volatile bool s_reschedule = true; // 打开或改了间隔后马上拍一张
+static timelapse_stats_t s_stats;
+// 以下只有拍照任务使用
+static int s_file_seq = 0;
+static size_t s_file_len = 0;
+
+// 找到编号最小和最大的文件 tNNNNN.mjpg
+static int scan_files(int *oldest, int *newest) {
+  int count = 0;
+  *oldest = 0;
+  *newest = 0;
+  DIR *dir = opendir(CLIP_DIR);
+  if (!dir) {
+    return 0;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    int n;
+    if (tolower((unsigned char)entry->d_name[0]) != 't' ||
+        sscanf(entry->d_name + 1, "%d", &n) != 1) {
+      continue;
+    }
+    if (count == 0 || n < *oldest) {
+      *oldest = n;
+    }
+    if (n > *newest) {
+      *newest = n;
+    }
+    count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+// 写need字节后剩余空间不到TIMELAPSE_MIN_FREE_KB时删除最旧的文件。
+// 只剩正在追加的文件时也删掉它，下一帧从一个空文件重新开始
+static void make_room(size_t need) {
+  uint64_t total, free_bytes;
+  int oldest, newest;
+  while (esp_vfs_fat_info(CLIP_DIR, &total, &free_bytes) == ESP_OK &&
+         free_bytes < need + TIMELAPSE_MIN_FREE_KB * 1024ULL &&
+         scan_files(&oldest, &newest) > 0) {
+    char path[TIMELAPSE_PATH_MAX];
+    snprintf(path, sizeof(path), CLIP_DIR "/t%05d.mjpg", oldest);
+    ESP_LOGI(TAG, "Deleting %s", path);
+    if (unlink(path) != 0) {
+      break;
+    }
+    if (oldest == s_file_seq) {
+      s_file_len = 0; // fopen("ab")会重新创建它
+    }
+  }
+}
+
+// 每一帧都重新打开文件追加，断电时最多丢掉正在写的这一帧
+static bool append_frame(const uint8_t *jpeg, size_t len) {
+  if (!clip_recorder_storage_ready()) {
+    return false;
+  }
+  if (s_file_seq == 0 || s_file_len + len > TIMELAPSE_FILE_MAX_KB * 1024) {
+    int oldest, newest;
+    scan_files(&oldest, &newest);
+    s_file_seq = newest + 1;
+    s_file_len = 0;
+    ESP_LOGI(TAG, "Writing t%05d.mjpg", s_file_seq);
+  }
+  make_room(len);
+  char path[TIMELAPSE_PATH_MAX];
+  snprintf(path, sizeof(path), CLIP_DIR "/t%05d.mjpg", s_file_seq);
+  FILE *f = fopen(path, "ab");
+  if (!f) {
+    ESP_LOGE(TAG, "Failed to open %s", path);
+    return false;
+  }
+  bool ok = fwrite(jpeg, 1, len, f) == len;
+  ok = fclose(f) == 0 && ok;
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to write %s", path);
+    return false;
+  }
+  s_file_len += len;
+  return true;
+}
+
+// 传感器不能休眠的原因，没有时返回NULL
+static const char *awake_reason(void) {
+  if (stream_hub_get_stats(NULL, 0) > 0) {
+    return "stream";
+  }
+  if (clip_recorder_enabled()) {
+    return "clip_arm"; // 门铃录像默认打开，它要一直拍照
+  }
+  return NULL;
+}
+
+// 没有视频流客户端、也不录门铃录像时，传感器可以休眠
+static bool sensor_idle(void) { return awake_reason() == NULL; }
+
+// 拍一张JPEG；传感器在休眠时camera_sensor_lock()会先唤醒它。
+// The frame is copied out and the sensor powered down (when idle) before
+// encoding and writing to flash, so *awake_us, counted from start_us, only
+// covers waking up and capturing.
+static bool take_shot(int64_t start_us, size_t *len, bool *slept,
+                      uint32_t *awake_us) {
+  uint8_t *raw = NULL;
+  size_t raw_len = 0;
+  uint16_t width = 0, height = 0;
+  pixformat_t format = PIXFORMAT_JPEG;
+  camera_sensor_lock();
+  camera_fb_t *fb = frame_source_fb_get();
+  if (fb) {
+    raw = (uint8_t *)mem_alloc(MEM_POOL_FRAME, fb->len);
+    if (raw) {
+      memcpy(raw, fb->buf, fb->len);
+      raw_len = fb->len;
+      width = fb->width;
+      height = fb->height;
+      format = fb->format;
+    }
+    frame_source_fb_return(fb);
+  }
+  camera_sensor_unlock();
+  *slept = sensor_idle();
+  if (*slept) {
+    camera_sensor_power_down();
+  }
+  *awake_us = esp_timer_get_time() - start_us;
+
+  if (!raw) {
+    ESP_LOGE(TAG, fb ? "Out of memory" : "Camera capture failed");
+    return false;
+  }
+  uint8_t *jpeg = raw;
+  if (format != PIXFORMAT_JPEG) {
+    bool ok = mem_fmt2jpg(raw, raw_len, width, height, format,
+                          TIMELAPSE_JPEG_QUALITY, &jpeg, len);
+    free(raw);
+    if (!ok) {
+      ESP_LOGE(TAG, "JPEG compression failed");
+      return false;
+    }
+  } else {
+    *len = raw_len;
+  }
+  bool ok = append_frame(jpeg, *len);
+  free(jpeg);
+  return ok;
+}
+
+static void timelapse_task(void *arg) {
+  int64_t next_us = 0;
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TIMELAPSE_POLL_MS));
+    if (!s_enabled) {
+      continue; // 关闭时不碰传感器
+    }
+    int64_t now = esp_timer_get_time();
+    if (s_reschedule) {
+      s_reschedule = false;
+      next_us = now;
+    }
+    if (now >= next_us) {
+      // 按计划的时刻排下一张，拍照本身的耗时不会让间隔越来越长
+      next_us += s_interval_s * 1000000LL;
+      if (next_us <= now) {
+        next_us = now + s_interval_s * 1000000LL;
+      }
+      // 醒着的时间：唤醒、丢帧、拍照，直到再次休眠
+      size_t len = 0;
+      bool idle = false;
+      uint32_t awake_us = 0;
+      bool ok = take_shot(now, &len, &idle, &awake_us);
+
+      xSemaphoreTake(s_lock, portMAX_DELAY);
+      if (ok) {
+        s_stats.frames++;
+        s_stats.bytes += len;
+        s_stats.last_len = len;
+        s_stats.file_seq = s_file_seq;
+      } else {
+        s_stats.failures++;
+      }
+      if (idle) {
+        s_stats.sleeps++;
+        s_stats.last_awake_us = awake_us;
+        s_stats.awake_us += awake_us;
+      }
+      uint32_t frames = s_stats.frames;
+      xSemaphoreGive(s_lock);
+      ESP_LOGI(TAG, "Frame %u: %uB, awake %ums%s", frames, (unsigned int)len,
+               (unsigned int)(awake_us / 1000),
+               idle ? "" : " (sensor shared with the stream)");
+    } else if (sensor_idle()) {
+      // 视频流客户端都走了，不用等到下一张
+      camera_sensor_power_down();
+    }
+  }
+}
+
+void timelapse_set_enabled(bool enable) {
+  ESP_LOGI(TAG, "Time-lapse %s, every %us", enable ? "on" : "off",
+           s_interval_s);
+  if (enable && clip_recorder_enabled()) {
+    ESP_LOGW(TAG, "Clip recorder is armed, the sensor stays on between "
+                  "shots; set clip_arm=0 to save power");
+  }
+  s_enabled = enable;
+  s_reschedule = true;
+  if (s_task) {
+    xTaskNotifyGive(s_task);
+  }
+}
+
+void timelapse_set_interval(uint32_t seconds) {
+  s_interval_s =
+      seconds < TIMELAPSE_MIN_INTERVAL_S ? TIMELAPSE_MIN_INTERVAL_S : seconds;
+  s_reschedule = true;
+  if (s_task) {
+    xTaskNotifyGive(s_task);
+  }
+}
+
+bool timelapse_enabled(void) { return s_enabled; }
+
+void timelapse_get_stats(timelapse_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (s_lock) { // timelapse_init()失败时/metrics仍然会调用
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *stats = s_stats;
+    xSemaphoreGive(s_lock);
+  }
+  stats->enabled = s_enabled;
+  stats->interval_s = s_interval_s;
+  camera_power_stats_t power;
+  camera_sensor_get_power_stats(&power);
+  stats->sensor_on_us = power.on_us;
+  stats->sensor_off_us = power.off_us;
+  stats->sensor_wakeups = power.wakeups;
+}
+
+static bool valid_file_name(const char *name) {
+  // 只允许 tNNNNN.mjpg，防止读取其他文件
+  size_t len = strlen(name);
+  if (len < 7 || tolower((unsigned char)name[0]) != 't' ||
+      strcasecmp(name + len - 5, ".mjpg") != 0) {
+    return false;
+  }
+  for (size_t i = 1; i < len - 5; i++) {
+    if (!isdigit((unsigned char)name[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static esp_err_t send_file(httpd_req_t *req, const char *name) {
+  char path[TIMELAPSE_PATH_MAX + sizeof(CLIP_DIR)];
+  snprintf(path, sizeof(path), CLIP_DIR "/%s", name);
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    httpd_resp_send_404(req);
+    return ESP_FAIL;
+  }
+  char *buf = (char *)malloc(4096);
+  if (!buf) {
+    fclose(f);
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+
+  httpd_resp_set_type(req, "video/x-motion-jpeg");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  esp_err_t res = ESP_OK;
+  size_t n;
+  while (res == ESP_OK && (n = fread(buf, 1, 4096, f)) > 0) {
+    res = httpd_resp_send_chunk(req, buf, n);
+  }
+  free(buf);
+  fclose(f);
+  if (res == ESP_OK) {
+    res = httpd_resp_send_chunk(req, NULL, 0);
+  }
+  return res;
+}
+
+static esp_err_t send_status(httpd_req_t *req) {
+  timelapse_stats_t st;
+  timelapse_get_stats(&st);
+  uint64_t total_us = st.sensor_on_us + st.sensor_off_us;
+  char file[16] = "";
+  if (st.file_seq > 0) {
+    snprintf(file, sizeof(file), "t%05d.mjpg", st.file_seq);
+  }
+  // 为什么拍完之后传感器没有休眠
+  const char *reason = awake_reason();
+  char json[448];
+  snprintf(json, sizeof(json),
+           "{\"enabled\":%u,\"interval_s\":%u,\"frames\":%u,\"failures\":%u,"
+           "\"bytes\":%llu,\"last_len\":%u,\"file\":\"%s\","
+           "\"last_awake_ms\":%u,\"avg_awake_ms\":%u,\"sensor_on_s\":%llu,"
+           "\"sensor_off_s\":%llu,\"sensor_wakeups\":%u,\"duty_cycle\":%.4f,"
+           "\"sleeps\":%u,\"awake_for\":\"%s\",\"files\":[",
+           st.enabled, st.interval_s, st.frames, st.failures,
+           (unsigned long long)st.bytes, st.last_len, file,
+           st.last_awake_us / 1000,
+           st.sleeps ? (unsigned int)(st.awake_us / st.sleeps / 1000) : 0,
+           (unsigned long long)(st.sensor_on_us / 1000000),
+           (unsigned long long)(st.sensor_off_us / 1000000),
+           st.sensor_wakeups,
+           total_us ? (double)st.sensor_on_us / total_us : 1.0, st.sleeps,
+           reason ? reason : "");
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_sendstr_chunk(req, json);
+
+  DIR *dir = clip_recorder_storage_ready() ? opendir(CLIP_DIR) : NULL;
+  if (dir) {
+    struct dirent *entry;
+    bool first = true;
+    while ((entry = readdir(dir)) != NULL) {
+      if (!valid_file_name(entry->d_name)) {
+        continue;
+      }
+      char name[TIMELAPSE_PATH_MAX];
+      char path[TIMELAPSE_PATH_MAX + sizeof(CLIP_DIR)];
+      struct stat st_file;
+      snprintf(name, sizeof(name), "%s", entry->d_name);
+      for (char *p = name; *p; p++) {
+        *p = tolower((unsigned char)*p);
+      }
+      snprintf(path, sizeof(path), CLIP_DIR "/%s", name);
+      if (stat(path, &st_file) != 0) {
+        continue;
+      }
+      snprintf(json, sizeof(json), "%s{\"name\":\"%s\",\"size\":%ld}",
+               first ? "" : ",", name, (long)st_file.st_size);
+      httpd_resp_sendstr_chunk(req, json);
+      first = false;
+    }
+    closedir(dir);
+  }
+  httpd_resp_sendstr_chunk(req, "]}");
+  return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+static esp_err_t timelapse_handler(httpd_req_t *req) {
+  // 下载文件、列目录都要读文件系统
+  if (!async_handler_on_worker()) {
+    return async_handler_submit(req, timelapse_handler);
+  }
+  char query[64];
+  char value[TIMELAPSE_PATH_MAX];
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "name", value, sizeof(value)) ==
+        ESP_OK) {
+      if (!valid_file_name(value)) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+      }
+      return send_file(req, value);
+    }
+    if (httpd_query_key_value(query, "interval", value, sizeof(value)) ==
+        ESP_OK) {
+      timelapse_set_interval(atoi(value));
+    }
+    if (httpd_query_key_value(query, "enable", value, sizeof(value)) ==
+        ESP_OK) {
+      timelapse_set_enabled(atoi(value));
+      // 这里在工作任务上，/status的缓存和推送交给httpd的任务
+      camera_server_status_changed();
+    }
+  }
+  return send_status(req);
+}
+
+esp_err_t timelapse_register(httpd_handle_t server) {
+  httpd_uri_t timelapse_uri = {.uri = "/timelapse",
+                               .method = HTTP_GET,
+                               .handler = timelapse_handler,
+                               .user_ctx = NULL
+#ifdef CONFIG_HTTPD_WS_SUPPORT
+                               ,
+                               .is_websocket = false,
+                               .handle_ws_control_frames = false,
+                               .supported_subprotocol = NULL
+#endif
+  };
+  return httpd_register_uri_handler(server, &timelapse_uri);
+}
+
+esp_err_t timelapse_init(void) {
+  if (s_lock) {
+    return ESP_OK;
+  }
+  s_lock = xSemaphoreCreateMutex();
+  if (!s_lock) {
+    return ESP_ERR_NO_MEM;
+  }
+  // 写闪存的优先级和录像一样，低于采集和发送
+  if (xTaskCreatePinnedToCore(timelapse_task, "timelapse", 4096, NULL, 3,
+                              &s_task, 0) != pdPASS) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
@@ -0,0 +1,63 @@
+#if !defined(__TIMELAPSE__)
+#define __TIMELAPSE__
+
+#include "esp_http_server.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// 间隔拍照（夜间监控）：每隔TIMELAPSE_INTERVAL_S秒拍一张JPEG，追加到存储分区的
+// MJPEG文件里；两次拍照之间传感器休眠（PWDN拉高、XCLK停掉）。
+//
+// A shot wakes the sensor through camera_sensor_lock(), copies one frame,
+// powers the sensor down again and only then encodes and appends it to
+// /storage/tNNNNN.mjpg (a plain concatenation of JPEGs, which ffmpeg reads
+// with -f mjpeg). Every append opens and closes the file, so a power cut
+// loses at most the frame being written. A new file is started after
+// TIMELAPSE_FILE_MAX_KB and the oldest time-lapse files are deleted when the
+// partition runs low, the current one too when it is the only one left, so
+// the files form a ring. The sensor is only powered down when no stream
+// client is attached and the clip recorder is off; otherwise the shot just
+// shares the running sensor and /timelapse reports why in "awake_for".
+//
+// GET /timelapse                    状态和占空比统计（JSON）
+// GET /timelapse?enable=1&interval=300
+// GET /timelapse?name=t00001.mjpg   下载文件
+
+#define TIMELAPSE_ENABLED 0 // 开机时是否打开
+#define TIMELAPSE_INTERVAL_S 60
+#define TIMELAPSE_MIN_INTERVAL_S 5
+#define TIMELAPSE_JPEG_QUALITY 80
+// 超过这个大小换一个新文件。要远小于存储分区（4MB，FAT之后更少），
+// otherwise a single file fills the partition and there is nothing older to
+// delete.
+#define TIMELAPSE_FILE_MAX_KB 512
+#define TIMELAPSE_MIN_FREE_KB 512 // 空间不够时删除最旧的文件
+// 没到拍照时间时，每隔多久检查一次传感器是不是可以休眠了（视频流客户端都走了）
+#define TIMELAPSE_POLL_MS 1000
+
+typedef struct {
+  bool enabled;
+  uint32_t interval_s;
+  uint32_t frames;
+  uint32_t failures;
+  uint64_t bytes;
+  uint32_t last_len;
+  int file_seq; // 正在追加的文件 tNNNNN.mjpg，0表示还没有
+  // 占空比：每次拍照传感器醒着的时间，以及开机以来上电/休眠的总时间
+  uint32_t sleeps;   // 拍完之后让传感器休眠的次数
+  uint32_t last_awake_us;
+  uint64_t awake_us; // 这些拍照醒着的时间之和
+  uint64_t sensor_on_us;
+  uint64_t sensor_off_us;
+  uint32_t sensor_wakeups;
+} timelapse_stats_t;
+
+esp_err_t timelapse_init(void);
+esp_err_t timelapse_register(httpd_handle_t server);
+
+void timelapse_set_enabled(bool enable);
+bool timelapse_enabled(void);
+void timelapse_set_interval(uint32_t seconds);
+void timelapse_get_stats(timelapse_stats_t *stats);
+
+#endif // __TIMELAPSE__
@@ -0,0 +1,101 @@
+#include "ws_video.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "stream_hub.h"
+
+#define TAG "ws_video"
+
+#define WS_VIDEO_MAX_TEXT 64
+
+static ws_video_control_cb_t s_control_cb = NULL;
+
+// 回复由stream_hub在两帧之间发出，不会插进二进制消息中间
+static esp_err_t send_text(httpd_req_t *req, const char *text) {
+  return stream_hub_send_text(httpd_req_to_sockfd(req), text);
+}
+
+static esp_err_t handle_text(httpd_req_t *req, char *text) {
+  char variable[32];
+  char value[32];
+  char reply[96];
+
+  if (httpd_query_key_value(text, "time", value, sizeof(value)) == ESP_OK) {
+    snprintf(reply, sizeof(reply), "{\"time\":%s,\"device_us\":%lld}", value,
+             esp_timer_get_time());
+    return send_text(req, reply);
+  }
+
+  if (httpd_query_key_value(text, "video", value, sizeof(value)) == ESP_OK) {
+    int video = atoi(value) != 0;
+    if (stream_hub_set_paused(httpd_req_to_sockfd(req), !video) != ESP_OK) {
+      video = -1;
+    }
+    snprintf(reply, sizeof(reply), "{\"video\":%d}", video);
+    return send_text(req, reply);
+  }
+
+  if (httpd_query_key_value(text, "layer", value, sizeof(value)) == ESP_OK) {
+    int layer = stream_hub_layer_from_name(value);
+    if (layer < 0 || stream_hub_set_layer(httpd_req_to_sockfd(req),
+                                          (stream_layer_t)layer) != ESP_OK) {
+      layer = -1;
+    }
+    snprintf(reply, sizeof(reply), "{\"layer\":%d}", layer);
+    return send_text(req, reply);
+  }
+
+  if (httpd_query_key_value(text, "var", variable, sizeof(variable)) ==
+          ESP_OK &&
+      httpd_query_key_value(text, "val", value, sizeof(value)) == ESP_OK) {
+    int res = s_control_cb ? s_control_cb(variable, atoi(value)) : -1;
+    snprintf(reply, sizeof(reply), "{\"var\":\"%s\",\"res\":%d}", variable,
+             res);
+    return send_text(req, reply);
+  }
+
+  ESP_LOGI(TAG, "Unknown message: %s", text);
+  return send_text(req, "{\"res\":-1}");
+}
+
+static esp_err_t ws_video_handler(httpd_req_t *req) {
+  // 握手完成，把这个连接交给stream_hub推送视频
+  if (req->method == HTTP_GET) {
+    return stream_hub_attach(req->handle, httpd_req_to_sockfd(req),
+                             STREAM_CLIENT_WS);
+  }
+
+  httpd_ws_frame_t pkt;
+  memset(&pkt, 0, sizeof(pkt));
+  // max_len为0时只读取帧长度
+  esp_err_t ret = httpd_ws_recv_frame(req, &pkt, 0);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  if (pkt.type != HTTPD_WS_TYPE_TEXT || pkt.len >= WS_VIDEO_MAX_TEXT) {
+    // 不认识的消息体还留在socket里，只能断开连接
+    ESP_LOGW(TAG, "Unexpected frame type %d len %u", pkt.type, pkt.len);
+    return ESP_FAIL;
+  }
+  char text[WS_VIDEO_MAX_TEXT];
+  pkt.payload = (uint8_t *)text;
+  ret = httpd_ws_recv_frame(req, &pkt, sizeof(text) - 1);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  text[pkt.len] = 0;
+  return handle_text(req, text);
+}
+
+esp_err_t ws_video_register(httpd_handle_t server,
+                            ws_video_control_cb_t control_cb) {
+  httpd_uri_t ws_video_uri = {.uri = "/ws/video",
+                              .method = HTTP_GET,
+                              .handler = ws_video_handler,
+                              .user_ctx = NULL,
+                              .is_websocket = true,
+                              .handle_ws_control_frames = false,
+                              .supported_subprotocol = NULL};
+
+  s_control_cb = control_cb;
+  return httpd_register_uri_handler(server, &ws_video_uri);
+}
@@ -0,0 +1,43 @@
+#if !defined(__WS_VIDEO__)
+#define __WS_VIDEO__
+
+#include "esp_http_server.h"
+
+// `/ws/video`：通过websocket推送视频帧，同一个连接上也可以发送控制命令。
+//
+// 每一帧是一条二进制消息：ws_video_header_t + JPEG数据。
+// 文本消息使用与 /control 相同的query格式：
+//   "var=framesize&val=5"  修改传感器设置，回复 {"var":"framesize","res":0}
+//   "video=0" / "video=1"  暂停/恢复本连接的视频推送
+//   "layer=low" / "layer=full"  换分辨率层（见stream_hub.h），回复 {"layer":1}
+//   "time=<client_ts>"     时钟同步，回复 {"time":<client_ts>,"device_us":<now>}
+// 设置改变时（无论来自哪个连接或 /control）设备主动推送变化的字段：
+//   {"version":7,"status":{"quality":12}}
+// 变化太多放不下时只推送 {"version":7}，客户端重新获取 /status。
+// version is the ETag of /status, so the UI never needs to poll it.
+//
+// The device clock in capture_us/send_us/device_us is esp_timer (microseconds
+// since boot), so a browser can estimate the offset with "time=" round trips
+// and then compute glass-to-glass latency for every frame.
+
+#define WS_VIDEO_MAGIC 0x464D4143 // "CAMF"
+#define WS_VIDEO_VERSION 1
+
+// All fields are little-endian.
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint16_t header_len; // sizeof(ws_video_header_t), JPEG data starts here
+  uint16_t version;
+  uint32_t seq;        // frame sequence number, gaps mean dropped frames
+  uint32_t jpeg_len;
+  int64_t capture_us;  // when the sensor delivered the frame
+  int64_t send_us;     // when the device started sending the frame
+} ws_video_header_t;
+
+// Applies a "var"/"val" pair, returns < 0 on failure (same as /control).
+typedef int (*ws_video_control_cb_t)(const char *variable, int val);
+
+esp_err_t ws_video_register(httpd_handle_t server,
+                            ws_video_control_cb_t control_cb);
+
+#endif // __WS_VIDEO__
@@ -0,0 +1,103 @@
+#include "www.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include <string.h>
+
+#define TAG "www"
+
+#define WWW_MAGIC 0x31575757 // "WWW1"
+
+// 分区镜像的布局，见 www/pack_www.py
+typedef struct {
+  uint32_t magic;
+  uint32_t count;
+} www_header_t;
+
+typedef struct {
+  char name[24];
+  uint32_t offset; // from the start of the partition
+  uint32_t length;
+  char etag[20]; // quoted, NUL terminated
+} www_entry_t;
+
+static const uint8_t *s_base = NULL;
+static const www_entry_t *s_entries = NULL;
+static uint32_t s_count = 0;
+static esp_partition_mmap_handle_t s_handle;
+
+// 检查镜像的头，防止分区没有烧录或者被别的数据覆盖
+static bool image_valid(const uint8_t *base, size_t size) {
+  const www_header_t *header = (const www_header_t *)base;
+  if (header->magic != WWW_MAGIC ||
+      sizeof(www_header_t) + header->count * sizeof(www_entry_t) > size) {
+    return false;
+  }
+  const www_entry_t *entries = (const www_entry_t *)(header + 1);
+  for (uint32_t i = 0; i < header->count; i++) {
+    const www_entry_t *e = &entries[i];
+    if (!memchr(e->name, 0, sizeof(e->name)) ||
+        !memchr(e->etag, 0, sizeof(e->etag)) || e->offset > size ||
+        e->length > size - e->offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+esp_err_t www_init(void) {
+  if (s_base) {
+    return ESP_OK;
+  }
+  const esp_partition_t *part = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, WWW_PARTITION);
+  if (!part) {
+    ESP_LOGE(TAG, "No \"%s\" partition", WWW_PARTITION);
+    return ESP_ERR_NOT_FOUND;
+  }
+  const void *base = NULL;
+  esp_err_t err = esp_partition_mmap(part, 0, part->size,
+                                     ESP_PARTITION_MMAP_DATA, &base, &s_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "mmap failed: %s", esp_err_to_name(err));
+    return err;
+  }
+  if (!image_valid((const uint8_t *)base, part->size)) {
+    ESP_LOGE(TAG, "\"%s\" partition has no web pages, run idf.py flash",
+             WWW_PARTITION);
+    esp_partition_munmap(s_handle);
+    return ESP_ERR_INVALID_STATE;
+  }
+  s_base = (const uint8_t *)base;
+  s_count = ((const www_header_t *)s_base)->count;
+  s_entries = (const www_entry_t *)(s_base + sizeof(www_header_t));
+  ESP_LOGI(TAG, "%u web pages mapped", (unsigned int)s_count);
+  return ESP_OK;
+}
+
+esp_err_t www_send(httpd_req_t *req, const char *name, const char *type) {
+  const www_entry_t *e = NULL;
+  for (uint32_t i = 0; i < s_count; i++) {
+    if (!strcmp(s_entries[i].name, name)) {
+      e = &s_entries[i];
+      break;
+    }
+  }
+  if (!e) {
+    ESP_LOGE(TAG, "%s not found", name);
+    return httpd_resp_send_404(req);
+  }
+
+  char match[sizeof(e->etag)];
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(req, "ETag", e->etag);
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", match,
+                                  sizeof(match)) == ESP_OK &&
+      !strcmp(match, e->etag)) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+  httpd_resp_set_type(req, type);
+  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  // 数据直接从映射的flash写进socket，不拷贝到RAM
+  return httpd_resp_send(req, (const char *)s_base + e->offset, e->length);
+}
@@ -0,0 +1,23 @@
+#if !defined(__WWW__)
+#define __WWW__
+
+#include "esp_http_server.h"
+
+// 网页放在单独的www分区里，不编译进程序。
+//
+// main/www/*.html are gzipped and packed into a partition image at build time
+// by www/pack_www.py, which also derives each file's ETag from a hash of the
+// gzip data; `idf.py flash` writes the image along with the app. At startup
+// the partition is memory-mapped once and responses are sent straight from
+// the mapped flash, so a page load costs no heap. A browser that already has
+// the page gets a 304 after revalidating its ETag.
+
+#define WWW_PARTITION "www"
+
+esp_err_t www_init(void);
+
+// Sends a gzip-encoded file of the www partition, or 304 when If-None-Match
+// matches its ETag. 404 when the partition or the file is missing.
+esp_err_t www_send(httpd_req_t *req, const char *name, const char *type);
+
+#endif // __WWW__
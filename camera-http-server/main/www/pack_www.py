@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+# 把网页压缩后打包成www分区的镜像，构建时由main/CMakeLists.txt调用。
+#
+# usage: pack_www.py <output.bin> <file>...
+#
+# Image layout (little endian), read by main/www.c:
+#   uint32 magic "WWW1", uint32 count
+#   count x { char name[24]; uint32 offset; uint32 length; char etag[20]; }
+#   gzip data, each file aligned to 4 bytes
+# The ETag is the first 16 hex digits of the SHA-256 of the gzip data, so it
+# changes exactly when the served bytes change. gzip runs with mtime=0 to
+# keep the image reproducible.
+
+import gzip
+import hashlib
+import io
+import os
+import struct
+import sys
+
+MAGIC = 0x31575757  # "WWW1"
+ENTRY = struct.Struct("<24sII20s")
+
+
+def compress(path):
+    buf = io.BytesIO()
+    with open(path, "rb") as f, gzip.GzipFile(
+        filename=os.path.basename(path),
+        mode="wb",
+        fileobj=buf,
+        compresslevel=9,
+        mtime=0,
+    ) as g:
+        g.write(f.read())
+    return buf.getvalue()
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("usage: pack_www.py <output.bin> <file>...")
+    files = sorted(sys.argv[2:], key=os.path.basename)
+    blobs = [compress(p) for p in files]
+    offset = 8 + ENTRY.size * len(files)
+    header = struct.pack("<II", MAGIC, len(files))
+    data = b""
+    for path, blob in zip(files, blobs):
+        name = os.path.basename(path).encode()
+        if len(name) >= 24:
+            sys.exit("%s: name too long" % path)
+        etag = '"%s"' % hashlib.sha256(blob).hexdigest()[:16]
+        header += ENTRY.pack(name, offset + len(data), len(blob), etag.encode())
+        data += blob + b"\0" * (-len(blob) % 4)
+    with open(sys.argv[1], "wb") as f:
+        f.write(header + data)
+    print("www image: %d files, %d bytes" % (len(files), len(header + data)))
+
+
+if __name__ == "__main__":
+    main()
@@ -7,16 +7,13 @@
 #include "connect_wifi.h"
 #include "esp_camera.h"
 #include "esp_http_server.h"
-#include "esp_timer.h"
+#include "esp_log.h"
+#include "stream_broadcast.h"
 
 static const char *TAG = "esp32-cam Webserver";
 
-#define PART_BOUNDARY "123456789000000000000987654321"
 static const char *_STREAM_CONTENT_TYPE =
-    "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char *_STREAM_PART =
-    "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+    "multipart/x-mixed-replace;boundary=" STREAM_PART_BOUNDARY;
 
 #define CONFIG_XCLK_FREQ 20000000
 
@@ -59,69 +56,22 @@ static esp_err_t init_camera(void) {
   return ESP_OK;
 }
 
+// 只发响应头，然后把socket交给stream_broadcast，马上返回，
+// httpd任务可以继续接受别的浏览器的连接
 esp_err_t jpg_stream_httpd_handler(httpd_req_t *req) {
-  camera_fb_t *fb = NULL;
-  esp_err_t res = ESP_OK;
-  size_t _jpg_buf_len;
-  uint8_t *_jpg_buf;
-  char *part_buf[64];
-  static int64_t last_frame = 0;
-  if (!last_frame) {
-    last_frame = esp_timer_get_time();
+  char header[128];
+  // multipart流没有Content-Length，也不用chunked编码，直到连接关闭为止
+  int len = snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: %s\r\n"
+                     "\r\n",
+                     _STREAM_CONTENT_TYPE);
+  if (httpd_send(req, header, len) != len) {
+    ESP_LOGE(TAG, "Send stream header failed");
+    return ESP_FAIL;
   }
-
-  // 设置响应内容为流媒体
-  res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-  if (res != ESP_OK) {
-    return res;
-  }
-
-  while (true) {
-    // 获取图片缓冲区
-    fb = esp_camera_fb_get();
-    if (!fb) {
-      res = ESP_FAIL;
-      break;
-    }
-    if (fb->format != PIXFORMAT_JPEG) {
-      bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-      if (!jpeg_converted) {
-        esp_camera_fb_return(fb);
-        res = ESP_FAIL;
-      }
-    } else {
-      _jpg_buf_len = fb->len;
-      _jpg_buf = fb->buf;
-    }
-
-    // 分段将图片数据返回给浏览器
-    if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY,
-                                  strlen(_STREAM_BOUNDARY));
-    }
-    if (res == ESP_OK) {
-      size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, _jpg_buf_len);
-
-      res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-    }
-    if (res == ESP_OK) {
-      res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-    }
-    if (fb->format != PIXFORMAT_JPEG) {
-      free(_jpg_buf);
-    }
-    esp_camera_fb_return(fb);
-    if (res != ESP_OK) {
-      break;
-    }
-    int64_t fr_end = esp_timer_get_time();
-    int64_t frame_time = fr_end - last_frame;
-    last_frame = fr_end;
-    frame_time /= 1000;
-  }
-
-  last_frame = 0;
-  return res;
+  // 返回ESP_FAIL会让http服务器关闭这个连接
+  return stream_broadcast_attach(req->handle, httpd_req_to_sockfd(req));
 }
 
 httpd_uri_t uri_get = {.uri = "/",
@@ -132,6 +82,10 @@ httpd_handle_t setup_server(void) {
   // 生成http server的默认配置
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   httpd_handle_t stream_httpd = NULL;
+  // 视频流的socket由发送任务在写，关闭之前要先让它放手
+  config.close_fn = stream_broadcast_close_fn;
+  // 连接满了时关掉最久没有活动的，浏览器刷新页面留下的旧连接不会占着名额
+  config.lru_purge_enable = true;
 
   if (httpd_start(&stream_httpd, &config) == ESP_OK) {
     // 只注册一个uri的处理逻辑，就是"172.20.10.6:80/"的处理逻辑
@@ -161,6 +115,11 @@ void app_main() {
       printf("err: %s\n", esp_err_to_name(err));
       return;
     }
+    err = stream_broadcast_init();
+    if (err != ESP_OK) {
+      printf("err: %s\n", esp_err_to_name(err));
+      return;
+    }
     // 启动web server
     setup_server();
   } else {
@@ -0,0 +1,328 @@
+#include "stream_broadcast.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "img_converters.h"
+#include "lwip/sockets.h"
+
+static const char *TAG = "stream";
+
+// 有客户端发不动时，每隔多久检查一次其他客户端有没有新帧
+#define SELECT_TIMEOUT_US 10000
+
+static const char *_STREAM_PART = "\r\n--" STREAM_PART_BOUNDARY "\r\n"
+                                  "Content-Type: image/jpeg\r\n"
+                                  "Content-Length: %u\r\n\r\n";
+
+typedef struct {
+  int refs; // 引用计数，s_lock保护
+  uint8_t *buf;
+  size_t len;
+  size_t part_len;
+  char part[96]; // boundary + part header
+} shared_frame_t;
+
+typedef struct {
+  int fd; // -1表示空位
+  httpd_handle_t hd;
+  shared_frame_t *pending; // 深度为1的发送队列
+  shared_frame_t *sending;
+  size_t offset; // 这一帧（part头 + JPEG）已经写出的字节数
+  uint32_t sent;
+  uint32_t dropped;
+  uint64_t bytes;
+  int64_t connected_us;
+  uint32_t log_sent; // 上次打印帧率时的sent
+} stream_client_t;
+
+static stream_client_t s_clients[STREAM_MAX_CLIENTS];
+static SemaphoreHandle_t s_lock = NULL;
+static TaskHandle_t s_capture_task = NULL;
+static TaskHandle_t s_send_task = NULL;
+
+// 以下几个函数的调用者需要持有s_lock
+static void frame_unref(shared_frame_t *frame) {
+  if (frame && --frame->refs == 0) {
+    free(frame->buf);
+    free(frame);
+  }
+}
+
+static stream_client_t *find_client(int fd) {
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    if (s_clients[i].fd == fd) {
+      return &s_clients[i];
+    }
+  }
+  return NULL;
+}
+
+static int client_count(void) {
+  int count = 0;
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    count += s_clients[i].fd >= 0;
+  }
+  return count;
+}
+
+static void release_client(stream_client_t *c) {
+  float secs = (esp_timer_get_time() - c->connected_us) / 1e6f;
+  ESP_LOGI(TAG, "Client %d left: %u sent (%.1f fps), %u dropped, %llukB",
+           c->fd, c->sent, secs > 0 ? c->sent / secs : 0, c->dropped,
+           c->bytes / 1024);
+  frame_unref(c->pending);
+  frame_unref(c->sending);
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+}
+
+// 拍一帧并压缩成JPEG，图片缓冲区马上还给驱动
+static shared_frame_t *capture_frame(void) {
+  camera_fb_t *fb = esp_camera_fb_get();
+  if (!fb) {
+    ESP_LOGE(TAG, "Camera capture failed");
+    return NULL;
+  }
+  shared_frame_t *frame = (shared_frame_t *)calloc(1, sizeof(shared_frame_t));
+  bool ok = frame != NULL;
+  if (ok && fb->format == PIXFORMAT_JPEG) {
+    frame->buf = (uint8_t *)malloc(fb->len);
+    ok = frame->buf != NULL;
+    if (ok) {
+      memcpy(frame->buf, fb->buf, fb->len);
+      frame->len = fb->len;
+    }
+  } else if (ok) {
+    ok = frame2jpg(fb, STREAM_JPEG_QUALITY, &frame->buf, &frame->len);
+  }
+  esp_camera_fb_return(fb);
+  if (!ok) {
+    ESP_LOGE(TAG, "JPEG compression failed");
+    if (frame) {
+      free(frame->buf);
+      free(frame);
+    }
+    return NULL;
+  }
+  frame->part_len = snprintf(frame->part, sizeof(frame->part), _STREAM_PART,
+                             frame->len);
+  frame->refs = 1; // 采集任务自己的引用
+  return frame;
+}
+
+// 把新帧放进每个客户端的槽位，槽位里还没开始发的旧帧直接丢弃
+static void publish(shared_frame_t *frame) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    stream_client_t *c = &s_clients[i];
+    if (c->fd < 0) {
+      continue;
+    }
+    if (c->pending) {
+      frame_unref(c->pending);
+      c->dropped++;
+    }
+    frame->refs++;
+    c->pending = frame;
+  }
+  frame_unref(frame);
+  xSemaphoreGive(s_lock);
+  xTaskNotifyGive(s_send_task);
+}
+
+static void log_fps(uint32_t frames, float secs) {
+  ESP_LOGI(TAG, "Capture: %.1f fps", frames / secs);
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    stream_client_t *c = &s_clients[i];
+    if (c->fd < 0) {
+      continue;
+    }
+    ESP_LOGI(TAG, "Client %d: %.1f fps, %u dropped", c->fd,
+             (c->sent - c->log_sent) / secs, c->dropped);
+    c->log_sent = c->sent;
+  }
+  xSemaphoreGive(s_lock);
+}
+
+static void capture_task(void *arg) {
+  int64_t log_us = 0;
+  uint32_t frames = 0;
+  while (true) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int clients = client_count();
+    xSemaphoreGive(s_lock);
+    if (clients == 0) {
+      // 没有人看时不拍照，等stream_broadcast_attach()叫醒
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      log_us = esp_timer_get_time();
+      frames = 0;
+      continue;
+    }
+
+    shared_frame_t *frame = capture_frame();
+    if (!frame) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    publish(frame);
+    frames++;
+
+    int64_t now = esp_timer_get_time();
+    if (now - log_us >= STREAM_FPS_LOG_S * 1000000LL) {
+      log_fps(frames, (now - log_us) / 1e6f);
+      log_us = now;
+      frames = 0;
+    }
+  }
+}
+
+// 非阻塞写，返回写出的字节数；socket写满返回0，出错返回-1
+static int write_some(int fd, const void *data, size_t len) {
+  int n = send(fd, data, len, MSG_DONTWAIT);
+  if (n < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+  return n;
+}
+
+// 尽可能多地往客户端写数据
+// 返回: 0 没有数据要发, 1 socket写满了, -1 出错
+static int pump(stream_client_t *c) {
+  while (true) {
+    if (!c->sending) {
+      if (!c->pending) {
+        return 0;
+      }
+      c->sending = c->pending;
+      c->pending = NULL;
+      c->offset = 0;
+    }
+
+    shared_frame_t *frame = c->sending;
+    int n;
+    if (c->offset < frame->part_len) {
+      n = write_some(c->fd, frame->part + c->offset,
+                     frame->part_len - c->offset);
+    } else {
+      size_t pos = c->offset - frame->part_len;
+      n = write_some(c->fd, frame->buf + pos, frame->len - pos);
+    }
+    if (n <= 0) {
+      return n < 0 ? -1 : 1;
+    }
+    c->offset += n;
+    c->bytes += n;
+    if (c->offset == frame->part_len + frame->len) {
+      c->sent++;
+      c->sending = NULL;
+      frame_unref(frame);
+    }
+  }
+}
+
+static void send_task(void *arg) {
+  while (true) {
+    fd_set wfds;
+    int maxfd = -1;
+    int closing[STREAM_MAX_CLIENTS];
+    httpd_handle_t closing_hd[STREAM_MAX_CLIENTS];
+    int closing_count = 0;
+
+    FD_ZERO(&wfds);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+      stream_client_t *c = &s_clients[i];
+      if (c->fd < 0) {
+        continue;
+      }
+      int r = pump(c);
+      if (r < 0) {
+        closing[closing_count] = c->fd;
+        closing_hd[closing_count] = c->hd;
+        closing_count++;
+        release_client(c);
+      } else if (r > 0) {
+        FD_SET(c->fd, &wfds);
+        if (c->fd > maxfd) {
+          maxfd = c->fd;
+        }
+      }
+    }
+    xSemaphoreGive(s_lock);
+
+    // 不能在持有s_lock时关闭：close_fn也要拿s_lock
+    for (int i = 0; i < closing_count; i++) {
+      httpd_sess_trigger_close(closing_hd[i], closing[i]);
+    }
+
+    if (maxfd >= 0) {
+      // 等待发不动的socket变为可写；其他客户端的新帧最多晚
+      // SELECT_TIMEOUT_US发出
+      struct timeval tv = {.tv_sec = 0, .tv_usec = SELECT_TIMEOUT_US};
+      select(maxfd + 1, NULL, &wfds, NULL, &tv);
+      ulTaskNotifyTake(pdTRUE, 0);
+    } else {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+  }
+}
+
+esp_err_t stream_broadcast_init(void) {
+  if (s_lock) {
+    return ESP_OK;
+  }
+  for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+    s_clients[i].fd = -1;
+  }
+  s_lock = xSemaphoreCreateMutex();
+  if (!s_lock) {
+    return ESP_ERR_NO_MEM;
+  }
+  // 采集压缩在core 1，网络发送在core 0
+  if (xTaskCreatePinnedToCore(capture_task, "stream_cap", 4096, NULL, 5,
+                              &s_capture_task, 1) != pdPASS ||
+      xTaskCreatePinnedToCore(send_task, "stream_send", 4096, NULL, 5,
+                              &s_send_task, 0) != pdPASS) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t stream_broadcast_attach(httpd_handle_t hd, int fd) {
+  xSemaphoreTake(s_lock, portMAX_DELAY);
+  stream_client_t *c = find_client(-1);
+  if (c) {
+    c->fd = fd;
+    c->hd = hd;
+    c->connected_us = esp_timer_get_time();
+  }
+  xSemaphoreGive(s_lock);
+  if (!c) {
+    ESP_LOGW(TAG, "Too many clients, rejecting %d", fd);
+    return ESP_ERR_NO_MEM;
+  }
+  ESP_LOGI(TAG, "Client %d joined", fd);
+  xTaskNotifyGive(s_capture_task);
+  return ESP_OK;
+}
+
+void stream_broadcast_close_fn(httpd_handle_t hd, int fd) {
+  // 先让发送任务放开这个socket，再关闭
+  if (s_lock) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    stream_client_t *c = find_client(fd);
+    if (c) {
+      release_client(c);
+    }
+    xSemaphoreGive(s_lock);
+  }
+  close(fd);
+}
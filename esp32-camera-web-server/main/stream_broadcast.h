@@ -0,0 +1,28 @@
+#ifndef STREAM_BROADCAST_H_
+#define STREAM_BROADCAST_H_
+
+#include "esp_http_server.h"
+
+// 多个浏览器同时看视频流
+//
+// 采集任务每拍一帧只压缩一次JPEG，所有客户端共享这一帧（引用计数）。
+// 每个客户端一个深度为1的发送槽位，新帧覆盖还没发出去的旧帧；发送任务
+// 用非阻塞socket轮流给每个客户端写，慢的客户端只丢自己的帧。
+//
+// The URI handler only sends the response header and attaches the socket,
+// then returns, so the httpd task is free for the next connection. Register
+// stream_broadcast_close_fn as httpd_config_t.close_fn so the send task lets
+// go of a socket before httpd closes it.
+
+#define STREAM_PART_BOUNDARY "123456789000000000000987654321"
+#define STREAM_MAX_CLIENTS 4 // 加上httpd自己的socket，不超过max_open_sockets
+#define STREAM_JPEG_QUALITY 80
+#define STREAM_FPS_LOG_S 10 // 每隔多少秒打印一次每个客户端的帧率
+
+esp_err_t stream_broadcast_init(void);
+
+// 响应头已经发出去之后调用，之后这个socket只有发送任务写
+esp_err_t stream_broadcast_attach(httpd_handle_t hd, int fd);
+void stream_broadcast_close_fn(httpd_handle_t hd, int fd);
+
+#endif